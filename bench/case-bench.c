@@ -0,0 +1,658 @@
+/*
+ * ProFTPD: case-bench -- microbenchmark for mod_case's path normalizer
+ * Copyright (c) 2004-2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ */
+
+/* Builds a synthetic directory tree, then times mod_case's path normalizer
+ * over it, outside of proftpd, for three workloads: paths which exist as
+ * given ("exact"), paths which differ from the existing ones in case
+ * ("mismatch"), and paths whose last component does not exist at all
+ * ("miss").  For each, the lookup rate, and the syscalls and pool allocations
+ * made per lookup, are reported.
+ *
+ * mod_case.c is compiled in directly, against the stand-in proftpd API in
+ * stub.c.  Build, in the mod_case directory, with:
+ *
+ *   cc -O2 -Ibench -o case-bench bench/case-bench.c bench/stub.c
+ */
+
+#include "conf.h"
+
+#if defined(__linux__)
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <sys/inotify.h>
+#endif
+
+/* The system calls which mod_case makes directly are counted here; those
+ * made via the pr_fsio API are counted by stub.c.
+ */
+static int bench_open(const char *path, int flags, ...) {
+  va_list ap;
+  mode_t mode;
+
+  va_start(ap, flags);
+  mode = (mode_t) va_arg(ap, int);
+  va_end(ap);
+
+  bench_nsyscalls++;
+  return open(path, flags, mode);
+}
+
+static int bench_openat(int dirfd, const char *path, int flags, ...) {
+  va_list ap;
+  mode_t mode;
+
+  va_start(ap, flags);
+  mode = (mode_t) va_arg(ap, int);
+  va_end(ap);
+
+  bench_nsyscalls++;
+  return openat(dirfd, path, flags, mode);
+}
+
+static int bench_close(int fd) {
+  bench_nsyscalls++;
+  return close(fd);
+}
+
+static ssize_t bench_read(int fd, void *buf, size_t bufsz) {
+  bench_nsyscalls++;
+  return read(fd, buf, bufsz);
+}
+
+static int bench_fstat(int fd, struct stat *st) {
+  bench_nsyscalls++;
+  return fstat(fd, st);
+}
+
+static int bench_fstatat(int dirfd, const char *path, struct stat *st,
+    int flags) {
+  bench_nsyscalls++;
+  return fstatat(dirfd, path, st, flags);
+}
+
+#if defined(__linux__)
+/* Defined after mod_case.c, for its FS_CASEFOLD_FL. */
+static int bench_ioctl(int fd, unsigned long req, int *flags);
+#endif /* __linux__ */
+
+#if defined(SYS_getdents64)
+static long bench_getdents(long nr, int fd, void *buf, size_t bufsz) {
+  bench_nsyscalls++;
+  return syscall(nr, fd, buf, bufsz);
+}
+#endif /* SYS_getdents64 */
+
+#define open(...)		bench_open(__VA_ARGS__)
+#define openat(...)		bench_openat(__VA_ARGS__)
+#define close(fd)		bench_close(fd)
+#define read(fd, buf, sz)	bench_read((fd), (buf), (sz))
+#define fstat(fd, st)		bench_fstat((fd), (st))
+#define fstatat(fd, p, st, fl)	bench_fstatat((fd), (p), (st), (fl))
+#if defined(__linux__)
+# define ioctl(fd, req, flags)	bench_ioctl((fd), (req), (flags))
+#endif /* __linux__ */
+#if defined(SYS_getdents64)
+# define syscall(nr, fd, buf, sz) bench_getdents((nr), (fd), (buf), (sz))
+#endif /* SYS_getdents64 */
+
+#include "../mod_case.c"
+
+#undef open
+#undef openat
+#undef close
+#undef read
+#undef fstat
+#undef fstatat
+#undef ioctl
+#undef syscall
+
+/* With -F, every directory is reported to be casefolded, as if marked with
+ * "chattr +F", so that the CaseCasefold short-circuit can be measured, and
+ * checked, on any filesystem.
+ */
+static int mock_casefold = FALSE;
+
+#if defined(__linux__)
+static int bench_ioctl(int fd, unsigned long req, int *flags) {
+  bench_nsyscalls++;
+
+# if defined(CASE_USE_CASEFOLD)
+  if (mock_casefold &&
+      req == FS_IOC_GETFLAGS) {
+    *flags = FS_CASEFOLD_FL;
+    return 0;
+  }
+# endif /* CASE_USE_CASEFOLD */
+
+  return ioctl(fd, req, flags);
+}
+#endif /* __linux__ */
+
+#define BENCH_DEFAULT_DEPTH		3
+#define BENCH_DEFAULT_FANOUT		4
+#define BENCH_DEFAULT_ENTRIES		100
+#define BENCH_DEFAULT_LOOKUPS		100000
+
+/* The number of distinct paths looked up, in turn, per workload. */
+#define BENCH_MAX_PATHS			4096
+
+static const char *program = "case-bench";
+
+static unsigned int tree_depth = BENCH_DEFAULT_DEPTH;
+static unsigned int tree_fanout = BENCH_DEFAULT_FANOUT;
+static unsigned int tree_entries = BENCH_DEFAULT_ENTRIES;
+static unsigned int tree_collisions = 0;
+static unsigned long nlookups = BENCH_DEFAULT_LOOKUPS;
+static unsigned int seed = 1;
+static int json = FALSE;
+
+struct bench_result {
+  const char *workload;
+  unsigned long nlookups;
+  unsigned long nchanged;
+  unsigned long nsyscalls;
+  unsigned long nallocs;
+  double secs;
+};
+
+static cmd_rec *bench_cmd(pool *p, const char *line) {
+  cmd_rec *cmd;
+  array_header *argv;
+  char *dup, *word;
+
+  cmd = pcalloc(p, sizeof(cmd_rec));
+  cmd->pool = p;
+  cmd->tmp_pool = make_sub_pool(p);
+  cmd->notes = pr_table_alloc(p, 0);
+
+  dup = pstrdup(p, line);
+  argv = make_array(p, 4, sizeof(char *));
+  while ((word = pr_str_get_word(&dup, 0)) != NULL) {
+    *((char **) push_array(argv)) = pstrdup(p, word);
+  }
+
+  cmd->argc = argv->nelts;
+  *((char **) push_array(argv)) = NULL;
+  cmd->argv = argv->elts;
+
+  return cmd;
+}
+
+/* Applies a configuration directive, e.g. "CaseCache off", as if it had been
+ * read from proftpd.conf.
+ */
+static int bench_config(const char *line) {
+  cmd_rec *cmd;
+  conftable *tab;
+
+  cmd = bench_cmd(permanent_pool, line);
+  if (cmd->argc == 0) {
+    return 0;
+  }
+
+  for (tab = case_conftab; tab->directive != NULL; tab++) {
+    if (strcasecmp(tab->directive, cmd->argv[0]) == 0) {
+      cmd->argv[0] = (char *) tab->directive;
+      if (tab->handler(cmd) == NULL) {
+        return -1;
+      }
+
+      return 0;
+    }
+  }
+
+  fprintf(stderr, "%s: unknown directive: %s\n", program,
+    (char *) cmd->argv[0]);
+  return -1;
+}
+
+static const char *bench_dir_name(char *buf, size_t bufsz, unsigned int idx) {
+  snprintf(buf, bufsz, "Dir_%03u", idx);
+  return buf;
+}
+
+static const char *bench_file_name(char *buf, size_t bufsz,
+    unsigned int idx) {
+  snprintf(buf, bufsz, "File_%06u.Dat", idx);
+  return buf;
+}
+
+static int bench_touch(const char *path) {
+  int fd;
+
+  fd = open(path, O_CREAT|O_WRONLY, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "%s: error creating '%s': %s\n", program, path,
+      strerror(errno));
+    return -1;
+  }
+
+  (void) close(fd);
+  return 0;
+}
+
+/* The cached indexes of directories modified in the current second are not
+ * trusted, and so are rebuilt on every lookup; the directories of the tree
+ * are thus made older than that, once populated, lest the timed lookups all
+ * take the cold path.
+ */
+static int bench_age_dir(const char *dir) {
+  struct timeval tvs[2];
+
+  gettimeofday(&tvs[0], NULL);
+  tvs[0].tv_sec -= 10;
+  tvs[0].tv_usec = 0;
+  tvs[1] = tvs[0];
+
+  if (utimes(dir, tvs) < 0) {
+    fprintf(stderr, "%s: error setting times of '%s': %s\n", program, dir,
+      strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Creates `tree_entries` files in the given directory, and, above the given
+ * depth, `tree_fanout` subdirectories, each populated in turn.  For the
+ * given percentage of files, a second name, differing only in case, is
+ * created as well.
+ */
+static int bench_make_tree(const char *dir, unsigned int depth) {
+  register unsigned int i;
+  char name[64], path[PR_TUNABLE_PATH_MAX+1];
+
+  for (i = 0; i < tree_entries; i++) {
+    snprintf(path, sizeof(path), "%s/%s", dir,
+      bench_file_name(name, sizeof(name), i));
+    if (bench_touch(path) < 0) {
+      return -1;
+    }
+
+    if (tree_collisions > 0 &&
+        (unsigned int) (rand() % 100) < tree_collisions) {
+      char *ptr;
+
+      for (ptr = path + strlen(dir) + 1; *ptr; ptr++) {
+        *ptr = tolower((int) *ptr);
+      }
+
+      if (bench_touch(path) < 0) {
+        return -1;
+      }
+    }
+  }
+
+  if (depth == tree_depth) {
+    return bench_age_dir(dir);
+  }
+
+  for (i = 0; i < tree_fanout; i++) {
+    snprintf(path, sizeof(path), "%s/%s", dir,
+      bench_dir_name(name, sizeof(name), i));
+    if (mkdir(path, 0755) < 0) {
+      fprintf(stderr, "%s: error creating '%s': %s\n", program, path,
+        strerror(errno));
+      return -1;
+    }
+
+    if (bench_make_tree(path, depth + 1) < 0) {
+      return -1;
+    }
+  }
+
+  return bench_age_dir(dir);
+}
+
+/* Picks a random existing file, at a random depth, as a relative path. */
+static char *bench_random_path(pool *p) {
+  register unsigned int i;
+  unsigned int depth;
+  char name[64], *path = "";
+
+  depth = tree_fanout > 0 ? (unsigned int) rand() % (tree_depth + 1) : 0;
+  for (i = 0; i < depth; i++) {
+    path = pstrcat(p, path,
+      bench_dir_name(name, sizeof(name), rand() % tree_fanout), "/", NULL);
+  }
+
+  return pstrcat(p, path,
+    bench_file_name(name, sizeof(name), rand() % tree_entries), NULL);
+}
+
+static char **bench_make_paths(pool *p, const char *workload,
+    unsigned int npaths) {
+  register unsigned int i;
+  char **paths;
+
+  paths = pcalloc(p, npaths * sizeof(char *));
+
+  for (i = 0; i < npaths; i++) {
+    char *path, *ptr;
+
+    path = bench_random_path(p);
+
+    if (strcmp(workload, "mismatch") == 0) {
+      for (ptr = path; *ptr; ptr++) {
+        *ptr = toupper((int) *ptr);
+      }
+
+    } else if (strcmp(workload, "miss") == 0) {
+      ptr = strrchr(path, '/');
+      path = pstrcat(p, ptr != NULL ? pstrndup(p, path, ptr - path + 1) : "",
+        "NoSuchFile.Dat", NULL);
+    }
+
+    paths[i] = path;
+  }
+
+  return paths;
+}
+
+static double bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+}
+
+static void bench_run(const char *workload, struct bench_result *res) {
+  register unsigned long i;
+  unsigned int npaths;
+  pool *paths_pool, *tmp_pool;
+  char **paths;
+  double start;
+
+  npaths = nlookups < BENCH_MAX_PATHS ? nlookups : BENCH_MAX_PATHS;
+  paths_pool = make_sub_pool(permanent_pool);
+  paths = bench_make_paths(paths_pool, workload, npaths);
+  tmp_pool = make_sub_pool(permanent_pool);
+
+  /* One untimed pass over the paths first, so that what is measured is the
+   * steady state, with whatever caches are configured populated.
+   */
+  for (i = 0; i < npaths; i++) {
+    int changed = FALSE;
+
+    (void) case_normalize_path(tmp_pool, paths[i], &changed, NULL);
+    clear_pool(tmp_pool);
+  }
+
+  memset(res, 0, sizeof(struct bench_result));
+  res->workload = workload;
+  res->nlookups = nlookups;
+
+  bench_nsyscalls = bench_nallocs = 0;
+  start = bench_now();
+
+  for (i = 0; i < nlookups; i++) {
+    int changed = FALSE;
+
+    (void) case_normalize_path(tmp_pool, paths[i % npaths], &changed, NULL);
+    if (changed) {
+      res->nchanged++;
+    }
+
+    clear_pool(tmp_pool);
+  }
+
+  res->secs = bench_now() - start;
+  res->nsyscalls = bench_nsyscalls;
+  res->nallocs = bench_nallocs;
+
+  destroy_pool(tmp_pool);
+  destroy_pool(paths_pool);
+}
+
+static void bench_report(struct bench_result *res) {
+  double rate, syscalls, allocs;
+
+  rate = res->secs > 0 ? res->nlookups / res->secs : 0;
+  syscalls = (double) res->nsyscalls / res->nlookups;
+  allocs = (double) res->nallocs / res->nlookups;
+
+  if (json) {
+    fprintf(stdout, "{\"workload\":\"%s\",\"depth\":%u,\"fanout\":%u,"
+      "\"entries\":%u,\"collisions\":%u,\"lookups\":%lu,\"changed\":%lu,"
+      "\"secs\":%.6f,\"lookups_per_sec\":%.1f,\"syscalls_per_lookup\":%.3f,"
+      "\"allocs_per_lookup\":%.3f}\n", res->workload, tree_depth,
+      tree_fanout, tree_entries, tree_collisions, res->nlookups,
+      res->nchanged, res->secs, rate, syscalls, allocs);
+
+  } else {
+    fprintf(stdout, "%-10s %10lu %10lu %14.1f %16.3f %14.3f\n", res->workload,
+      res->nlookups, res->nchanged, rate, syscalls, allocs);
+  }
+}
+
+static void usage(void) {
+  fprintf(stdout,
+    "usage: %s [options] [workload ...]\n\n"
+    "Times mod_case's path normalizer over a synthetic directory tree, for\n"
+    "the given workloads: exact, mismatch, miss (default: all three).\n\n"
+    "  -c pct    Percentage of files which also have a name differing only\n"
+    "            in case (default 0)\n"
+    "  -d depth  Depth of the directory tree (default %u)\n"
+    "  -F        Report every directory as casefolded, with CaseCasefold on,\n"
+    "            and fail if any directory is scanned\n"
+    "  -f count  Subdirectories per directory (default %u)\n"
+    "  -h        Show this message\n"
+    "  -j        Report as JSON, one object per line\n"
+    "  -k        Keep the directory tree afterwards\n"
+    "  -l count  Lookups per workload (default %u)\n"
+    "  -n count  Files per directory (default %u)\n"
+    "  -o conf   Apply the given mod_case directive, e.g. \"CaseCache off\";\n"
+    "            may be repeated\n"
+    "  -s seed   Random seed (default 1)\n"
+    "  -t path   Directory in which to build the tree (default $TMPDIR, or\n"
+    "            /tmp)\n",
+    program, BENCH_DEFAULT_DEPTH, BENCH_DEFAULT_FANOUT, BENCH_DEFAULT_LOOKUPS,
+    BENCH_DEFAULT_ENTRIES);
+}
+
+int main(int argc, char *argv[]) {
+  register int i;
+  int c, keep = FALSE, res = 0;
+  const char *tmp_dir, *workloads[] = { "exact", "mismatch", "miss", NULL };
+  char root[PR_TUNABLE_PATH_MAX+1];
+  array_header *configs;
+
+  permanent_pool = make_sub_pool(NULL);
+  main_server = pcalloc(permanent_pool, sizeof(server_rec));
+  session.pool = make_sub_pool(permanent_pool);
+  session.notes = pr_table_alloc(session.pool, 0);
+  session.pid = getpid();
+
+  configs = make_array(permanent_pool, 4, sizeof(char *));
+  *((char **) push_array(configs)) = "CaseEngine on";
+  *((char **) push_array(configs)) = "CaseIgnore on";
+
+  tmp_dir = getenv("TMPDIR");
+  if (tmp_dir == NULL) {
+    tmp_dir = "/tmp";
+  }
+
+  while ((c = getopt(argc, argv, "c:d:f:Fhjkl:n:o:s:t:")) != -1) {
+    switch (c) {
+      case 'c':
+        tree_collisions = strtoul(optarg, NULL, 10);
+        if (tree_collisions > 100) {
+          fprintf(stderr, "%s: invalid collision percentage: %s\n", program,
+            optarg);
+          return 1;
+        }
+        break;
+
+      case 'd':
+        tree_depth = strtoul(optarg, NULL, 10);
+        break;
+
+      case 'f':
+        tree_fanout = strtoul(optarg, NULL, 10);
+        break;
+
+      case 'F':
+#if defined(CASE_USE_CASEFOLD)
+        mock_casefold = TRUE;
+        *((char **) push_array(configs)) = "CaseCasefold on";
+#else
+        fprintf(stderr, "%s: casefolding is not supported here\n", program);
+        return 1;
+#endif /* CASE_USE_CASEFOLD */
+        break;
+
+      case 'h':
+        usage();
+        return 0;
+
+      case 'j':
+        json = TRUE;
+        break;
+
+      case 'k':
+        keep = TRUE;
+        break;
+
+      case 'l':
+        nlookups = strtoul(optarg, NULL, 10);
+        if (nlookups < 1) {
+          fprintf(stderr, "%s: invalid number of lookups: %s\n", program,
+            optarg);
+          return 1;
+        }
+        break;
+
+      case 'n':
+        tree_entries = strtoul(optarg, NULL, 10);
+        if (tree_entries < 1) {
+          fprintf(stderr, "%s: invalid number of files: %s\n", program,
+            optarg);
+          return 1;
+        }
+        break;
+
+      case 'o':
+        *((char **) push_array(configs)) = optarg;
+        break;
+
+      case 's':
+        seed = strtoul(optarg, NULL, 10);
+        break;
+
+      case 't':
+        tmp_dir = optarg;
+        break;
+
+      default:
+        usage();
+        return 1;
+    }
+  }
+
+  for (i = optind; i < argc; i++) {
+    if (strcmp(argv[i], "exact") != 0 &&
+        strcmp(argv[i], "mismatch") != 0 &&
+        strcmp(argv[i], "miss") != 0) {
+      fprintf(stderr, "%s: unknown workload: %s\n", program, argv[i]);
+      return 1;
+    }
+  }
+
+  for (i = 0; i < (int) configs->nelts; i++) {
+    if (bench_config(((char **) configs->elts)[i]) < 0) {
+      fprintf(stderr, "%s: bad configuration: %s\n", program,
+        ((char **) configs->elts)[i]);
+      return 1;
+    }
+  }
+
+  snprintf(root, sizeof(root), "%s/case-bench.XXXXXX", tmp_dir);
+  if (mkdtemp(root) == NULL) {
+    fprintf(stderr, "%s: error creating directory in '%s': %s\n", program,
+      tmp_dir, strerror(errno));
+    return 1;
+  }
+
+  srand(seed);
+  if (bench_make_tree(root, 0) < 0 ||
+      chdir(root) < 0) {
+    res = 1;
+    goto done;
+  }
+
+  if (case_module.init != NULL) {
+    case_module.init();
+  }
+  pr_event_generate("core.postparse", NULL);
+  if (case_module.sess_init() < 0) {
+    fprintf(stderr, "%s: error initializing mod_case\n", program);
+    res = 1;
+    goto done;
+  }
+
+  if (!json) {
+    fprintf(stdout, "%-10s %10s %10s %14s %16s %14s\n", "workload",
+      "lookups", "changed", "lookups/sec", "syscalls/lookup",
+      "allocs/lookup");
+  }
+
+  if (optind == argc) {
+    for (i = 0; workloads[i] != NULL; i++) {
+      struct bench_result result;
+
+      bench_run(workloads[i], &result);
+      bench_report(&result);
+    }
+
+  } else {
+    for (i = optind; i < argc; i++) {
+      struct bench_result result;
+
+      bench_run(argv[i], &result);
+      bench_report(&result);
+    }
+  }
+
+  /* Names not found as given in a casefolded directory do not exist in any
+   * case, so there is nothing to scan.
+   */
+  if (mock_casefold &&
+      case_stats->scans > 0) {
+    fprintf(stderr, "%s: %lu directories scanned, despite casefolding\n",
+      program, case_stats->scans);
+    res = 1;
+  }
+
+  pr_event_generate("core.exit", NULL);
+
+ done:
+  if (!keep) {
+    char *cmd;
+
+    cmd = pstrcat(permanent_pool, "rm -rf '", root, "'", NULL);
+    if (system(cmd) != 0) {
+      fprintf(stderr, "%s: error removing '%s'\n", program, root);
+    }
+
+  } else {
+    fprintf(stderr, "%s: tree kept in '%s'\n", program, root);
+  }
+
+  return res;
+}
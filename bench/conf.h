@@ -0,0 +1,446 @@
+/*
+ * ProFTPD: mod_case benchmark -- stand-in for proftpd's conf.h
+ * Copyright (c) 2004-2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ */
+
+/* Just enough of the proftpd API for mod_case.c to be compiled, and its
+ * path normalizer driven, outside of proftpd; see case-bench.c.  The
+ * implementations, in stub.c, are deliberately simple, and count the
+ * allocations and filesystem calls made.
+ */
+
+#ifndef CASE_BENCH_CONF_H
+#define CASE_BENCH_CONF_H
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROFTPD_VERSION_NUMBER		0x0001030901
+
+#define PR_TUNABLE_PATH_MAX		PATH_MAX
+#define PR_TUNABLE_BUFFER_SIZE		1024
+
+#ifndef TRUE
+# define TRUE				1
+#endif
+
+#ifndef FALSE
+# define FALSE				0
+#endif
+
+/* Pools */
+typedef struct pool_rec pool;
+
+struct pool_rec {
+  void *first;
+  struct pool_rec *parent, *children, *next;
+  const char *tag;
+};
+
+extern pool *permanent_pool;
+
+pool *make_sub_pool(pool *);
+void destroy_pool(pool *);
+void clear_pool(pool *);
+void pr_pool_tag(pool *, const char *);
+void *palloc(pool *, size_t);
+void *pcalloc(pool *, size_t);
+char *pstrdup(pool *, const char *);
+char *pstrndup(pool *, const char *, size_t);
+char *pstrcat(pool *, ...);
+char *pdircat(pool *, ...);
+char *sstrncpy(char *, const char *, size_t);
+
+typedef struct {
+  pool *pool;
+  unsigned int elt_size;
+  unsigned int nelts;
+  unsigned int nalloc;
+  void *elts;
+} array_header;
+
+array_header *make_array(pool *, unsigned int, size_t);
+void *push_array(array_header *);
+
+/* Tables */
+typedef struct table_rec pr_table_t;
+
+pr_table_t *pr_table_alloc(pool *, int);
+pr_table_t *pr_table_nalloc(pool *, int, unsigned int);
+int pr_table_add(pr_table_t *, const char *, const void *, size_t);
+int pr_table_add_dup(pr_table_t *, const char *, const void *, size_t);
+int pr_table_set(pr_table_t *, const char *, const void *, size_t);
+const void *pr_table_get(pr_table_t *, const char *, size_t *);
+const void *pr_table_remove(pr_table_t *, const char *, size_t *);
+int pr_table_kadd(pr_table_t *, const void *, size_t, const void *, size_t);
+const void *pr_table_kget(pr_table_t *, const void *, size_t, size_t *);
+const void *pr_table_kremove(pr_table_t *, const void *, size_t, size_t *);
+int pr_table_exists(pr_table_t *, const char *);
+int pr_table_count(pr_table_t *);
+int pr_table_empty(pr_table_t *);
+int pr_table_free(pr_table_t *);
+
+/* Configuration */
+#define CONF_ROOT			0x0001
+#define CONF_DIR			0x0002
+#define CONF_ANON			0x0004
+#define CONF_LIMIT			0x0008
+#define CONF_VIRTUAL			0x0010
+#define CONF_DYNDIR			0x0020
+#define CONF_GLOBAL			0x0040
+#define CONF_CLASS			0x0080
+#define CONF_PARAM			0x8000
+
+#define CF_MERGEDOWN			0x0001
+#define CF_MERGEDOWN_MULTI		0x0002
+
+typedef struct config_struc {
+  struct config_struc *next;
+  int config_type;
+  pool *pool;
+  char *name;
+  int argc;
+  void **argv;
+  long flags;
+} config_rec;
+
+typedef struct xaset {
+  config_rec *xas_list;
+} xaset_t;
+
+typedef struct server_struc {
+  pool *pool;
+  xaset_t *conf;
+  const char *ServerName;
+  unsigned int sid;
+} server_rec;
+
+extern server_rec *main_server;
+
+typedef struct cmd_struc {
+  pool *pool;
+  server_rec *server;
+  config_rec *config;
+  pool *tmp_pool;
+  unsigned int argc;
+  char *arg;
+  void **argv;
+  char *group;
+  int cmd_class;
+  pr_table_t *notes;
+  int cmd_id;
+} cmd_rec;
+
+typedef struct {
+  int flags;
+  int mr_error;
+  void *data;
+} modret_t;
+
+#define MODRET				static modret_t *
+#define PR_DECLINED(cmd)		((modret_t *) NULL)
+#define PR_HANDLED(cmd)			(&bench_handled)
+#define PR_ERROR_MSG(cmd, n, m)		((modret_t *) NULL)
+
+extern modret_t bench_handled;
+
+modret_t *bench_conf_error(cmd_rec *, const char *);
+#define CONF_ERROR(cmd, msg)		return bench_conf_error((cmd), (msg))
+#define CHECK_ARGS(cmd, n) \
+  if ((cmd)->argc - 1 < (n)) CONF_ERROR((cmd), "missing parameters")
+#define CHECK_VARARGS(cmd, n, m) \
+  if ((cmd)->argc - 1 < (n) || (cmd)->argc - 1 > (m)) \
+    CONF_ERROR((cmd), "wrong number of parameters")
+#define CHECK_CONF(cmd, flags)		((void) 0)
+
+int get_boolean(cmd_rec *, int);
+config_rec *add_config_param(const char *, unsigned int, ...);
+config_rec *add_config_param_str(const char *, unsigned int, ...);
+config_rec *find_config(xaset_t *, int, const char *, int);
+config_rec *find_config_next(config_rec *, config_rec *, int, const char *,
+  int);
+
+#define CURRENT_CONF			(main_server->conf)
+
+/* Modules */
+typedef struct conftab_rec {
+  const char *directive;
+  modret_t *(*handler)(cmd_rec *);
+  void *m;
+} conftable;
+
+typedef struct cmdtab_rec {
+  int cmd_type;
+  const char *command;
+  const char *group;
+  modret_t *(*handler)(cmd_rec *);
+  int requires_auth;
+  int interrupt_xfer;
+} cmdtable;
+
+typedef struct module_struc {
+  struct module_struc *next, *prev;
+  int api_version;
+  const char *name;
+  conftable *conftable;
+  cmdtable *cmdtable;
+  void *authtable;
+  int (*init)(void);
+  int (*sess_init)(void);
+  const char *module_version;
+} module;
+
+#define PRE_CMD				1
+#define CMD				2
+#define POST_CMD			3
+#define POST_CMD_ERR			4
+#define LOG_CMD				5
+#define LOG_CMD_ERR			6
+
+#define C_ANY				"*"
+
+#define G_NONE				NULL
+#define G_READ				"READ"
+#define G_WRITE				"WRITE"
+#define G_DIRS				"DIRS"
+
+#define C_APPE				"APPE"
+#define C_CWD				"CWD"
+#define C_DELE				"DELE"
+#define C_LIST				"LIST"
+#define C_MDTM				"MDTM"
+#define C_MKD				"MKD"
+#define C_MLSD				"MLSD"
+#define C_MLST				"MLST"
+#define C_NLST				"NLST"
+#define C_RETR				"RETR"
+#define C_RMD				"RMD"
+#define C_RNFR				"RNFR"
+#define C_RNTO				"RNTO"
+#define C_SITE				"SITE"
+#define C_SIZE				"SIZE"
+#define C_STAT				"STAT"
+#define C_STOR				"STOR"
+#define C_XCWD				"XCWD"
+#define C_XMKD				"XMKD"
+#define C_XRMD				"XRMD"
+
+#define PR_CMD_APPE_ID			1
+#define PR_CMD_CWD_ID			2
+#define PR_CMD_DELE_ID			3
+#define PR_CMD_LIST_ID			4
+#define PR_CMD_MDTM_ID			5
+#define PR_CMD_MKD_ID			6
+#define PR_CMD_MLSD_ID			7
+#define PR_CMD_MLST_ID			8
+#define PR_CMD_NLST_ID			9
+#define PR_CMD_RETR_ID			10
+#define PR_CMD_RMD_ID			11
+#define PR_CMD_RNFR_ID			12
+#define PR_CMD_RNTO_ID			13
+#define PR_CMD_SITE_ID			14
+#define PR_CMD_SIZE_ID			15
+#define PR_CMD_STAT_ID			16
+#define PR_CMD_STOR_ID			17
+#define PR_CMD_XCWD_ID			18
+#define PR_CMD_XMKD_ID			19
+#define PR_CMD_XRMD_ID			20
+
+int pr_cmd_get_id(const char *);
+int pr_cmd_cmp(cmd_rec *, int);
+int pr_cmd_strcmp(cmd_rec *, const char *);
+int pr_cmd_clear_cache(cmd_rec *);
+
+array_header *pr_expr_create(pool *, unsigned int *, char **);
+array_header *pr_str_text_to_array(pool *, const char *, char);
+char *pr_str_get_word(char **, int);
+#define PR_STR_FL_PRESERVE_COMMENTS	0x0001
+int pr_str2uint64(const char *, uint64_t *);
+int pr_snprintf(char *, size_t, const char *, ...);
+const char *pr_strtime(time_t);
+
+/* Filesystem */
+typedef struct fh_rec {
+  pool *fh_pool;
+  int fh_fd;
+  char *fh_path;
+  struct fs_rec *fh_fs;
+} pr_fh_t;
+
+#define PR_FH_FD(fh)			((fh)->fh_fd)
+
+#define PR_OPEN_MODE			0666
+
+typedef struct fs_rec {
+  struct fs_rec *fs_next, *fs_prev;
+  char *fs_name;
+  char *fs_path;
+  void *fs_data;
+  pool *fs_pool;
+  int allow_xdev_link, allow_xdev_rename, non_std_path;
+
+  int (*stat)(struct fs_rec *, const char *, struct stat *);
+  int (*fstat)(pr_fh_t *, int, struct stat *);
+  int (*lstat)(struct fs_rec *, const char *, struct stat *);
+  int (*rename)(struct fs_rec *, const char *, const char *);
+  int (*unlink)(struct fs_rec *, const char *);
+  int (*open)(pr_fh_t *, const char *, int);
+  int (*close)(pr_fh_t *, int);
+  int (*read)(pr_fh_t *, int, char *, size_t);
+  int (*write)(pr_fh_t *, int, const char *, size_t);
+  off_t (*lseek)(pr_fh_t *, int, off_t, int);
+  int (*link)(struct fs_rec *, const char *, const char *);
+  int (*readlink)(struct fs_rec *, const char *, char *, size_t);
+  int (*symlink)(struct fs_rec *, const char *, const char *);
+  int (*ftruncate)(pr_fh_t *, int, off_t);
+  int (*truncate)(struct fs_rec *, const char *, off_t);
+  int (*chmod)(struct fs_rec *, const char *, mode_t);
+  int (*fchmod)(pr_fh_t *, int, mode_t);
+  int (*chown)(struct fs_rec *, const char *, uid_t, gid_t);
+  int (*fchown)(pr_fh_t *, int, uid_t, gid_t);
+  int (*lchown)(struct fs_rec *, const char *, uid_t, gid_t);
+  int (*access)(struct fs_rec *, const char *, int, uid_t, gid_t,
+    array_header *);
+  int (*faccess)(pr_fh_t *, int, uid_t, gid_t, array_header *);
+  int (*utimes)(struct fs_rec *, const char *, struct timeval *);
+  int (*futimes)(pr_fh_t *, int, struct timeval *);
+  int (*fsync)(pr_fh_t *, int);
+  int (*chdir)(struct fs_rec *, const char *);
+  int (*chroot)(struct fs_rec *, const char *);
+  void *(*opendir)(struct fs_rec *, const char *);
+  int (*closedir)(struct fs_rec *, void *);
+  struct dirent *(*readdir)(struct fs_rec *, void *);
+  int (*mkdir)(struct fs_rec *, const char *, mode_t);
+  int (*rmdir)(struct fs_rec *, const char *);
+} pr_fs_t;
+
+pr_fs_t *pr_get_fs(const char *, int *);
+pr_fs_t *pr_register_fs(pool *, const char *, const char *);
+int pr_unregister_fs(const char *);
+pr_fh_t *pr_fsio_open(const char *, int);
+int pr_fsio_close(pr_fh_t *);
+int pr_fsio_read(pr_fh_t *, char *, size_t);
+int pr_fsio_write(pr_fh_t *, const char *, size_t);
+int pr_fsio_stat(const char *, struct stat *);
+int pr_fsio_lstat(const char *, struct stat *);
+int pr_fsio_fstat(pr_fh_t *, struct stat *);
+int pr_fsio_fchmod(pr_fh_t *, mode_t);
+int pr_fsio_access(const char *, int, uid_t, gid_t, array_header *);
+int pr_fsio_rename(const char *, const char *);
+int pr_fsio_unlink(const char *);
+int pr_fsio_mkdir(const char *, mode_t);
+int pr_fsio_rmdir(const char *);
+void *pr_fsio_opendir(const char *);
+struct dirent *pr_fsio_readdir(void *);
+int pr_fsio_closedir(void *);
+int pr_fs_valid_path(const char *);
+const char *pr_fs_getcwd(void);
+const char *pr_fs_getvwd(void);
+char *pr_fs_decode_path(pool *, const char *);
+void pr_fs_clear_cache(void);
+int pr_fs_clear_cache2(const char *);
+char *dir_best_path(pool *, const char *);
+char *dir_abs_path(pool *, const char *, int);
+int dir_check(pool *, cmd_rec *, const char *, const char *, int *);
+int pr_fnmatch(const char *, const char *, int);
+#define PR_FNM_CASEFOLD			FNM_CASEFOLD
+
+/* Logging */
+#define PR_LOG_ERR			LOG_ERR
+#define PR_LOG_WARNING			LOG_WARNING
+#define PR_LOG_NOTICE			LOG_NOTICE
+#define PR_LOG_INFO			LOG_INFO
+
+#define DEBUG0				0
+#define DEBUG2				2
+#define DEBUG5				5
+
+int pr_trace_msg(const char *, int, const char *, ...);
+int pr_trace_get_level(const char *);
+int pr_log_openfile(const char *, int *, mode_t);
+int pr_log_writefile(int, const char *, const char *, ...);
+int pr_log_vwritefile(int, const char *, const char *, va_list);
+void pr_log_pri(int, const char *, ...);
+void pr_log_debug(int, const char *, ...);
+int pr_openlog(const char *, int, int);
+void pr_syslog(int, int, const char *, ...);
+void pr_closelog(int);
+
+/* Signals, events and timers */
+void pr_signals_handle(void);
+void pr_signals_block(void);
+void pr_signals_unblock(void);
+
+typedef void (*pr_event_cb_t)(const void *, void *);
+int pr_event_register(module *, const char *, pr_event_cb_t, void *);
+int pr_event_unregister(module *, const char *, pr_event_cb_t);
+void pr_event_generate(const char *, const void *);
+
+#define CALLBACK_FRAME	void *p1, void *p2, void *p3, void *data
+typedef int (*callback_t)(CALLBACK_FRAME);
+int pr_timer_add(int, int, module *, callback_t, const char *);
+int pr_timer_remove(int, module *);
+
+/* Session */
+struct session_rec {
+  pool *pool;
+  pr_table_t *notes;
+  uid_t uid;
+  gid_t gid;
+  const char *chroot_path;
+  const char *user;
+  cmd_rec *curr_cmd_rec;
+  config_rec *dir_config;
+  pid_t pid;
+  array_header *gids;
+};
+
+extern struct session_rec session;
+
+const char *pr_session_get_protocol(int);
+
+/* The counters kept by stub.c and case-bench.c.  An allocation is any
+ * palloc()/pcalloc() (and so pstrdup() et al), or make_sub_pool(); a
+ * syscall is any filesystem call made, whether directly by mod_case, or via
+ * the pr_fsio API.
+ */
+extern unsigned long bench_nallocs;
+extern unsigned long bench_nsyscalls;
+
+#endif /* CASE_BENCH_CONF_H */
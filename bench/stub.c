@@ -0,0 +1,1002 @@
+/*
+ * ProFTPD: mod_case benchmark -- stand-in for the proftpd API
+ * Copyright (c) 2004-2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ */
+
+/* The proftpd API which mod_case.c uses, as simply as possible.  Pool
+ * allocations are malloc(3)'d, and chained for clear_pool(); tables are
+ * linked lists; the pr_fsio API calls the system directly.  Allocations, and
+ * pr_fsio calls, are counted.
+ */
+
+#include "conf.h"
+
+pool *permanent_pool = NULL;
+server_rec *main_server = NULL;
+struct session_rec session;
+modret_t bench_handled;
+
+unsigned long bench_nallocs = 0;
+unsigned long bench_nsyscalls = 0;
+
+/* Pools */
+
+struct pool_blk {
+  struct pool_blk *next;
+  union {
+    long double ld;
+    void *ptr;
+  } align;
+};
+
+pool *make_sub_pool(pool *parent) {
+  pool *p;
+
+  p = calloc(1, sizeof(pool));
+  if (p == NULL) {
+    abort();
+  }
+
+  bench_nallocs++;
+
+  p->parent = parent;
+  if (parent != NULL) {
+    p->next = parent->children;
+    parent->children = p;
+  }
+
+  return p;
+}
+
+void clear_pool(pool *p) {
+  struct pool_blk *blk;
+
+  while (p->children != NULL) {
+    destroy_pool(p->children);
+  }
+
+  blk = p->first;
+  while (blk != NULL) {
+    struct pool_blk *next;
+
+    next = blk->next;
+    free(blk);
+    blk = next;
+  }
+
+  p->first = NULL;
+}
+
+void destroy_pool(pool *p) {
+  if (p == NULL) {
+    return;
+  }
+
+  clear_pool(p);
+
+  if (p->parent != NULL) {
+    pool **pp;
+
+    for (pp = &(p->parent->children); *pp != NULL; pp = &((*pp)->next)) {
+      if (*pp == p) {
+        *pp = p->next;
+        break;
+      }
+    }
+  }
+
+  free(p);
+}
+
+void pr_pool_tag(pool *p, const char *tag) {
+  p->tag = tag;
+}
+
+void *palloc(pool *p, size_t sz) {
+  struct pool_blk *blk;
+
+  blk = malloc(sizeof(struct pool_blk) + sz);
+  if (blk == NULL) {
+    abort();
+  }
+
+  bench_nallocs++;
+
+  blk->next = p->first;
+  p->first = blk;
+
+  return &(blk->align);
+}
+
+void *pcalloc(pool *p, size_t sz) {
+  void *res;
+
+  res = palloc(p, sz);
+  memset(res, 0, sz);
+  return res;
+}
+
+char *pstrdup(pool *p, const char *str) {
+  return pstrndup(p, str, strlen(str));
+}
+
+char *pstrndup(pool *p, const char *str, size_t n) {
+  char *res;
+  size_t len;
+
+  len = strnlen(str, n);
+  res = palloc(p, len + 1);
+  memcpy(res, str, len);
+  res[len] = '\0';
+
+  return res;
+}
+
+char *pstrcat(pool *p, ...) {
+  va_list ap;
+  char *res, *str;
+  size_t len = 0;
+
+  va_start(ap, p);
+  while ((str = va_arg(ap, char *)) != NULL) {
+    len += strlen(str);
+  }
+  va_end(ap);
+
+  res = palloc(p, len + 1);
+  *res = '\0';
+
+  va_start(ap, p);
+  while ((str = va_arg(ap, char *)) != NULL) {
+    strcat(res, str);
+  }
+  va_end(ap);
+
+  return res;
+}
+
+char *pdircat(pool *p, ...) {
+  va_list ap;
+  char *res, *str;
+  size_t len = 0;
+
+  va_start(ap, p);
+  while ((str = va_arg(ap, char *)) != NULL) {
+    len += strlen(str) + 1;
+  }
+  va_end(ap);
+
+  res = palloc(p, len + 1);
+  *res = '\0';
+
+  va_start(ap, p);
+  while ((str = va_arg(ap, char *)) != NULL) {
+    size_t res_len;
+
+    res_len = strlen(res);
+    if (res_len > 0) {
+      if (res[res_len-1] != '/' &&
+          *str != '/') {
+        strcat(res, "/");
+
+      } else if (res[res_len-1] == '/' &&
+                 *str == '/') {
+        str++;
+      }
+    }
+
+    strcat(res, str);
+  }
+  va_end(ap);
+
+  return res;
+}
+
+char *sstrncpy(char *dst, const char *src, size_t n) {
+  if (n == 0) {
+    return dst;
+  }
+
+  strncpy(dst, src, n - 1);
+  dst[n-1] = '\0';
+  return dst;
+}
+
+array_header *make_array(pool *p, unsigned int nelts, size_t elt_size) {
+  array_header *arr;
+
+  if (nelts < 1) {
+    nelts = 1;
+  }
+
+  arr = pcalloc(p, sizeof(array_header));
+  arr->pool = p;
+  arr->elt_size = elt_size;
+  arr->nalloc = nelts;
+  arr->elts = pcalloc(p, nelts * elt_size);
+
+  return arr;
+}
+
+void *push_array(array_header *arr) {
+  if (arr->nelts == arr->nalloc) {
+    void *elts;
+
+    elts = pcalloc(arr->pool, arr->nalloc * 2 * arr->elt_size);
+    memcpy(elts, arr->elts, arr->nalloc * arr->elt_size);
+    arr->elts = elts;
+    arr->nalloc *= 2;
+  }
+
+  return ((char *) arr->elts) + (arr->elt_size * arr->nelts++);
+}
+
+/* Tables */
+
+struct table_ent {
+  struct table_ent *next;
+  void *key;
+  size_t keysz;
+  const void *val;
+  size_t valsz;
+};
+
+struct table_rec {
+  pool *pool;
+  struct table_ent *head;
+  int nents;
+};
+
+pr_table_t *pr_table_alloc(pool *p, int flags) {
+  pr_table_t *tab;
+
+  tab = pcalloc(p, sizeof(pr_table_t));
+  tab->pool = p;
+  return tab;
+}
+
+pr_table_t *pr_table_nalloc(pool *p, int flags, unsigned int nchains) {
+  return pr_table_alloc(p, flags);
+}
+
+static struct table_ent *table_find(pr_table_t *tab, const void *key,
+    size_t keysz) {
+  struct table_ent *ent;
+
+  for (ent = tab->head; ent != NULL; ent = ent->next) {
+    if (ent->keysz == keysz &&
+        memcmp(ent->key, key, keysz) == 0) {
+      return ent;
+    }
+  }
+
+  return NULL;
+}
+
+int pr_table_kadd(pr_table_t *tab, const void *key, size_t keysz,
+    const void *val, size_t valsz) {
+  struct table_ent *ent;
+
+  if (tab == NULL ||
+      key == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (table_find(tab, key, keysz) != NULL) {
+    errno = EEXIST;
+    return -1;
+  }
+
+  ent = malloc(sizeof(struct table_ent));
+  ent->key = malloc(keysz);
+  memcpy(ent->key, key, keysz);
+  ent->keysz = keysz;
+  ent->val = val;
+  ent->valsz = valsz;
+  bench_nallocs += 2;
+
+  ent->next = tab->head;
+  tab->head = ent;
+  tab->nents++;
+
+  return 0;
+}
+
+const void *pr_table_kget(pr_table_t *tab, const void *key, size_t keysz,
+    size_t *valsz) {
+  struct table_ent *ent;
+
+  ent = table_find(tab, key, keysz);
+  if (ent == NULL) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  if (valsz != NULL) {
+    *valsz = ent->valsz;
+  }
+
+  return ent->val;
+}
+
+const void *pr_table_kremove(pr_table_t *tab, const void *key, size_t keysz,
+    size_t *valsz) {
+  struct table_ent **entp;
+
+  for (entp = &(tab->head); *entp != NULL; entp = &((*entp)->next)) {
+    struct table_ent *ent;
+    const void *val;
+
+    ent = *entp;
+    if (ent->keysz != keysz ||
+        memcmp(ent->key, key, keysz) != 0) {
+      continue;
+    }
+
+    val = ent->val;
+    if (valsz != NULL) {
+      *valsz = ent->valsz;
+    }
+
+    *entp = ent->next;
+    free(ent->key);
+    free(ent);
+    tab->nents--;
+
+    return val;
+  }
+
+  errno = ENOENT;
+  return NULL;
+}
+
+int pr_table_add(pr_table_t *tab, const char *key, const void *val,
+    size_t valsz) {
+  if (valsz == 0 &&
+      val != NULL) {
+    valsz = strlen(val) + 1;
+  }
+
+  return pr_table_kadd(tab, key, strlen(key) + 1, val, valsz);
+}
+
+int pr_table_add_dup(pr_table_t *tab, const char *key, const void *val,
+    size_t valsz) {
+  void *dup;
+
+  if (valsz == 0) {
+    valsz = strlen(val) + 1;
+  }
+
+  dup = palloc(tab->pool, valsz);
+  memcpy(dup, val, valsz);
+  return pr_table_add(tab, key, dup, valsz);
+}
+
+int pr_table_set(pr_table_t *tab, const char *key, const void *val,
+    size_t valsz) {
+  struct table_ent *ent;
+
+  ent = table_find(tab, key, strlen(key) + 1);
+  if (ent == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  ent->val = val;
+  ent->valsz = valsz;
+  return 0;
+}
+
+const void *pr_table_get(pr_table_t *tab, const char *key, size_t *valsz) {
+  return pr_table_kget(tab, key, strlen(key) + 1, valsz);
+}
+
+const void *pr_table_remove(pr_table_t *tab, const char *key, size_t *valsz) {
+  return pr_table_kremove(tab, key, strlen(key) + 1, valsz);
+}
+
+int pr_table_exists(pr_table_t *tab, const char *key) {
+  return table_find(tab, key, strlen(key) + 1) != NULL ? 1 : -1;
+}
+
+int pr_table_count(pr_table_t *tab) {
+  return tab->nents;
+}
+
+int pr_table_empty(pr_table_t *tab) {
+  while (tab->head != NULL) {
+    struct table_ent *ent;
+
+    ent = tab->head;
+    tab->head = ent->next;
+    free(ent->key);
+    free(ent);
+  }
+
+  tab->nents = 0;
+  return 0;
+}
+
+int pr_table_free(pr_table_t *tab) {
+  return pr_table_empty(tab);
+}
+
+/* Configuration */
+
+modret_t *bench_conf_error(cmd_rec *cmd, const char *msg) {
+  fprintf(stderr, "%s: %s\n", (char *) cmd->argv[0], msg);
+  return NULL;
+}
+
+int get_boolean(cmd_rec *cmd, int idx) {
+  const char *str;
+
+  str = cmd->argv[idx];
+  if (strcasecmp(str, "on") == 0 ||
+      strcasecmp(str, "yes") == 0 ||
+      strcasecmp(str, "true") == 0) {
+    return TRUE;
+  }
+
+  if (strcasecmp(str, "off") == 0 ||
+      strcasecmp(str, "no") == 0 ||
+      strcasecmp(str, "false") == 0) {
+    return FALSE;
+  }
+
+  return -1;
+}
+
+/* Later settings of a directive replace earlier ones; there is only the one
+ * configuration context.
+ */
+static config_rec *config_new(const char *name, unsigned int argc) {
+  config_rec *c, **cp;
+
+  if (main_server->conf == NULL) {
+    main_server->conf = pcalloc(permanent_pool, sizeof(xaset_t));
+  }
+
+  for (cp = &(main_server->conf->xas_list); *cp != NULL; cp = &((*cp)->next)) {
+    if (strcmp((*cp)->name, name) == 0) {
+      *cp = (*cp)->next;
+      break;
+    }
+  }
+
+  c = pcalloc(permanent_pool, sizeof(config_rec));
+  c->pool = make_sub_pool(permanent_pool);
+  c->config_type = CONF_PARAM;
+  c->name = pstrdup(c->pool, name);
+  c->argc = argc;
+  c->argv = pcalloc(c->pool, (argc + 1) * sizeof(void *));
+
+  c->next = main_server->conf->xas_list;
+  main_server->conf->xas_list = c;
+
+  return c;
+}
+
+config_rec *add_config_param(const char *name, unsigned int argc, ...) {
+  va_list ap;
+  config_rec *c;
+  unsigned int i;
+
+  c = config_new(name, argc);
+
+  va_start(ap, argc);
+  for (i = 0; i < argc; i++) {
+    c->argv[i] = va_arg(ap, void *);
+  }
+  va_end(ap);
+
+  return c;
+}
+
+config_rec *add_config_param_str(const char *name, unsigned int argc, ...) {
+  va_list ap;
+  config_rec *c;
+  unsigned int i;
+
+  c = config_new(name, argc);
+
+  va_start(ap, argc);
+  for (i = 0; i < argc; i++) {
+    char *str;
+
+    str = va_arg(ap, char *);
+    c->argv[i] = str != NULL ? pstrdup(c->pool, str) : NULL;
+  }
+  va_end(ap);
+
+  return c;
+}
+
+config_rec *find_config(xaset_t *set, int type, const char *name,
+    int recurse) {
+  config_rec *c;
+
+  if (set == NULL) {
+    return NULL;
+  }
+
+  for (c = set->xas_list; c != NULL; c = c->next) {
+    if (strcmp(c->name, name) == 0) {
+      return c;
+    }
+  }
+
+  return NULL;
+}
+
+config_rec *find_config_next(config_rec *prev, config_rec *c, int type,
+    const char *name, int recurse) {
+  for (c = c->next; c != NULL; c = c->next) {
+    if (strcmp(c->name, name) == 0) {
+      return c;
+    }
+  }
+
+  return NULL;
+}
+
+/* Commands */
+
+static const char *cmd_names[] = {
+  NULL, C_APPE, C_CWD, C_DELE, C_LIST, C_MDTM, C_MKD, C_MLSD, C_MLST, C_NLST,
+  C_RETR, C_RMD, C_RNFR, C_RNTO, C_SITE, C_SIZE, C_STAT, C_STOR, C_XCWD,
+  C_XMKD, C_XRMD, NULL
+};
+
+int pr_cmd_get_id(const char *name) {
+  register unsigned int i;
+
+  for (i = 1; cmd_names[i] != NULL; i++) {
+    if (strcmp(cmd_names[i], name) == 0) {
+      return i;
+    }
+  }
+
+  errno = ENOENT;
+  return -1;
+}
+
+int pr_cmd_cmp(cmd_rec *cmd, int cmd_id) {
+  if (cmd->cmd_id == 0) {
+    cmd->cmd_id = pr_cmd_get_id(cmd->argv[0]);
+  }
+
+  if (cmd->cmd_id == cmd_id) {
+    return 0;
+  }
+
+  return cmd->cmd_id < cmd_id ? -1 : 1;
+}
+
+int pr_cmd_strcmp(cmd_rec *cmd, const char *name) {
+  return strcmp(cmd->argv[0], name);
+}
+
+int pr_cmd_clear_cache(cmd_rec *cmd) {
+  return 0;
+}
+
+/* Strings */
+
+array_header *pr_expr_create(pool *p, unsigned int *argc, char **argv) {
+  array_header *list;
+  unsigned int i;
+
+  list = make_array(p, 4, sizeof(char *));
+
+  for (i = 1; i <= *argc; i++) {
+    char *str, *elt;
+
+    str = pstrdup(p, argv[i]);
+    for (elt = strtok(str, ","); elt != NULL; elt = strtok(NULL, ",")) {
+      *((char **) push_array(list)) = pstrdup(p, elt);
+    }
+  }
+
+  return list;
+}
+
+array_header *pr_str_text_to_array(pool *p, const char *text, char delim) {
+  array_header *list;
+  const char *ptr;
+
+  list = make_array(p, 4, sizeof(char *));
+
+  ptr = text;
+  while (*ptr) {
+    const char *end;
+
+    end = strchr(ptr, delim);
+    if (end == NULL) {
+      end = ptr + strlen(ptr);
+    }
+
+    if (end > ptr) {
+      *((char **) push_array(list)) = pstrndup(p, ptr, end - ptr);
+    }
+
+    ptr = *end ? end + 1 : end;
+  }
+
+  return list;
+}
+
+char *pr_str_get_word(char **cp, int flags) {
+  char *res, *dst;
+
+  if (cp == NULL ||
+      *cp == NULL ||
+      **cp == '\0') {
+    return NULL;
+  }
+
+  while (**cp == ' ') {
+    (*cp)++;
+  }
+
+  if (**cp == '\0') {
+    return NULL;
+  }
+
+  res = dst = *cp;
+  while (**cp &&
+         **cp != ' ') {
+    *dst++ = *(*cp)++;
+  }
+
+  if (**cp) {
+    (*cp)++;
+  }
+
+  *dst = '\0';
+  return res;
+}
+
+int pr_str2uint64(const char *str, uint64_t *val) {
+  char *endp = NULL;
+
+  *val = strtoull(str, &endp, 10);
+  return (endp != NULL && *endp) ? -1 : 0;
+}
+
+int pr_snprintf(char *buf, size_t bufsz, const char *fmt, ...) {
+  va_list ap;
+  int res;
+
+  va_start(ap, fmt);
+  res = vsnprintf(buf, bufsz, fmt, ap);
+  va_end(ap);
+
+  return res;
+}
+
+const char *pr_strtime(time_t t) {
+  static char buf[64];
+  struct tm *tm;
+
+  tm = localtime(&t);
+  strftime(buf, sizeof(buf), "%a %b %d %H:%M:%S %Y", tm);
+  return buf;
+}
+
+/* Filesystem; there is only the system filesystem. */
+
+static pr_fs_t system_fs = { NULL, NULL, "system", "/" };
+
+pr_fs_t *pr_get_fs(const char *path, int *exact) {
+  if (exact != NULL) {
+    *exact = FALSE;
+  }
+
+  return &system_fs;
+}
+
+pr_fs_t *pr_register_fs(pool *p, const char *name, const char *path) {
+  errno = EPERM;
+  return NULL;
+}
+
+int pr_unregister_fs(const char *path) {
+  errno = ENOENT;
+  return -1;
+}
+
+pr_fh_t *pr_fsio_open(const char *path, int flags) {
+  pr_fh_t *fh;
+  int fd;
+
+  bench_nsyscalls++;
+  fd = open(path, flags, 0666);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  fh = calloc(1, sizeof(pr_fh_t));
+  fh->fh_fd = fd;
+  return fh;
+}
+
+int pr_fsio_close(pr_fh_t *fh) {
+  int res;
+
+  bench_nsyscalls++;
+  res = close(fh->fh_fd);
+  free(fh);
+  return res;
+}
+
+int pr_fsio_read(pr_fh_t *fh, char *buf, size_t bufsz) {
+  bench_nsyscalls++;
+  return read(fh->fh_fd, buf, bufsz);
+}
+
+int pr_fsio_write(pr_fh_t *fh, const char *buf, size_t bufsz) {
+  bench_nsyscalls++;
+  return write(fh->fh_fd, buf, bufsz);
+}
+
+int pr_fsio_stat(const char *path, struct stat *st) {
+  bench_nsyscalls++;
+  return stat(path, st);
+}
+
+int pr_fsio_lstat(const char *path, struct stat *st) {
+  bench_nsyscalls++;
+  return lstat(path, st);
+}
+
+int pr_fsio_fstat(pr_fh_t *fh, struct stat *st) {
+  bench_nsyscalls++;
+  return fstat(fh->fh_fd, st);
+}
+
+int pr_fsio_fchmod(pr_fh_t *fh, mode_t mode) {
+  bench_nsyscalls++;
+  return fchmod(fh->fh_fd, mode);
+}
+
+int pr_fsio_access(const char *path, int mode, uid_t uid, gid_t gid,
+    array_header *suppl_gids) {
+  bench_nsyscalls++;
+  return access(path, mode);
+}
+
+int pr_fsio_rename(const char *from, const char *to) {
+  bench_nsyscalls++;
+  return rename(from, to);
+}
+
+int pr_fsio_unlink(const char *path) {
+  bench_nsyscalls++;
+  return unlink(path);
+}
+
+int pr_fsio_mkdir(const char *path, mode_t mode) {
+  bench_nsyscalls++;
+  return mkdir(path, mode);
+}
+
+int pr_fsio_rmdir(const char *path) {
+  bench_nsyscalls++;
+  return rmdir(path);
+}
+
+/* Each opendir(3) is an open(2), and each closedir(3) a close(2); the
+ * getdents(2) calls made by readdir(3) are not seen here, so they are not
+ * counted.
+ */
+void *pr_fsio_opendir(const char *path) {
+  bench_nsyscalls++;
+  return opendir(path);
+}
+
+struct dirent *pr_fsio_readdir(void *dirh) {
+  return readdir(dirh);
+}
+
+int pr_fsio_closedir(void *dirh) {
+  bench_nsyscalls++;
+  return closedir(dirh);
+}
+
+int pr_fs_valid_path(const char *path) {
+  return *path == '/' ? 0 : -1;
+}
+
+const char *pr_fs_getcwd(void) {
+  static char cwd[PR_TUNABLE_PATH_MAX+1];
+
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    return NULL;
+  }
+
+  return cwd;
+}
+
+const char *pr_fs_getvwd(void) {
+  return pr_fs_getcwd();
+}
+
+char *pr_fs_decode_path(pool *p, const char *path) {
+  return (char *) path;
+}
+
+void pr_fs_clear_cache(void) {
+}
+
+int pr_fs_clear_cache2(const char *path) {
+  return 0;
+}
+
+char *dir_best_path(pool *p, const char *path) {
+  if (*path == '/') {
+    return pstrdup(p, path);
+  }
+
+  return pdircat(p, pr_fs_getcwd(), path, NULL);
+}
+
+char *dir_abs_path(pool *p, const char *path, int interpolate) {
+  return dir_best_path(p, path);
+}
+
+/* No <Directory> sections, HideFiles or <Limit>s are configured. */
+int dir_check(pool *p, cmd_rec *cmd, const char *group, const char *path,
+    int *hidden) {
+  if (hidden != NULL) {
+    *hidden = FALSE;
+  }
+
+  return 1;
+}
+
+int pr_fnmatch(const char *pattern, const char *str, int flags) {
+  return fnmatch(pattern, str, flags);
+}
+
+/* Logging; trace messages are discarded, log files written as usual. */
+
+int pr_trace_msg(const char *channel, int level, const char *fmt, ...) {
+  return 0;
+}
+
+int pr_trace_get_level(const char *channel) {
+  return 0;
+}
+
+int pr_log_openfile(const char *path, int *fd, mode_t mode) {
+  *fd = open(path, O_WRONLY|O_CREAT|O_APPEND, mode);
+  return *fd < 0 ? -1 : 0;
+}
+
+int pr_log_vwritefile(int fd, const char *ident, const char *fmt,
+    va_list msg) {
+  char buf[PR_TUNABLE_BUFFER_SIZE];
+  int len;
+
+  len = snprintf(buf, sizeof(buf), "%s[%u]: ", ident, (unsigned int) getpid());
+  len += vsnprintf(buf + len, sizeof(buf) - len - 1, fmt, msg);
+  if (len > (int) sizeof(buf) - 1) {
+    len = sizeof(buf) - 1;
+  }
+  buf[len++] = '\n';
+
+  return write(fd, buf, len) < 0 ? -1 : 0;
+}
+
+int pr_log_writefile(int fd, const char *ident, const char *fmt, ...) {
+  va_list msg;
+  int res;
+
+  va_start(msg, fmt);
+  res = pr_log_vwritefile(fd, ident, fmt, msg);
+  va_end(msg);
+
+  return res;
+}
+
+void pr_log_pri(int priority, const char *fmt, ...) {
+}
+
+void pr_log_debug(int level, const char *fmt, ...) {
+}
+
+int pr_openlog(const char *ident, int opts, int facility) {
+  openlog(ident, opts, facility);
+  return 0;
+}
+
+void pr_syslog(int fd, int priority, const char *fmt, ...) {
+  va_list msg;
+
+  va_start(msg, fmt);
+  vsyslog(priority, fmt, msg);
+  va_end(msg);
+}
+
+void pr_closelog(int fd) {
+  closelog();
+}
+
+/* Signals, events and timers; timers never fire. */
+
+void pr_signals_handle(void) {
+}
+
+void pr_signals_block(void) {
+}
+
+void pr_signals_unblock(void) {
+}
+
+#define BENCH_MAX_EVENTS	32
+
+static struct {
+  const char *event;
+  pr_event_cb_t cb;
+  void *user_data;
+} events[BENCH_MAX_EVENTS];
+static unsigned int nevents = 0;
+
+int pr_event_register(module *m, const char *event, pr_event_cb_t cb,
+    void *user_data) {
+  if (nevents == BENCH_MAX_EVENTS) {
+    errno = ENOSPC;
+    return -1;
+  }
+
+  events[nevents].event = event;
+  events[nevents].cb = cb;
+  events[nevents].user_data = user_data;
+  nevents++;
+
+  return 0;
+}
+
+int pr_event_unregister(module *m, const char *event, pr_event_cb_t cb) {
+  return 0;
+}
+
+void pr_event_generate(const char *event, const void *event_data) {
+  register unsigned int i;
+
+  for (i = 0; i < nevents; i++) {
+    if (strcmp(events[i].event, event) == 0) {
+      events[i].cb(event_data, events[i].user_data);
+    }
+  }
+}
+
+int pr_timer_add(int interval, int timerno, module *m, callback_t cb,
+    const char *desc) {
+  return timerno > 0 ? timerno : 1;
+}
+
+int pr_timer_remove(int timerno, module *m) {
+  return 0;
+}
+
+const char *pr_session_get_protocol(int flags) {
+  return "ftp";
+}
@@ -0,0 +1,884 @@
+/*
+ * ProFTPD: ftpcaseindex -- builds mod_case's on-disk directory indexes
+ * Copyright (c) 2004-2025 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ */
+
+/* Walks directory trees, writing the CaseIndex indexes (see mod_case.h) of
+ * their large directories ahead of time, so that no FTP session has to.
+ * Directories are read in parallel by a pool of worker threads.
+ *
+ * Build with:
+ *
+ *   cc -o ftpcaseindex ftpcaseindex.c -lpthread
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mod_case.h"
+
+#define FTPCASEINDEX_MAX_THREADS	64
+
+struct index_job {
+  struct index_job *next;
+  char *path;
+
+  /* The length of the top-level path given on the command line, which is
+   * the only part of the path in which symlinks are followed.
+   */
+  size_t root_len;
+
+  /* Whether to queue the directory's subdirectories as well. */
+  int recurse;
+
+  /* Whether this is the directory's last chance to be indexed; a directory
+   * which changed too recently is retried once, later.
+   */
+  int last_try;
+};
+
+struct name_list {
+  char *buf;
+  size_t buflen, bufsz;
+
+  size_t *offsets;
+  size_t count, max_count;
+};
+
+static const char *program = "ftpcaseindex";
+
+/* Options */
+static const char *index_dir = NULL;
+static int index_dir_fd = -1;
+static unsigned long min_entries = CASE_INDEX_DEFAULT_MIN_ENTRIES;
+static int incremental = 0;
+static int verbose = 0;
+
+static unsigned char fold_tab[256];
+static uint32_t fold_hash = 0;
+
+/* The work queue, and the directories to retry once the pool is done. */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct index_job *queue_head = NULL, *queue_tail = NULL;
+static unsigned long queue_pending = 0;
+static struct index_job *retry_head = NULL;
+static time_t retry_after = 0;
+
+/* Statistics, updated under the queue lock. */
+static unsigned long ndirs_read = 0;
+static unsigned long ndirs_indexed = 0;
+static unsigned long ndirs_current = 0;
+static unsigned long ndirs_failed = 0;
+static unsigned long long nentries_read = 0;
+static unsigned long long nnames_indexed = 0;
+
+static uint32_t index_fnv1a(const unsigned char *data, size_t len) {
+  register size_t i;
+  uint32_t hash = CASE_INDEX_FNV_OFFSET;
+
+  for (i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= CASE_INDEX_FNV_PRIME;
+  }
+
+  return hash;
+}
+
+static uint32_t index_name_hash(const char *name) {
+  register const unsigned char *ptr;
+  uint32_t hash = CASE_INDEX_FNV_OFFSET;
+
+  for (ptr = (const unsigned char *) name; *ptr; ptr++) {
+    hash ^= fold_tab[*ptr];
+    hash *= CASE_INDEX_FNV_PRIME;
+  }
+
+  return hash;
+}
+
+static void *xmalloc(size_t len) {
+  void *ptr;
+
+  ptr = malloc(len);
+  if (ptr == NULL) {
+    fprintf(stderr, "%s: out of memory\n", program);
+    exit(1);
+  }
+
+  return ptr;
+}
+
+static void *xrealloc(void *ptr, size_t len) {
+  ptr = realloc(ptr, len);
+  if (ptr == NULL) {
+    fprintf(stderr, "%s: out of memory\n", program);
+    exit(1);
+  }
+
+  return ptr;
+}
+
+static char *path_join(const char *dir, const char *name) {
+  size_t dir_len, name_len;
+  char *path;
+
+  dir_len = strlen(dir);
+  name_len = strlen(name);
+
+  path = xmalloc(dir_len + name_len + 2);
+  memcpy(path, dir, dir_len);
+  if (dir_len == 0 ||
+      dir[dir_len-1] != '/') {
+    path[dir_len++] = '/';
+  }
+  memcpy(path + dir_len, name, name_len + 1);
+
+  return path;
+}
+
+static void names_add(struct name_list *names, const char *name) {
+  size_t len;
+
+  len = strlen(name) + 1;
+  if (names->buflen + len > names->bufsz) {
+    names->bufsz = (names->bufsz + len) * 2;
+    names->buf = xrealloc(names->buf, names->bufsz);
+  }
+
+  if (names->count == names->max_count) {
+    names->max_count = names->max_count ? names->max_count * 2 : 1024;
+    names->offsets = xrealloc(names->offsets,
+      names->max_count * sizeof(size_t));
+  }
+
+  memcpy(names->buf + names->buflen, name, len);
+  names->offsets[names->count++] = names->buflen;
+  names->buflen += len;
+}
+
+static void names_free(struct name_list *names) {
+  free(names->buf);
+  free(names->offsets);
+  memset(names, 0, sizeof(struct name_list));
+}
+
+static void queue_push(const char *path, size_t root_len, int recurse,
+    int last_try) {
+  struct index_job *job;
+
+  job = xmalloc(sizeof(struct index_job));
+  job->next = NULL;
+  job->path = strdup(path);
+  job->root_len = root_len;
+  job->recurse = recurse;
+  job->last_try = last_try;
+
+  pthread_mutex_lock(&queue_lock);
+  if (queue_tail != NULL) {
+    queue_tail->next = job;
+
+  } else {
+    queue_head = job;
+  }
+  queue_tail = job;
+  queue_pending++;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+}
+
+/* Opens the job's directory: the top-level path as given, and then each
+ * component below it without following symlinks, so that a directory which
+ * is replaced by a symlink while the tree is read is not followed out of the
+ * tree.
+ */
+static int open_job_dir(const struct index_job *job) {
+  char *root, *rel, *name, *next = NULL;
+  int fd;
+
+  root = xmalloc(job->root_len + 1);
+  memcpy(root, job->path, job->root_len);
+  root[job->root_len] = '\0';
+
+  fd = open(root, O_RDONLY|O_DIRECTORY);
+  free(root);
+
+  if (fd < 0) {
+    return -1;
+  }
+
+  rel = strdup(job->path + job->root_len);
+  for (name = strtok_r(rel, "/", &next); name != NULL;
+       name = strtok_r(NULL, "/", &next)) {
+    int sub_fd, xerrno;
+
+    sub_fd = openat(fd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW);
+    xerrno = errno;
+
+    (void) close(fd);
+
+    if (sub_fd < 0) {
+      free(rel);
+      errno = xerrno;
+      return -1;
+    }
+
+    fd = sub_fd;
+  }
+
+  free(rel);
+  return fd;
+}
+
+/* Opens the directory in which the index of the given directory is kept, and
+ * sets `name` to the index's name in it.  The sidecar directory is in a
+ * directory which its owner can change at will, so it is opened relative to
+ * the directory, without following symlinks, and only used if it belongs to
+ * the directory's owner (or to us).  If `created` is not NULL, a missing
+ * sidecar directory is created, and `created` set; the directory has then
+ * changed, and -1 is returned.
+ */
+static int index_open_dir(int dir_fd, const struct stat *dir_st, char *name,
+    size_t namesz, int *created) {
+  struct stat st;
+  int fd;
+
+  if (index_dir != NULL) {
+    snprintf(name, namesz, "%llx-%llx.idx", (unsigned long long) dir_st->st_dev,
+      (unsigned long long) dir_st->st_ino);
+    return dup(index_dir_fd);
+  }
+
+  snprintf(name, namesz, "%s", CASE_INDEX_SIDECAR_FILE);
+
+  if (created != NULL) {
+    if (mkdirat(dir_fd, CASE_INDEX_SIDECAR_DIR, 0755) == 0) {
+      if (geteuid() == 0) {
+        (void) fchownat(dir_fd, CASE_INDEX_SIDECAR_DIR, dir_st->st_uid,
+          dir_st->st_gid, AT_SYMLINK_NOFOLLOW);
+      }
+
+      *created = 1;
+      return -1;
+    }
+
+    if (errno != EEXIST) {
+      return -1;
+    }
+  }
+
+  fd = openat(dir_fd, CASE_INDEX_SIDECAR_DIR, O_RDONLY|O_DIRECTORY|O_NOFOLLOW);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (fstat(fd, &st) < 0 ||
+      (st.st_uid != dir_st->st_uid &&
+       st.st_uid != geteuid())) {
+    (void) close(fd);
+    errno = EPERM;
+    return -1;
+  }
+
+  return fd;
+}
+
+/* Returns 1 if the directory's existing index is still valid, else 0. */
+static int index_is_current(int dir_fd, const struct stat *dir_st) {
+  struct case_index_header hdr;
+  char name[64];
+  int fd, index_fd, res = 0;
+
+  index_fd = index_open_dir(dir_fd, dir_st, name, sizeof(name), NULL);
+  if (index_fd < 0) {
+    return 0;
+  }
+
+  fd = openat(index_fd, name, O_RDONLY|O_NOFOLLOW);
+  (void) close(index_fd);
+
+  if (fd < 0) {
+    return 0;
+  }
+
+  if (read(fd, &hdr, sizeof(hdr)) == (ssize_t) sizeof(hdr) &&
+      hdr.magic == CASE_INDEX_MAGIC &&
+      hdr.version == CASE_INDEX_VERSION &&
+      hdr.fold_hash == fold_hash &&
+      hdr.dir_dev == (uint64_t) dir_st->st_dev &&
+      hdr.dir_ino == (uint64_t) dir_st->st_ino &&
+      hdr.dir_mtime == (int64_t) dir_st->st_mtime &&
+      hdr.dir_mtime < hdr.built) {
+    res = 1;
+  }
+
+  (void) close(fd);
+  return res;
+}
+
+/* Writes the index, named `name`, in the directory open as `index_fd`.
+ * Returns the number of names indexed, or -1 on error.
+ */
+static long index_write(int index_fd, const char *name,
+    const struct stat *dir_st, time_t built, struct name_list *names) {
+  register size_t i;
+  char *buf, *name_tab, tmp_name[128];
+  struct case_index_header *hdr;
+  struct case_index_slot *slots;
+  uint32_t nslots, nnames = 0, name_off = 1, mask;
+  size_t buflen, written = 0;
+  int fd, xerrno;
+
+  nslots = 16;
+  while (nslots < names->count * 2) {
+    nslots *= 2;
+  }
+  mask = nslots - 1;
+
+  buflen = sizeof(struct case_index_header) +
+    (nslots * sizeof(struct case_index_slot)) + names->buflen + 1;
+  buf = calloc(1, buflen);
+  if (buf == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  hdr = (struct case_index_header *) buf;
+  slots = (struct case_index_slot *) (hdr + 1);
+  name_tab = (char *) (slots + nslots);
+
+  for (i = 0; i < names->count; i++) {
+    const char *entry;
+    uint32_t hash, j;
+    size_t entry_len;
+
+    entry = names->buf + names->offsets[i];
+    hash = index_name_hash(entry);
+
+    for (j = hash & mask; slots[j].name_off != 0; j = (j + 1) & mask) {
+      if (slots[j].hash == hash &&
+          strcasecmp(name_tab + slots[j].name_off, entry) == 0) {
+        break;
+      }
+    }
+
+    if (slots[j].name_off != 0) {
+      continue;
+    }
+
+    entry_len = strlen(entry) + 1;
+    memcpy(name_tab + name_off, entry, entry_len);
+    slots[j].hash = hash;
+    slots[j].name_off = name_off;
+    name_off += entry_len;
+    nnames++;
+  }
+
+  buflen = sizeof(struct case_index_header) +
+    (nslots * sizeof(struct case_index_slot)) + name_off;
+
+  hdr->magic = CASE_INDEX_MAGIC;
+  hdr->version = CASE_INDEX_VERSION;
+  hdr->fold_hash = fold_hash;
+  hdr->dir_dev = (uint64_t) dir_st->st_dev;
+  hdr->dir_ino = (uint64_t) dir_st->st_ino;
+  hdr->dir_mtime = (int64_t) dir_st->st_mtime;
+  hdr->built = (int64_t) built;
+  hdr->nslots = nslots;
+  hdr->nnames = nnames;
+  hdr->names_len = name_off;
+  hdr->checksum = index_fnv1a((unsigned char *) slots,
+    buflen - sizeof(struct case_index_header));
+
+  snprintf(tmp_name, sizeof(tmp_name), "%s.%lu.tmp", name,
+    (unsigned long) getpid());
+
+  fd = openat(index_fd, tmp_name, O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW, 0644);
+  if (fd < 0) {
+    xerrno = errno;
+    free(buf);
+
+    errno = xerrno;
+    return -1;
+  }
+
+  /* Sessions rebuild stale indexes as their own users; let the owner of the
+   * directory replace this one.
+   */
+  if (geteuid() == 0) {
+    (void) fchown(fd, dir_st->st_uid, dir_st->st_gid);
+  }
+
+  while (written < buflen) {
+    ssize_t res;
+
+    res = write(fd, buf + written, buflen - written);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      break;
+    }
+
+    written += res;
+  }
+
+  xerrno = errno;
+  free(buf);
+
+  if (close(fd) < 0 &&
+      written == buflen) {
+    xerrno = errno;
+    written = 0;
+  }
+
+  if (written < buflen ||
+      renameat(index_fd, tmp_name, index_fd, name) < 0) {
+    if (written == buflen) {
+      xerrno = errno;
+    }
+
+    (void) unlinkat(index_fd, tmp_name, 0);
+
+    errno = xerrno;
+    return -1;
+  }
+
+  return (long) nnames;
+}
+
+static void index_dir_job(struct index_job *job) {
+  struct stat dir_st;
+  struct name_list names;
+  struct dirent *dent;
+  DIR *dirh = NULL;
+  time_t built;
+  char index_name[64];
+  int fd, index_fd, current = 0, retry = 0, failed = 0;
+  unsigned long long nread = 0;
+  long nindexed = -1;
+
+  memset(&names, 0, sizeof(names));
+
+  /* Note when reading started before reading, so that changes made while
+   * reading invalidate the index.
+   */
+  built = time(NULL);
+
+  fd = open_job_dir(job);
+  if (fd < 0) {
+    fprintf(stderr, "%s: unable to open '%s': %s\n", program, job->path,
+      strerror(errno));
+    failed = 1;
+    goto done;
+  }
+
+  if (fstat(fd, &dir_st) < 0) {
+    fprintf(stderr, "%s: unable to stat '%s': %s\n", program, job->path,
+      strerror(errno));
+    (void) close(fd);
+    failed = 1;
+    goto done;
+  }
+
+  if (incremental &&
+      index_is_current(fd, &dir_st)) {
+    current = 1;
+  }
+
+  dirh = fdopendir(fd);
+  if (dirh == NULL) {
+    fprintf(stderr, "%s: unable to read '%s': %s\n", program, job->path,
+      strerror(errno));
+    (void) close(fd);
+    failed = 1;
+    goto done;
+  }
+
+  while ((dent = readdir(dirh)) != NULL) {
+    nread++;
+
+    if (current == 0) {
+      names_add(&names, dent->d_name);
+    }
+
+    if (job->recurse == 0 ||
+        strcmp(dent->d_name, ".") == 0 ||
+        strcmp(dent->d_name, "..") == 0 ||
+        strcmp(dent->d_name, CASE_INDEX_SIDECAR_DIR) == 0) {
+      continue;
+    }
+
+#if defined(DT_DIR) && defined(DT_UNKNOWN)
+    if (dent->d_type != DT_DIR &&
+        dent->d_type != DT_UNKNOWN) {
+      continue;
+    }
+#endif
+
+    {
+      struct stat st;
+
+      /* Do not follow symlinks out of the tree. */
+      if (fstatat(dirfd(dirh), dent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+          S_ISDIR(st.st_mode)) {
+        char *sub_path;
+
+        sub_path = path_join(job->path, dent->d_name);
+        queue_push(sub_path, job->root_len, 1, job->last_try);
+        free(sub_path);
+      }
+    }
+  }
+
+  if (current ||
+      names.count < min_entries) {
+    goto done;
+  }
+
+  if (dir_st.st_mtime >= built) {
+    /* The directory changed in this second; changes later in the same
+     * second would not change its mtime, so try again later.
+     */
+    if (job->last_try == 0) {
+      retry = 1;
+
+    } else if (verbose) {
+      printf("%s: '%s' changed too recently to index\n", program, job->path);
+    }
+
+    goto done;
+  }
+
+  {
+    int created = 0;
+
+    index_fd = index_open_dir(dirfd(dirh), &dir_st, index_name,
+      sizeof(index_name), &created);
+    if (created) {
+      /* Creating the index directory has just changed the directory. */
+      retry = (job->last_try == 0);
+      goto done;
+    }
+  }
+
+  if (index_fd < 0) {
+    fprintf(stderr, "%s: unable to open index directory for '%s': %s\n",
+      program, job->path, strerror(errno));
+    failed = 1;
+    goto done;
+  }
+
+  nindexed = index_write(index_fd, index_name, &dir_st, built, &names);
+  if (nindexed < 0) {
+    fprintf(stderr, "%s: unable to write index for '%s': %s\n", program,
+      job->path, strerror(errno));
+    (void) close(index_fd);
+    failed = 1;
+    goto done;
+  }
+
+  (void) close(index_fd);
+
+  if (verbose) {
+    printf("%s: indexed %ld names in '%s'\n", program, nindexed, job->path);
+  }
+
+ done:
+  if (dirh != NULL) {
+    (void) closedir(dirh);
+  }
+  names_free(&names);
+
+  pthread_mutex_lock(&queue_lock);
+  ndirs_read++;
+  nentries_read += nread;
+
+  if (failed) {
+    ndirs_failed++;
+
+  } else if (current) {
+    ndirs_current++;
+
+  } else if (nindexed >= 0) {
+    ndirs_indexed++;
+    nnames_indexed += nindexed;
+  }
+
+  if (retry) {
+    struct index_job *retry_job;
+
+    retry_job = xmalloc(sizeof(struct index_job));
+    retry_job->path = strdup(job->path);
+    retry_job->root_len = job->root_len;
+    retry_job->recurse = 0;
+    retry_job->last_try = 1;
+    retry_job->next = retry_head;
+    retry_head = retry_job;
+
+    if (built > retry_after) {
+      retry_after = built;
+    }
+  }
+  pthread_mutex_unlock(&queue_lock);
+}
+
+static void *index_worker(void *arg) {
+  (void) arg;
+
+  while (1) {
+    struct index_job *job;
+
+    pthread_mutex_lock(&queue_lock);
+    while (queue_head == NULL &&
+           queue_pending > 0) {
+      pthread_cond_wait(&queue_cond, &queue_lock);
+    }
+
+    job = queue_head;
+    if (job == NULL) {
+      /* Nothing queued, and nothing being read which could queue more. */
+      pthread_cond_broadcast(&queue_cond);
+      pthread_mutex_unlock(&queue_lock);
+      break;
+    }
+
+    queue_head = job->next;
+    if (queue_head == NULL) {
+      queue_tail = NULL;
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    index_dir_job(job);
+    free(job->path);
+    free(job);
+
+    pthread_mutex_lock(&queue_lock);
+    queue_pending--;
+    if (queue_pending == 0) {
+      pthread_cond_broadcast(&queue_cond);
+    }
+    pthread_mutex_unlock(&queue_lock);
+  }
+
+  return NULL;
+}
+
+static int run_workers(unsigned int nthreads) {
+  register unsigned int i;
+  pthread_t threads[FTPCASEINDEX_MAX_THREADS];
+  unsigned int nstarted = 0;
+
+  for (i = 0; i < nthreads; i++) {
+    int res;
+
+    /* pthread_create(3) returns its error, rather than setting errno. */
+    res = pthread_create(&threads[i], NULL, index_worker, NULL);
+    if (res != 0) {
+      fprintf(stderr, "%s: unable to start worker thread: %s\n", program,
+        strerror(res));
+      break;
+    }
+
+    nstarted++;
+  }
+
+  if (nstarted == 0) {
+    /* Do the work ourselves, then. */
+    index_worker(NULL);
+    return 0;
+  }
+
+  for (i = 0; i < nstarted; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  return 0;
+}
+
+static void usage(void) {
+  fprintf(stdout,
+    "usage: %s [options] path ...\n\n"
+    "Writes mod_case CaseIndex indexes for the large directories under the\n"
+    "given paths.\n\n"
+    "  -d path   Write indexes to the given directory, as configured for\n"
+    "            CaseIndex, rather than into each indexed directory\n"
+    "  -h        Show this message\n"
+    "  -i        Incremental: only rebuild indexes whose directories have\n"
+    "            changed\n"
+    "  -m count  Only index directories with at least this many entries\n"
+    "            (default %d)\n"
+    "  -n        Do not descend into subdirectories\n"
+    "  -t count  Number of worker threads (default: number of CPUs)\n"
+    "  -v        Report each directory indexed\n",
+    program, CASE_INDEX_DEFAULT_MIN_ENTRIES);
+}
+
+int main(int argc, char *argv[]) {
+  register int i;
+  int c, recurse = 1;
+  long nthreads = 0;
+  char *ptr;
+  struct timeval start, end;
+  double secs;
+
+  while ((c = getopt(argc, argv, "d:him:nt:v")) != -1) {
+    switch (c) {
+      case 'd':
+        if (*optarg != '/') {
+          fprintf(stderr, "%s: index directory '%s' is not an absolute path\n",
+            program, optarg);
+          return 1;
+        }
+        index_dir = optarg;
+        break;
+
+      case 'h':
+        usage();
+        return 0;
+
+      case 'i':
+        incremental = 1;
+        break;
+
+      case 'm':
+        ptr = NULL;
+        min_entries = strtoul(optarg, &ptr, 10);
+        if (*optarg == '\0' ||
+            *optarg == '-' ||
+            *ptr != '\0' ||
+            min_entries < 1) {
+          fprintf(stderr, "%s: invalid minimum entries: %s\n", program,
+            optarg);
+          return 1;
+        }
+        break;
+
+      case 'n':
+        recurse = 0;
+        break;
+
+      case 't':
+        ptr = NULL;
+        nthreads = strtol(optarg, &ptr, 10);
+        if (*ptr != '\0' ||
+            nthreads < 1 ||
+            nthreads > FTPCASEINDEX_MAX_THREADS) {
+          fprintf(stderr, "%s: invalid number of threads: %s\n", program,
+            optarg);
+          return 1;
+        }
+        break;
+
+      case 'v':
+        verbose = 1;
+        break;
+
+      default:
+        usage();
+        return 1;
+    }
+  }
+
+  if (optind == argc) {
+    usage();
+    return 1;
+  }
+
+  if (nthreads == 0) {
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) {
+      nthreads = 1;
+
+    } else if (nthreads > FTPCASEINDEX_MAX_THREADS) {
+      nthreads = FTPCASEINDEX_MAX_THREADS;
+    }
+  }
+
+  /* Names are folded as by proftpd, which must thus run in the same
+   * locale; mod_case ignores indexes written with a different folding.
+   */
+  (void) setlocale(LC_CTYPE, "");
+  for (i = 0; i < (int) sizeof(fold_tab); i++) {
+    fold_tab[i] = (unsigned char) tolower(i);
+  }
+  fold_hash = index_fnv1a(fold_tab, sizeof(fold_tab));
+
+  if (index_dir != NULL) {
+    index_dir_fd = open(index_dir, O_RDONLY|O_DIRECTORY);
+    if (index_dir_fd < 0) {
+      fprintf(stderr, "%s: unable to open index directory '%s': %s\n",
+        program, index_dir, strerror(errno));
+      return 1;
+    }
+  }
+
+  gettimeofday(&start, NULL);
+
+  for (i = optind; i < argc; i++) {
+    queue_push(argv[i], strlen(argv[i]), recurse, 0);
+  }
+  run_workers((unsigned int) nthreads);
+
+  /* Retry the directories which changed too recently, once their mtimes
+   * are in the past.
+   */
+  if (retry_head != NULL) {
+    while (time(NULL) <= retry_after) {
+      usleep(100000);
+    }
+
+    while (retry_head != NULL) {
+      struct index_job *job;
+
+      job = retry_head;
+      retry_head = job->next;
+
+      queue_push(job->path, job->root_len, 0, 1);
+      free(job->path);
+      free(job);
+    }
+
+    run_workers((unsigned int) nthreads);
+  }
+
+  gettimeofday(&end, NULL);
+  secs = (end.tv_sec - start.tv_sec) +
+    ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+  printf("%s: indexed %lu directories (%llu names), %lu up to date, "
+    "%lu failed\n", program, ndirs_indexed, nnames_indexed, ndirs_current,
+    ndirs_failed);
+  printf("%s: read %llu entries from %lu directories in %.3f secs "
+    "(%.0f entries/sec)\n", program, nentries_read, ndirs_read, secs,
+    secs > 0 ? nentries_read / secs : 0.0);
+
+  return ndirs_failed > 0 ? 1 : 0;
+}
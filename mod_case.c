@@ -22,6 +22,18 @@
 
 #include "conf.h"
 #include "privs.h"
+#include "mod_case.h"
+
+#if defined(PR_USE_CTRLS)
+# include "mod_ctrls.h"
+#endif /* PR_USE_CTRLS */
+
+#include <sys/mman.h>
+#if defined(__linux__)
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <sys/inotify.h>
+#endif
 
 #define MOD_CASE_VERSION	"mod_case/0.9.2"
 
@@ -30,571 +42,5624 @@
 # error "ProFTPD 1.3.4rc2 or later required"
 #endif
 
+module case_module;
+
 static int case_engine = FALSE;
 static int case_logfd = -1;
 
-static const char *trace_channel = "case";
+/* CaseLog may also be "syslog", in which case messages are sent to syslog
+ * rather than written to a file.
+ */
+static int case_syslogfd = -1;
 
-/* Support routines
+/* CaseLogBuffer: messages are appended to a per-session buffer, which is
+ * written out when full, on an interval, and at session exit, rather than
+ * written as they are logged.  Messages which cannot be written are dropped,
+ * and counted, rather than waited for.
  */
+#define CASE_LOG_DEFAULT_BUFFER_SIZE		8192
+#define CASE_LOG_DEFAULT_FLUSH_INTERVAL		5
+#define CASE_LOG_MIN_BUFFER_SIZE		1024
 
-static int case_expr_eval_cmds(cmd_rec *cmd, array_header *list) {
-  int cmd_id, found;
-  register unsigned int i;
+#if defined(LOG_FTP)
+# define CASE_LOG_SYSLOG_FACILITY		LOG_FTP
+#else
+# define CASE_LOG_SYSLOG_FACILITY		LOG_DAEMON
+#endif /* LOG_FTP */
 
-  for (i = 0; i < list->nelts; i++) {
-    char *c = ((char **) list->elts)[i];
-    found = 0;
+static char *case_log_buf = NULL;
+static size_t case_log_bufsz = 0, case_log_buflen = 0;
+static unsigned long case_log_ndropped = 0;
 
-    if (*c == '!') {
-      found = !found;
-      c++;
-    }
+static void case_log_flush(void) {
+  ssize_t res;
+  size_t written = 0;
 
-    cmd_id = pr_cmd_get_id(c);
-    if (cmd_id > 0) {
-      if (pr_cmd_cmp(cmd, cmd_id) == 0) {
-        found = !found;
-      }
+  if (case_log_buflen == 0) {
+    return;
+  }
 
-    } else {
-      /* Fallback to doing a full strcmp(3). */
-      if (strcmp(cmd->argv[0], c) == 0) {
-        found = !found;
+  if (case_syslogfd >= 0) {
+    char *ptr, *line;
+
+    /* Each buffered message is sent as its own syslog message. */
+    line = case_log_buf;
+    for (ptr = case_log_buf; ptr < case_log_buf + case_log_buflen; ptr++) {
+      if (*ptr == '\n') {
+        *ptr = '\0';
+        pr_syslog(case_syslogfd, LOG_INFO, "%s", line);
+        line = ptr + 1;
       }
     }
 
-    if (found) {
-      return 1;
+    case_log_buflen = 0;
+    return;
+  }
+
+  /* A single write(2) for all of the buffered messages; if it fails, or is
+   * short (as it may be, for a non-blocking log, e.g. with EAGAIN for a full
+   * pipe), the unwritten messages are dropped rather than retried.
+   */
+  res = write(case_logfd, case_log_buf, case_log_buflen);
+  if (res > 0) {
+    written = (size_t) res;
+  }
+
+  if (written < case_log_buflen) {
+    char *ptr;
+
+    for (ptr = case_log_buf + written; ptr < case_log_buf + case_log_buflen;
+        ptr++) {
+      if (*ptr == '\n') {
+        case_log_ndropped++;
+      }
     }
   }
 
-  return 0;
+  case_log_buflen = 0;
 }
 
-static char *case_get_opts_path(cmd_rec *cmd, int *path_index) {
-  char *ptr;
-  char *path;
-  size_t pathlen;
+static int case_log_flush_cb(CALLBACK_FRAME) {
+  case_log_flush();
 
-  if (cmd->arg == NULL) {
-    return NULL;
-  }
+  /* Restart the timer. */
+  return 1;
+}
 
-  ptr = path = cmd->arg;
+/* Logs the given message to the CaseLog, if any. */
+static int case_log(const char *fmt, ...)
+#if defined(__GNUC__)
+      __attribute__ ((format (printf, 1, 2)));
+#else
+      ;
+#endif
 
-  pathlen = strlen(path);
-  if (pathlen == 0) {
-    return NULL;
-  }
+static int case_log(const char *fmt, ...) {
+  va_list msg;
+  char buf[PR_TUNABLE_BUFFER_SIZE+1];
+  size_t len = 0;
+  int res;
 
-  while (isspace((int) *ptr)) {
-    pr_signals_handle();
-    ptr++;
+  if (case_logfd < 0 &&
+      case_syslogfd < 0) {
+    return 0;
   }
 
-  if (*ptr == '-') {
-    /* Options are found; skip past the leading whitespace. */
-    path = ptr;
+  if (case_log_buf == NULL &&
+      case_syslogfd < 0) {
+    va_start(msg, fmt);
+    res = pr_log_vwritefile(case_logfd, MOD_CASE_VERSION, fmt, msg);
+    va_end(msg);
+
+    return res;
   }
 
-  while (path &&
-         *path == '-') {
-    /* Advance to the next whitespace */
-    while (*path != '\0' &&
-           !isspace((int) *path)) {
-      path++;
+  memset(buf, '\0', sizeof(buf));
+
+  /* Syslog supplies its own timestamps, and process ID; the messages written
+   * to a file are formatted as pr_log_writefile() would.
+   */
+  if (case_syslogfd < 0) {
+    struct timeval now;
+    time_t secs;
+    struct tm *tm;
+
+    gettimeofday(&now, NULL);
+    secs = now.tv_sec;
+    tm = localtime(&secs);
+    if (tm != NULL) {
+      len = strftime(buf, sizeof(buf) - 1, "%Y-%m-%d %H:%M:%S", tm);
+      len += snprintf(buf + len, sizeof(buf) - 1 - len, ",%03lu ",
+        (unsigned long) (now.tv_usec / 1000));
     }
 
-    ptr = path;
+    len += snprintf(buf + len, sizeof(buf) - 1 - len, "%s[%u]: ",
+      MOD_CASE_VERSION, (unsigned int) (session.pid ? session.pid : getpid()));
 
-    while (*ptr &&
-           isspace((int) *ptr)) {
-      pr_signals_handle();
-      ptr++;
-    }
+  } else {
+    len = snprintf(buf, sizeof(buf) - 1, "%s: ", MOD_CASE_VERSION);
+  }
 
-    if (*ptr == '-') {
-      /* Options are found; skip past the leading whitespace. */
-      path = ptr;
+  va_start(msg, fmt);
+  len += vsnprintf(buf + len, sizeof(buf) - 1 - len, fmt, msg);
+  va_end(msg);
 
-    } else if (*(path + 1) == ' ') {
-      /* If the next character is a blank space, advance just one
-       * character.
-       */
-      path++;
-      break;
+  if (len > sizeof(buf) - 2) {
+    len = sizeof(buf) - 2;
+  }
 
-    } else {
-      path = ptr;
-      break;
-    }
+  buf[len++] = '\n';
+
+  if (case_log_buf == NULL) {
+    buf[len-1] = '\0';
+    pr_syslog(case_syslogfd, LOG_INFO, "%s", buf);
+    return 0;
   }
 
-  pathlen = strlen(path);
-  if (pathlen == 0) {
-    return NULL;
+  /* A full buffer is not written out here, while the command is handled;
+   * the message is dropped, and counted, until the next timed flush.
+   */
+  if (case_log_buflen + len > case_log_bufsz) {
+    case_log_ndropped++;
+    return 0;
   }
 
-  *path_index = (ptr - cmd->arg);
-  return path;
+  memcpy(case_log_buf + case_log_buflen, buf, len);
+  case_log_buflen += len;
+
+  return 0;
 }
 
-static void case_replace_copy_paths(cmd_rec *cmd, const char *proto,
-    const char *src_path, const char *dst_path) {
+/* CaseCache: per-session index of directories' names, keyed by the folded
+ * name, so that repeated lookups in an unchanged directory do not need to
+ * read that directory again.
+ */
+#define CASE_CACHE_DEFAULT_MAX_ENTRIES		256
+#define CASE_CACHE_DEFAULT_MAX_BYTES		(4 * 1024 * 1024)
 
-  /* Minor nit: if src_path/dst_path is "//", then reduce it to just "/". */
-  if (strcmp(src_path, "//") == 0) {
-    src_path = pstrdup(cmd->tmp_pool, "/");
-  }
+struct case_name {
+  struct case_name *next;
+  unsigned int hash;
+  const char *name;
+};
 
-  if (strcmp(dst_path, "//") == 0) {
-    dst_path = pstrdup(cmd->tmp_pool, "/");
-  }
+struct case_dir_index {
+  struct case_dir_index *prev, *next;
+  pool *pool;
+  const char *path;
 
-  if (strcmp(proto, "ftp") == 0 ||
-      strcmp(proto, "ftps") == 0) {
-    array_header *argv;
+  /* For validating the index against the directory. */
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+  time_t built;
 
-    /* We should only be handling SITE COPY (over FTP/FTPS) requests here */
+  struct case_name **buckets;
+  unsigned int nbuckets;
+  unsigned int nnames;
+  size_t nbytes;
 
-    argv = make_array(cmd->pool, 4, sizeof(char *));
-    *((char **) push_array(argv)) = pstrdup(cmd->pool, cmd->argv[0]);
-    *((char **) push_array(argv)) = pstrdup(cmd->pool, cmd->argv[1]);
-    *((char **) push_array(argv)) = pstrdup(cmd->pool, src_path);
-    *((char **) push_array(argv)) = pstrdup(cmd->pool, dst_path);
+  /* Whether the directory has names which differ only in case, only the
+   * first of which is indexed.
+   */
+  int has_dups;
 
-    cmd->argc = argv->nelts;
+  /* The inotify(7) watch on the directory, if any, and whether there have
+   * been events for it since the index was last validated.
+   */
+  int watch_wd;
+  const char *watch_key;
+  int watch_dirty;
+};
 
-    *((char **) push_array(argv)) = NULL;
-    cmd->argv = argv->elts;
+/* A change to a cached directory index to be made once a command which
+ * modifies that directory is done.
+ */
+struct case_cache_op {
+  struct case_dir_index *idx;
+  const char *key;
+  const char *dir_path;
+  const char *path;
+  const char *name;
+
+  /* The directory's mtime, and the time, when the command started. */
+  time_t mtime;
+  time_t started;
+};
 
-    cmd->arg = pstrcat(cmd->pool, cmd->argv[1], " ", src_path, " ", dst_path,
-      NULL);
-  }
+static int case_cache_engine = FALSE;
+static unsigned int case_cache_max_entries = CASE_CACHE_DEFAULT_MAX_ENTRIES;
+static size_t case_cache_max_bytes = CASE_CACHE_DEFAULT_MAX_BYTES;
 
-  pr_cmd_clear_cache(cmd);
-}
+static pool *case_cache_pool = NULL;
+static pr_table_t *case_cache_tab = NULL;
+static struct case_dir_index *case_cache_head = NULL, *case_cache_tail = NULL;
+static unsigned int case_cache_nentries = 0;
+static size_t case_cache_nbytes = 0;
 
-static void case_replace_link_paths(cmd_rec *cmd, const char *proto,
-    const char *src_path, const char *dst_path) {
+/* On Linux, the directories of cached indexes may be watched using
+ * inotify(7), so that an index need not be revalidated, via stat(2) of its
+ * directory, on every lookup; only directories for which events have been
+ * seen are revalidated.
+ */
+#if defined(__linux__) && defined(IN_NONBLOCK)
+# define CASE_USE_INOTIFY	1
+# define CASE_WATCH_MASK	(IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+#endif /* CASE_USE_INOTIFY */
 
-  /* Minor nit: if src_path/dst_path is "//", then reduce it to just "/". */
-  if (strcmp(src_path, "//") == 0) {
-    src_path = pstrdup(cmd->tmp_pool, "/");
-  }
+#define CASE_WATCH_DEFAULT_MAX_WATCHES		64
 
-  if (strcmp(dst_path, "//") == 0) {
-    dst_path = pstrdup(cmd->tmp_pool, "/");
-  }
+static int case_watch_engine = FALSE;
+static unsigned int case_watch_max_watches = CASE_WATCH_DEFAULT_MAX_WATCHES;
+static int case_watch_fd = -1;
+static unsigned int case_watch_nwatches = 0;
+static pr_table_t *case_watch_tab = NULL;
 
-  if (strcmp(proto, "sftp") == 0) {
-    /* We should only be handling SFTP SYMLINK and LINK requests here. */
+/* The path given to the last RNFR, for updating its directory's index once
+ * the following RNTO is done.
+ */
+static char case_rnfr_path[PR_TUNABLE_PATH_MAX+1];
 
-    cmd->arg = pstrcat(cmd->pool, src_path, "\t", dst_path, NULL);
+/* CaseSharedCache: resolved paths, shared by all sessions via a memory
+ * region which the daemon maps before forking any sessions.  Each entry is
+ * guarded by a sequence lock; readers and writers never wait for each other,
+ * and simply treat a contended entry as a cache miss.
+ */
+#define CASE_SHM_KEY_MAX		512
+#define CASE_SHM_VALUE_MAX		256
+#define CASE_SHM_NWAYS			4
+#define CASE_SHM_MAX_DIRS		16
+
+struct case_shm_dir {
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+};
 
-    if (cmd->argv[1] != cmd->arg) {
-      cmd->argv[1] = cmd->arg;
-    }
-  }
+struct case_shm_entry {
+  /* Odd while the entry is being written. */
+  volatile unsigned int seq;
 
-  pr_cmd_clear_cache(cmd);
-}
+  unsigned int hash;
+  uid_t uid;
+  int changed;
 
-static void case_replace_path(cmd_rec *cmd, const char *proto, const char *path,
-    int path_index) {
+  /* Each directory in which a component of the resolved path was found,
+   * from the first to the last, for validating the entry; a change to any of
+   * them, e.g. a new name in an ancestor, could change the resolved path.
+   */
+  unsigned int ndirs;
+  struct case_shm_dir dirs[CASE_SHM_MAX_DIRS];
+  time_t stored;
 
-  if (strcmp(proto, "ftp") == 0 ||
-      strcmp(proto, "ftps") == 0) {
+  char key[CASE_SHM_KEY_MAX];
+  char value[CASE_SHM_VALUE_MAX];
+};
 
-    /* Special handling of LIST/NLST/STAT commands, which can take options */
-    if (pr_cmd_cmp(cmd, PR_CMD_LIST_ID) == 0 ||
-        pr_cmd_cmp(cmd, PR_CMD_NLST_ID) == 0 ||
-        pr_cmd_cmp(cmd, PR_CMD_STAT_ID) == 0) {
+static unsigned int case_shm_nentries = 0;
+static struct case_shm_entry *case_shm_entries = NULL;
+static size_t case_shm_size = 0;
 
-      /* XXX Be sure to overwrite the entire cmd->argv array, not just
-       * cmd->arg.
-       */
+/* CaseNegativeCache: names for which a scan of a directory found no match,
+ * in any case.  As for CaseSharedCache, entries are kept in sets, but in
+ * session memory.  An entry is valid while its directory is unchanged, and
+ * for at most the configured TTL.
+ */
+#define CASE_NEG_KEY_MAX			512
+#define CASE_NEG_NWAYS				4
+#define CASE_NEG_DEFAULT_MAX_ENTRIES		256
+#define CASE_NEG_DEFAULT_TTL			30
 
-      if (path_index > 0) {
-        unsigned int i;
-        char *arg;
+struct case_neg_entry {
+  unsigned int hash;
 
-        arg = pstrdup(cmd->tmp_pool, cmd->arg);
-        arg[path_index] = '\0';
-        arg = pstrcat(cmd->pool, arg, path, NULL);
-        cmd->arg = arg;
+  dev_t dir_dev;
+  ino_t dir_ino;
+  time_t dir_mtime;
 
-        /* We also need to find the index into cmd->argv to replace.  Look
-         * for the first item that does not start with `-`.
-         */
-        for (i = 1; i < cmd->argc; i++) {
-          if (*((char *) cmd->argv[i]) != '-') {
-            break;
-          }
-        }
+  /* Zero if the entry is unused. */
+  time_t stored;
 
-        cmd->argv[i] = pstrdup(cmd->pool, path);
+  char key[CASE_NEG_KEY_MAX];
+};
 
-      } else {
-        cmd->arg = pstrdup(cmd->pool, path);
-      }
+static int case_neg_engine = FALSE;
+static unsigned int case_neg_nentries = 0;
+static unsigned int case_neg_ttl = CASE_NEG_DEFAULT_TTL;
+static struct case_neg_entry *case_neg_entries = NULL;
+
+/* CaseProbe: before scanning a directory, stat(2) the lowercase, uppercase,
+ * and capitalized variants of the name.  The convention which the names in
+ * each directory have been seen to follow is remembered, per session, so
+ * that the likely variant is tried first; directories whose names follow no
+ * convention are not probed at all.  The table is keyed by the hash of the
+ * directory's path; a collision only costs a probe in the wrong order.
+ */
+#define CASE_PROBE_UNKNOWN		0
+#define CASE_PROBE_LOWER		1
+#define CASE_PROBE_UPPER		2
+#define CASE_PROBE_CAPITALIZED		3
+#define CASE_PROBE_MIXED		4
+
+#define CASE_PROBE_NVARIANTS		3
+#define CASE_PROBE_NDIRS		256
+
+struct case_probe_dir {
+  unsigned int hash;
+  int convention;
+};
 
-      pr_cmd_clear_cache(cmd);
+static int case_probe_engine = FALSE;
+static struct case_probe_dir case_probe_dirs[CASE_PROBE_NDIRS];
 
-    } else {
-      char *arg, *dup_path;
-      array_header *argv;
-      int flags = PR_STR_FL_PRESERVE_COMMENTS;
+/* Statistics, shared by all sessions via a memory region which the daemon
+ * maps at startup, and reported by the "case stats" control action.  The
+ * counters are updated atomically, without locking.
+ */
+#define CASE_STATS_PATH_MAX		256
 
-      dup_path = pstrdup(cmd->pool, path);
+/* CaseTiming: per-command histograms of the time spent in the handlers,
+ * bucketed by powers of two: bucket 0 counts times under a microsecond, and
+ * bucket N times of at least 2^(N-1), but under 2^N, microseconds.
+ */
+#define CASE_TIMING_NBUCKETS		32
+#define CASE_TIMING_MAX_CMDS		32
 
-      /* Be sure to overwrite the entire cmd->argv array, not just cmd->arg. */
-      argv = make_array(cmd->pool, 2, sizeof(char *));
-      *((char **) push_array(argv)) = pstrdup(cmd->pool, cmd->argv[0]);
+struct case_timing {
+  unsigned long buckets[CASE_TIMING_NBUCKETS];
+  unsigned long max_usecs;
 
-      if (pr_cmd_cmp(cmd, PR_CMD_SITE_ID) == 0) {
-        if (strncmp(cmd->argv[1], "CHGRP", 6) == 0 ||
-            strncmp(cmd->argv[1], "CHMOD", 6) == 0) {
+  /* The directory last looked in by the slowest command. */
+  volatile unsigned int max_seq;
+  char max_dir[CASE_STATS_PATH_MAX];
+};
 
-          *((char **) push_array(argv)) = pstrdup(cmd->pool, cmd->argv[1]);
-          *((char **) push_array(argv)) = pstrdup(cmd->pool, cmd->argv[2]);
+static int case_timing_engine = FALSE;
 
-        } else if (strncmp(cmd->argv[1], "CPFR", 5) == 0 ||
-                   strncmp(cmd->argv[1], "CPTO", 5) == 0) {
-          *((char **) push_array(argv)) = pstrdup(cmd->pool, cmd->argv[1]);
-        }
-      }
+/* The timed commands, i.e. those with PRE_CMD handlers; a command's index
+ * here is its index into the histograms, in the session and shared alike.
+ */
+static const char *case_timing_cmds[CASE_TIMING_MAX_CMDS];
+static unsigned int case_timing_ncmds = 0;
 
-      /* Handle spaces in the new path properly by breaking them up and adding
-       * them into the argv.
-       */
-      arg = pr_str_get_word(&dup_path, flags);
-      while (arg != NULL) {
-        pr_signals_handle();
+static struct case_timing case_timings[CASE_TIMING_MAX_CMDS];
+static char case_timing_dir[CASE_STATS_PATH_MAX];
 
-        *((char **) push_array(argv)) = pstrdup(cmd->pool, arg);
-        arg = pr_str_get_word(&dup_path, flags);
-      }
+/* CaseFSIOCounts: counts of the filesystem calls made during each command,
+ * for testing.  Calls made via the pr_fsio API are counted by an FS stacked
+ * on the system FS; those made directly, by the path walking routines, are
+ * counted there.
+ */
+#define CASE_FSIO_COUNTS_FS_NAME	"case_counts"
 
-      cmd->argc = argv->nelts;
+struct case_fsio_counts {
+  unsigned long nopendir;
+  unsigned long nreaddir;
+  unsigned long nopen;
+  unsigned long nstat;
+};
 
-      *((char **) push_array(argv)) = NULL;
-      cmd->argv = argv->elts;
+static int case_fsio_counting = FALSE;
+static struct case_fsio_counts case_fsio_counts;
 
-      pr_cmd_clear_cache(cmd);
+/* CaseFSIO: paths are resolved by an FS, stacked on the FS for "/", as the
+ * calls for them are made, as well as by rewriting the paths of the handled
+ * commands; the calls made by any module, for any command, are thus covered.
+ */
+#define CASE_FS_NAME			"case"
 
-      /* In the case of many commands, we also need to overwrite cmd->arg. */
-      if (pr_cmd_cmp(cmd, PR_CMD_APPE_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_CWD_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_DELE_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_MKD_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_MDTM_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_MLSD_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_MLST_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_RETR_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_RMD_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_RNFR_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_RNTO_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_SIZE_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_STOR_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_XCWD_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_XMKD_ID) == 0 ||
-          pr_cmd_cmp(cmd, PR_CMD_XRMD_ID) == 0) {
-        cmd->arg = pstrdup(cmd->pool, path);
-      }
-    }
+static int case_fs_engine = FALSE;
+static int case_fs_resolving = FALSE;
+static pool *case_fs_pool = NULL;
 
-    if (pr_trace_get_level(trace_channel) >= 19) {
-      register unsigned int i;
+struct case_stats {
+  /* Incremented by "case flush"; each session drops its caches when it sees
+   * a new generation.
+   */
+  volatile unsigned int cache_gen;
+
+  time_t since;
+
+  /* Paths which did not exist as given, and how they were resolved. */
+  unsigned long lookups;
+  unsigned long shared_cache_hits;
+  unsigned long cache_hits;
+  unsigned long negative_cache_hits;
+  unsigned long index_hits;
+  unsigned long canonical_hits;
+  unsigned long probes;
+  unsigned long probe_hits;
+  unsigned long casefold_hits;
+  unsigned long scans;
+  unsigned long entries_scanned;
+  unsigned long matches;
+  unsigned long misses;
+
+  unsigned long lookup_usecs;
+  unsigned long max_lookup_usecs;
+
+  /* The directory with the most entries scanned for a single lookup. */
+  volatile unsigned int largest_seq;
+  unsigned long largest_nentries;
+  char largest_path[CASE_STATS_PATH_MAX];
+
+  /* The CaseTiming histograms of the sessions which have ended. */
+  struct case_timing timings[CASE_TIMING_MAX_CMDS];
+};
 
-      pr_trace_msg(trace_channel, 19, "replacing path: cmd->argc = %d",
-        cmd->argc);
-      for (i = 0; i < cmd->argc; i++) {
-        pr_trace_msg(trace_channel, 19, "replacing path: cmd->argv[%u] = '%s'",
-          i, (char *) cmd->argv[i]);
-      }
-    }
+static struct case_stats case_stats_local;
+static struct case_stats *case_stats = &case_stats_local;
+static unsigned int case_stats_cache_gen = 0;
 
-    return;
-  }
+/* CaseIndex: on-disk index of a large directory's names, shared by all
+ * sessions, so that a lookup in that directory need not read it.  The index
+ * file (see mod_case.h) is memory-mapped for lookups, and replaced by
+ * rename(2) when rebuilt.
+ */
+static int case_index_engine = FALSE;
+static unsigned int case_index_min_entries = CASE_INDEX_DEFAULT_MIN_ENTRIES;
 
-  if (strcmp(proto, "sftp") == 0) {
-    /* Main SFTP commands */
-    if (pr_cmd_cmp(cmd, PR_CMD_RETR_ID) == 0 ||
-        pr_cmd_cmp(cmd, PR_CMD_STOR_ID) == 0 ||
-        pr_cmd_cmp(cmd, PR_CMD_MKD_ID) == 0 ||
-        pr_cmd_cmp(cmd, PR_CMD_RMD_ID) == 0 ||
-        pr_cmd_cmp(cmd, PR_CMD_RNFR_ID) == 0 ||
-        pr_cmd_cmp(cmd, PR_CMD_RNTO_ID) == 0 ||
-        pr_cmd_cmp(cmd, PR_CMD_DELE_ID) == 0 ||
-        pr_cmd_strcmp(cmd, "LSTAT") == 0 ||
-        pr_cmd_strcmp(cmd, "OPENDIR") == 0 ||
-        pr_cmd_strcmp(cmd, "READLINK") == 0 ||
-        pr_cmd_strcmp(cmd, "REALPATH") == 0 ||
-        pr_cmd_strcmp(cmd, "SETSTAT") == 0 ||
-        pr_cmd_strcmp(cmd, "STAT") == 0) {
-      cmd->arg = pstrdup(cmd->pool, path);
-    }
-    pr_cmd_clear_cache(cmd);
+/* Either the configured directory of indexes, or NULL, for the sidecar
+ * ".ftpcase" subdirectories, which must be asked for explicitly.
+ */
+static const char *case_index_dir = NULL;
+static uint32_t case_index_fold_hash = 0;
 
-    return;
-  }
-}
+/* The index files most recently used by this session are kept mapped; a
+ * rebuilt index is a new file, so an unchanged file need not be mapped, nor
+ * checksummed, again.  The least recently used mapping is replaced.
+ */
+#define CASE_INDEX_NMAPS		8
+
+struct case_index_map {
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+  void *addr;
+  size_t len;
+  unsigned long used;
+};
 
-static int case_scan_directory(pool *p, DIR *dirh, const char *dir_name,
-    const char *file, char **matched_file) {
-  struct dirent *dent;
-  const char *file_match;
+static struct case_index_map case_index_maps[CASE_INDEX_NMAPS];
+static unsigned long case_index_maps_tick = 0;
+
+/* When walking down a path, hold a descriptor for the current directory,
+ * and look up the next component relative to it, rather than having the
+ * kernel resolve the full path again for every component.  This is only done
+ * for paths handled by the default "system" FSIO; other FSIO modules
+ * (e.g. mod_vroot) need to see the full paths.
+ */
+#if defined(AT_FDCWD) && defined(O_DIRECTORY)
+# define CASE_USE_OPENAT	1
+# if defined(O_PATH)
+#  define CASE_O_DIRPATH	(O_PATH|O_DIRECTORY)
+# else
+#  define CASE_O_DIRPATH	(O_RDONLY|O_DIRECTORY)
+# endif
+# if defined(O_CLOEXEC)
+#  define CASE_O_CLOEXEC	O_CLOEXEC
+# else
+#  define CASE_O_CLOEXEC	0
+# endif
+#endif
 
-  /* Escape any existing fnmatch(3) characters in the file name. */
-  file_match = pstrdup(p, file);
+/* On Linux, directories walked via descriptors are read with getdents64(2),
+ * many entries per call into a session-lifetime buffer, rather than one
+ * readdir(3) call per entry.  Only one directory is read at a time, so one
+ * buffer suffices.
+ */
+#if defined(CASE_USE_OPENAT) && defined(SYS_getdents64)
+# define CASE_USE_GETDENTS	1
+# define CASE_DENTS_BUFSZ	(64 * 1024)
+
+struct case_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
 
-  if (strchr(file_match, '?') != NULL) {
-    file_match = sreplace(p, file_match, "?", "\\?", NULL);
-  }
+static char *case_dents_buf = NULL;
+#endif /* CASE_USE_GETDENTS */
+
+/* CaseCasefold: on Linux, ext4 and f2fs directories may be marked as
+ * casefolded (i.e. "chattr +F"), and the kernel's own lookups in them are
+ * then case-insensitive; a name not found as is in such a directory does not
+ * exist in any case, and there is no need to look further.  The flag can
+ * only be changed on an empty directory, so the flags of walked directories
+ * are cached for the session, by device and inode; devices whose filesystems
+ * do not support the flag at all are remembered too, so that their
+ * directories are not checked again.  The flags are read from the walk's
+ * descriptor for the directory, and so only for paths handled by the
+ * "system" FSIO.  The <linux/fs.h> values are used, without that header,
+ * which conflicts with <sys/mount.h>.
+ */
+static int case_casefold_engine = FALSE;
+
+#if defined(__linux__) && defined(CASE_USE_OPENAT)
+# define CASE_USE_CASEFOLD	1
+# if !defined(FS_IOC_GETFLAGS)
+#  define FS_IOC_GETFLAGS	_IOR('f', 1, long)
+# endif
+# if !defined(FS_CASEFOLD_FL)
+#  define FS_CASEFOLD_FL	0x40000000
+# endif
+# define CASE_CASEFOLD_NDIRS	256
+# define CASE_CASEFOLD_NWAYS	4
+# define CASE_CASEFOLD_NDEVS	8
+
+struct case_casefold_dir {
+  dev_t dev;
+  ino_t ino;
+
+  /* When the entry was last used; zero if it is unused. */
+  unsigned long used;
+  int casefold;
+};
 
-  if (strchr(file_match, '*') != NULL) {
-    file_match = sreplace(p, file_match, "*", "\\*", NULL);
-  }
+static struct case_casefold_dir case_casefold_dirs[CASE_CASEFOLD_NDIRS];
+static unsigned long case_casefold_tick = 0;
 
-  if (strchr(file_match, '[') != NULL) {
-    file_match = sreplace(p, file_match, "[", "\\[", NULL);
-  }
+static dev_t case_casefold_nodevs[CASE_CASEFOLD_NDEVS];
+static unsigned int case_casefold_nnodevs = 0;
+#endif /* CASE_USE_CASEFOLD */
 
-  /* For each file in the directory, check it against the given name, both
-   * as an exact match and as a possible match.
+/* How many entries to read between checks for pending signals, when not
+ * reading a batch at a time.
+ */
+#define CASE_SCAN_BATCH_SIZE	256
+
+struct case_walk {
+  /* The current directory; its path is kept in `buf`, and extended in place
+   * as the walk descends.
    */
-  dent = pr_fsio_readdir(dirh);
-  while (dent != NULL) {
-    pr_signals_handle();
+  const char *path;
+  char *buf;
+  size_t len;
 
-    if (strcmp(dent->d_name, file) == 0) {
-      pr_trace_msg(trace_channel, 9,
-       "found exact match for file '%s' in directory '%s'", file, dir_name);
-      *matched_file = NULL;
-      return 0;
-    }
+  /* Descriptor for the current directory, or -1 if using FSIO. */
+  int fd;
 
-    if (pr_fnmatch(file_match, dent->d_name, PR_FNM_CASEFOLD) == 0) {
-      (void) pr_log_writefile(case_logfd, MOD_CASE_VERSION,
-        "found case-insensitive match '%s' for '%s' in directory '%s'",
-        dent->d_name, file_match, dir_name);
-      *matched_file = pstrdup(p, dent->d_name);
-      return 0;
-    }
+  /* The handle for reading the current directory, while scanning it: either
+   * a descriptor for getdents64(2), with the unread part of the last batch,
+   * or a DIR handle.
+   */
+  int dir_fd;
+  size_t dents_len;
+  size_t dents_pos;
 
-    dent = pr_fsio_readdir(dirh);
-  }
+  DIR *dirh;
+  unsigned int nread;
 
-  errno = ENOENT;
-  return -1;
-}
+  /* The device of the current directory, as last seen by a stat(2) of it or
+   * of the directory it was entered from, if `have_dev` is TRUE.
+   */
+  dev_t dev;
+  int have_dev;
+};
 
-static const char *case_normalize_path(pool *p, const char *path,
-    int *changed) {
-  register unsigned int i;
-  int xerrno;
-  char *iter_path, *normalized_path, **elts;
-  size_t path_len;
-  pr_fh_t *fh;
-  array_header *components;
-  pool *tmp_pool;
+/* The path being resolved, split into its components, each NUL-terminated
+ * in place.  Matched components are rewritten in place, and the result
+ * copied out once; paths are resolved one at a time, so one of these, and
+ * one buffer for the path of the directory being walked, suffice.
+ */
+#define CASE_PATH_MAX_COMPONENTS	((PR_TUNABLE_PATH_MAX / 2) + 1)
 
-  /* Special cases. */
-  path_len = strlen(path);
-  if (path_len == 1) {
-    if (path[0] == '/' ||
-        path[1] == '.') {
-      /* Nothing to do. */
-      return path;
-    }
+struct case_path {
+  char buf[PR_TUNABLE_PATH_MAX+1];
+  size_t len;
+
+  char *elts[CASE_PATH_MAX_COMPONENTS];
+  unsigned int nelts;
+};
+
+static struct case_path case_path;
+static char case_walk_buf[PR_TUNABLE_PATH_MAX+1];
+
+/* Likewise, the keys and names made while looking up a component are written
+ * into these buffers, each valid until the next component, rather than
+ * allocated: the directory's cache key, the negative cache key, the name as
+ * folded for matching, the name matched (or made up, per CaseUploadPolicy),
+ * the variants tried by CaseProbe, and the path of the directory's index.
+ */
+static char case_key_buf[PR_TUNABLE_PATH_MAX+1];
+static char case_neg_key_buf[CASE_NEG_KEY_MAX];
+static unsigned char case_needle_buf[PR_TUNABLE_PATH_MAX+1];
+static char case_name_buf[PR_TUNABLE_PATH_MAX+1];
+static char case_probe_bufs[CASE_PROBE_NVARIANTS+1][PR_TUNABLE_PATH_MAX+1];
+static char case_index_path_buf[PR_TUNABLE_PATH_MAX+1];
+
+/* Allocations made while resolving, and rewriting, the current path; the
+ * module's pool allocations are made via these wrappers, which count them.
+ * make_array() allocates the array header and its elements, push_array()
+ * allocates when the array is full, and pr_table_add() allocates the table
+ * entry.
+ */
+static unsigned int case_path_nallocs = 0;
+
+static pool *case_make_sub_pool(pool *p) {
+  case_path_nallocs++;
+  return make_sub_pool(p);
+}
+
+static void *case_palloc(pool *p, size_t sz) {
+  case_path_nallocs++;
+  return palloc(p, sz);
+}
+
+static void *case_pcalloc(pool *p, size_t sz) {
+  case_path_nallocs++;
+  return pcalloc(p, sz);
+}
+
+static char *case_pstrdup(pool *p, const char *str) {
+  case_path_nallocs++;
+  return pstrdup(p, str);
+}
+
+static char *case_pstrndup(pool *p, const char *str, size_t n) {
+  case_path_nallocs++;
+  return pstrndup(p, str, n);
+}
+
+/* As pstrcat(), concatenating the NULL-terminated list of strings. */
+static char *case_pstrcat(pool *p, ...) {
+  char *arg, *res, *ptr;
+  size_t len = 0;
+  va_list ap;
+
+  va_start(ap, p);
+  while ((arg = va_arg(ap, char *)) != NULL) {
+    len += strlen(arg);
   }
+  va_end(ap);
 
-  /* Can we open the path as is?  If so, we can avoid the more expensive
-   * filesystem walk.  Note that the path might point to a directory.
-   */
-  fh = pr_fsio_open(path, O_RDONLY);
-  xerrno = errno;
+  res = ptr = case_palloc(p, len + 1);
 
-  if (fh != NULL) {
-    (void) pr_fsio_close(fh);
-    return path;
+  va_start(ap, p);
+  while ((arg = va_arg(ap, char *)) != NULL) {
+    size_t arglen;
+
+    arglen = strlen(arg);
+    memcpy(ptr, arg, arglen);
+    ptr += arglen;
   }
+  va_end(ap);
 
-  if (xerrno != ENOENT) {
-    /* The path exists as is; that's OK. */
-    return path;
+  *ptr = '\0';
+  return res;
+}
+
+static char *case_pdircat(pool *p, const char *dir, const char *name) {
+  case_path_nallocs++;
+  return pdircat(p, dir, name, NULL);
+}
+
+static array_header *case_make_array(pool *p, unsigned int n, size_t sz) {
+  case_path_nallocs += 2;
+  return make_array(p, n, sz);
+}
+
+static void *case_push_array(array_header *arr) {
+  if (arr->nelts == arr->nalloc) {
+    case_path_nallocs++;
   }
 
-  tmp_pool = make_sub_pool(p);
+  return push_array(arr);
+}
 
-  /* Note that it is tempting to use `pr_fs_split_path()`, however its
-   * semantics (resolving to an absolute path first) are not quite expected
-   * here.  So we'll just use pr_str_text_to_array() directly.
-   */
-  components = pr_str_text_to_array(tmp_pool, path, '/');
+static int case_table_add(pr_table_t *tab, const char *key, const void *value,
+    size_t valuesz) {
+  case_path_nallocs++;
+  return pr_table_add(tab, key, value, valuesz);
+}
+
+/* A file name to be matched against directory entries, folded once up front
+ * rather than once per entry.
+ */
+struct case_needle {
+  const unsigned char *name;
+  const unsigned char *folded;
+  size_t len;
+};
 
-  /* For the first component, what is the directory to open?  Depends;
-   * did the path start with '/', '.', or neither?
+/* Maps each byte to its lowercase form, per tolower(3) in the session's
+ * locale, as used by strcasecmp(3).
+ */
+static unsigned char case_fold_tab[256];
+
+/* CaseIgnore command lists are compiled, when the configuration is parsed,
+ * into the result of the list for each command: a bitmap over command IDs,
+ * and a table for those commands, such as SFTP requests, without IDs.
+ */
+#define CASE_CMD_ID_MAX		256
+
+struct case_cmd_set {
+  unsigned char ids[CASE_CMD_ID_MAX / 8];
+
+  /* The results for the commands without IDs named in the list, and for
+   * all other such commands.
    */
-  iter_path = pstrdup(tmp_pool, ".");
-  if (*path == '/') {
-    iter_path = pstrdup(tmp_pool, "/");
+  pr_table_t *names;
+  int others;
+
+  /* The list itself, for any command IDs beyond the bitmap. */
+  array_header *list;
+};
+
+/* How a command's path is to be found, and replaced.  Note that the same
+ * command may be sent over FTP, or be dispatched by mod_sftp.
+ */
+#define CASE_CMD_FL_FTP_OPTS	0x001	/* FTP: path may follow options */
+#define CASE_CMD_FL_FTP_SITE	0x002	/* FTP: SITE command */
+#define CASE_CMD_FL_FTP_ARG	0x004	/* FTP: replace cmd->arg too */
+#define CASE_CMD_FL_SFTP_ARG	0x008	/* SFTP: replace cmd->arg */
+#define CASE_CMD_FL_UPLOAD	0x010	/* Creates its target */
+
+struct case_cmd_desc {
+  int cmd_id;
+
+  /* For commands without IDs. */
+  const char *name;
+
+  int flags;
+};
+
+static struct case_cmd_desc case_cmd_descs[] = {
+  { PR_CMD_APPE_ID,	NULL,		CASE_CMD_FL_FTP_ARG|CASE_CMD_FL_UPLOAD },
+  { PR_CMD_CWD_ID,	NULL,		CASE_CMD_FL_FTP_ARG },
+  { PR_CMD_DELE_ID,	NULL,		CASE_CMD_FL_FTP_ARG|CASE_CMD_FL_SFTP_ARG },
+  { PR_CMD_LIST_ID,	NULL,		CASE_CMD_FL_FTP_OPTS },
+  { PR_CMD_MDTM_ID,	NULL,		CASE_CMD_FL_FTP_ARG },
+  { PR_CMD_MKD_ID,	NULL,
+    CASE_CMD_FL_FTP_ARG|CASE_CMD_FL_SFTP_ARG|CASE_CMD_FL_UPLOAD },
+  { PR_CMD_MLSD_ID,	NULL,		CASE_CMD_FL_FTP_ARG },
+  { PR_CMD_MLST_ID,	NULL,		CASE_CMD_FL_FTP_ARG },
+  { PR_CMD_NLST_ID,	NULL,		CASE_CMD_FL_FTP_OPTS },
+  { PR_CMD_RETR_ID,	NULL,		CASE_CMD_FL_FTP_ARG|CASE_CMD_FL_SFTP_ARG },
+  { PR_CMD_RMD_ID,	NULL,		CASE_CMD_FL_FTP_ARG|CASE_CMD_FL_SFTP_ARG },
+  { PR_CMD_RNFR_ID,	NULL,		CASE_CMD_FL_FTP_ARG|CASE_CMD_FL_SFTP_ARG },
+  { PR_CMD_RNTO_ID,	NULL,
+    CASE_CMD_FL_FTP_ARG|CASE_CMD_FL_SFTP_ARG|CASE_CMD_FL_UPLOAD },
+  { PR_CMD_SITE_ID,	NULL,		CASE_CMD_FL_FTP_SITE },
+  { PR_CMD_SIZE_ID,	NULL,		CASE_CMD_FL_FTP_ARG },
+  { PR_CMD_STAT_ID,	NULL,		CASE_CMD_FL_FTP_OPTS|CASE_CMD_FL_SFTP_ARG },
+  { PR_CMD_STOR_ID,	NULL,
+    CASE_CMD_FL_FTP_ARG|CASE_CMD_FL_SFTP_ARG|CASE_CMD_FL_UPLOAD },
+  { PR_CMD_XCWD_ID,	NULL,		CASE_CMD_FL_FTP_ARG },
+  { PR_CMD_XMKD_ID,	NULL,		CASE_CMD_FL_FTP_ARG|CASE_CMD_FL_UPLOAD },
+  { PR_CMD_XRMD_ID,	NULL,		CASE_CMD_FL_FTP_ARG },
+
+  /* SFTP requests */
+  { 0,			"LSTAT",	CASE_CMD_FL_SFTP_ARG },
+  { 0,			"OPENDIR",	CASE_CMD_FL_SFTP_ARG },
+  { 0,			"READLINK",	CASE_CMD_FL_SFTP_ARG },
+  { 0,			"REALPATH",	CASE_CMD_FL_SFTP_ARG },
+  { 0,			"SETSTAT",	CASE_CMD_FL_SFTP_ARG },
+
+  { 0, NULL, 0 }
+};
+
+/* The descriptor flags, by command ID, and by name for commands without
+ * IDs; built at module initialization.
+ */
+static int case_cmd_flags[CASE_CMD_ID_MAX];
+static pr_table_t *case_cmd_flags_tab = NULL;
+
+/* CaseUploadPolicy: the case in which uploaded files, and new directories,
+ * are named; lookups then try a name in that case before scanning for it.
+ */
+#define CASE_UPLOAD_POLICY_PRESERVE	0
+#define CASE_UPLOAD_POLICY_LOWER	1
+#define CASE_UPLOAD_POLICY_UPPER	2
+
+static int case_upload_policy = CASE_UPLOAD_POLICY_PRESERVE;
+
+/* The session's protocol, as last seen. */
+#define CASE_PROTO_OTHER	0
+#define CASE_PROTO_FTP		1
+#define CASE_PROTO_SFTP		2
+
+static const char *case_proto_name = NULL;
+static int case_proto = CASE_PROTO_OTHER;
+
+/* The CaseIgnore setting for the most recently checked configuration
+ * context; that context only changes when the client changes directories.
+ */
+static xaset_t *case_ignore_conf = NULL;
+static config_rec *case_ignore_config = NULL;
+
+static const char *trace_channel = "case";
+
+/* Support routines
+ */
+
+static int case_expr_eval_cmds(cmd_rec *cmd, array_header *list) {
+  int cmd_id, found;
+  register unsigned int i;
+
+  for (i = 0; i < list->nelts; i++) {
+    char *c = ((char **) list->elts)[i];
+    found = 0;
+
+    if (*c == '!') {
+      found = !found;
+      c++;
+    }
+
+    cmd_id = pr_cmd_get_id(c);
+    if (cmd_id > 0) {
+      if (pr_cmd_cmp(cmd, cmd_id) == 0) {
+        found = !found;
+      }
+
+    } else {
+      /* Fallback to doing a full strcmp(3). */
+      if (strcmp(cmd->argv[0], c) == 0) {
+        found = !found;
+      }
+    }
+
+    if (found) {
+      return 1;
+    }
   }
 
-  elts = components->elts;
-  for (i = 0; i < components->nelts; i++) {
-    int res;
-    pool *iter_pool;
-    DIR *dirh;
-    char *matched_elt = NULL;
+  return 0;
+}
 
-    /* Note that the last component in the list should be the target; we
-     * don't want to use opendir(3) on the target.
-     */
-    iter_pool = make_sub_pool(tmp_pool);
+/* Compiles a CaseIgnore command list.  Each element of the list, of the
+ * form "CMD" or "!CMD", matches the named command, or any other command,
+ * respectively; a command is selected if any element matches it.
+ */
+static struct case_cmd_set *case_cmd_set_create(pool *p, array_header *list) {
+  register unsigned int i;
+  int cmd_id, has_neg_ids = FALSE;
+  unsigned int nneg_names = 0;
+  const char *neg_name = NULL;
+  char **elts;
+  struct case_cmd_set *set;
+  array_header *pos_ids, *neg_ids, *pos_names, *neg_names;
+
+  set = pcalloc(p, sizeof(struct case_cmd_set));
+  set->names = pr_table_alloc(p, 0);
+  set->list = list;
+
+  pos_ids = make_array(p, 0, sizeof(int));
+  neg_ids = make_array(p, 0, sizeof(int));
+  pos_names = make_array(p, 0, sizeof(char *));
+  neg_names = make_array(p, 0, sizeof(char *));
+
+  elts = list->elts;
+  for (i = 0; i < list->nelts; i++) {
+    char *name;
+    int negated = FALSE;
 
-    dirh = pr_fsio_opendir(iter_path);
-    if (dirh == NULL) {
-      int xerrno = errno;
+    name = elts[i];
+    if (*name == '!') {
+      negated = TRUE;
+      name++;
+    }
 
-      /* This should never happen, right? It could, due to races with other
-       * processes' changes to the filesystem.
-       */
-      (void) pr_log_writefile(case_logfd, MOD_CASE_VERSION,
-        "error opening directory '%s': %s", iter_path, strerror(xerrno));
-      destroy_pool(iter_pool);
+    cmd_id = pr_cmd_get_id(name);
+    if (cmd_id > 0) {
+      *((int *) push_array(negated ? neg_ids : pos_ids)) = cmd_id;
 
-      errno = xerrno;
-      return NULL;
+      if (negated) {
+        has_neg_ids = TRUE;
+      }
+
+    } else {
+      *((char **) push_array(negated ? neg_names : pos_names)) = name;
+
+      if (negated &&
+          (neg_name == NULL || strcmp(neg_name, name) != 0)) {
+        neg_name = name;
+        nneg_names++;
+      }
     }
+  }
 
-    res = case_scan_directory(iter_pool, dirh, iter_path, elts[i],
-      &matched_elt);
-    if (res == 0 &&
-        matched_elt != NULL) {
-      ((char **) components->elts)[i] = pstrdup(tmp_pool, matched_elt);
+  /* Any command without an ID, not named in the list, matches all of the
+   * negated elements.
+   */
+  set->others = (has_neg_ids || nneg_names > 0);
 
-      if (changed != NULL) {
-        *changed = TRUE;
+  /* A command with an ID matches its own element, any negated element for
+   * another ID, and any negated element for a command without an ID.
+   */
+  for (cmd_id = 1; cmd_id < CASE_CMD_ID_MAX; cmd_id++) {
+    register unsigned int j;
+    int matched;
+
+    matched = (nneg_names > 0);
+
+    for (j = 0; matched == FALSE && j < pos_ids->nelts; j++) {
+      if (((int *) pos_ids->elts)[j] == cmd_id) {
+        matched = TRUE;
       }
     }
 
-    pr_fsio_closedir(dirh);
-    destroy_pool(iter_pool);
+    for (j = 0; matched == FALSE && j < neg_ids->nelts; j++) {
+      if (((int *) neg_ids->elts)[j] != cmd_id) {
+        matched = TRUE;
+      }
+    }
 
-    iter_path = pdircat(tmp_pool, iter_path, elts[i], NULL);
+    if (matched) {
+      set->ids[cmd_id / 8] |= (1 << (cmd_id % 8));
+    }
   }
 
-  /* Now return the normalized path, built from our possibly-modified
-   * components.  We would use `pr_fs_join_join()`, but it has a now-corrected
-   * bug.
+  /* A command without an ID, named in the list, matches its own element,
+   * any negated element for an ID, and any negated element for another
+   * command without an ID.
    */
-  elts = components->elts;
-  if (*path == '/') {
-    normalized_path = pstrcat(p, "/", elts[0], NULL);
+  for (i = 0; i < pos_names->nelts + neg_names->nelts; i++) {
+    register unsigned int j;
+    char *name;
+    int *matched;
+
+    name = (i < pos_names->nelts) ? ((char **) pos_names->elts)[i] :
+      ((char **) neg_names->elts)[i - pos_names->nelts];
+    if (pr_table_get(set->names, name, NULL) != NULL) {
+      continue;
+    }
 
-  } else {
-    normalized_path = pstrdup(p, elts[0]);
+    matched = pcalloc(p, sizeof(int));
+    *matched = has_neg_ids;
+
+    for (j = 0; *matched == FALSE && j < pos_names->nelts; j++) {
+      if (strcmp(((char **) pos_names->elts)[j], name) == 0) {
+        *matched = TRUE;
+      }
+    }
+
+    for (j = 0; *matched == FALSE && j < neg_names->nelts; j++) {
+      if (strcmp(((char **) neg_names->elts)[j], name) != 0) {
+        *matched = TRUE;
+      }
+    }
+
+    (void) pr_table_add(set->names, name, matched, sizeof(int));
+  }
+
+  return set;
+}
+
+static int case_cmd_set_match(struct case_cmd_set *set, cmd_rec *cmd) {
+  const int *matched;
+
+  if (cmd->cmd_id == 0) {
+    cmd->cmd_id = pr_cmd_get_id(cmd->argv[0]);
   }
 
-  for (i = 1; i < components->nelts; i++) {
-    char *elt;
+  if (cmd->cmd_id > 0) {
+    if (cmd->cmd_id < CASE_CMD_ID_MAX) {
+      return (set->ids[cmd->cmd_id / 8] & (1 << (cmd->cmd_id % 8))) ? 1 : 0;
+    }
 
-    elt = ((char **) components->elts)[i];
-    normalized_path = pdircat(p, normalized_path, elt, NULL);
+    return case_expr_eval_cmds(cmd, set->list);
   }
 
-  destroy_pool(tmp_pool);
+  matched = pr_table_get(set->names, cmd->argv[0], NULL);
+  if (matched != NULL) {
+    return *matched;
+  }
 
-  pr_trace_msg(trace_channel, 19, "normalized path '%s' to '%s'", path,
-    normalized_path);
-  return normalized_path;
+  return set->others;
 }
 
-static int case_have_file(pool *p, const char *path,
-    const char **matched_path) {
-  int changed = FALSE;
-  const char *normalized_path;
+/* Returns TRUE if CaseIgnore applies to the given command, in the current
+ * configuration context.
+ */
+static int case_ignore_cmd(cmd_rec *cmd) {
+  config_rec *c;
 
-  normalized_path = case_normalize_path(p, path, &changed);
-  if (normalized_path == NULL) {
+  if (CURRENT_CONF != case_ignore_conf) {
+    case_ignore_conf = CURRENT_CONF;
+    case_ignore_config = find_config(CURRENT_CONF, CONF_PARAM, "CaseIgnore",
+      FALSE);
+  }
+
+  c = case_ignore_config;
+  if (c == NULL) {
     return FALSE;
   }
 
-  if (changed == TRUE) {
-    *matched_path = normalized_path;
+  if (*((unsigned int *) c->argv[0]) != TRUE) {
+    return FALSE;
+  }
+
+  if (c->argv[1] != NULL &&
+      case_cmd_set_match(c->argv[1], cmd) == 0) {
+    return FALSE;
   }
 
   return TRUE;
 }
 
-/* Command handlers
- */
+static void case_cmd_flags_init(void) {
+  register unsigned int i;
 
-/* The SITE COPY requests are different enough to warrant their own command
- * handler.
+  memset(case_cmd_flags, 0, sizeof(case_cmd_flags));
+  case_cmd_flags_tab = pr_table_alloc(permanent_pool, 0);
+
+  for (i = 0; case_cmd_descs[i].cmd_id > 0 || case_cmd_descs[i].name != NULL;
+       i++) {
+    struct case_cmd_desc *desc;
+
+    desc = &(case_cmd_descs[i]);
+    if (desc->cmd_id > 0 &&
+        desc->cmd_id < CASE_CMD_ID_MAX) {
+      case_cmd_flags[desc->cmd_id] = desc->flags;
+
+    } else if (desc->name != NULL) {
+      (void) pr_table_add(case_cmd_flags_tab, desc->name, &(desc->flags),
+        sizeof(int));
+    }
+  }
+}
+
+static int case_cmd_get_flags(cmd_rec *cmd) {
+  const int *flags;
+
+  if (cmd->cmd_id == 0) {
+    cmd->cmd_id = pr_cmd_get_id(cmd->argv[0]);
+  }
+
+  if (cmd->cmd_id > 0 &&
+      cmd->cmd_id < CASE_CMD_ID_MAX) {
+    return case_cmd_flags[cmd->cmd_id];
+  }
+
+  flags = pr_table_get(case_cmd_flags_tab, cmd->argv[0], NULL);
+  if (flags != NULL) {
+    return *flags;
+  }
+
+  return 0;
+}
+
+/* Returns the session's protocol.  The protocol only changes rarely (e.g.
+ * once the session is known to be SFTP), and when it does, the protocol
+ * note is replaced; comparing names is only needed then.
  */
-MODRET case_pre_copy(cmd_rec *cmd) {
-  config_rec *c;
-  const char *proto, *matched_path = NULL;
-  char *src_path, *dst_path;
-  int modified_arg = FALSE, res;
+static int case_get_protocol(void) {
+  const char *proto;
 
-  if (case_engine == FALSE) {
-    return PR_DECLINED(cmd);
+  proto = pr_session_get_protocol(0);
+  if (proto == case_proto_name) {
+    return case_proto;
+  }
+
+  case_proto_name = proto;
+
+  if (strcmp(proto, "ftp") == 0 ||
+      strcmp(proto, "ftps") == 0) {
+    case_proto = CASE_PROTO_FTP;
+
+  } else if (strcmp(proto, "sftp") == 0) {
+    case_proto = CASE_PROTO_SFTP;
+
+  } else {
+    case_proto = CASE_PROTO_OTHER;
+  }
+
+  return case_proto;
+}
+
+static char *case_get_opts_path(cmd_rec *cmd, int *path_index) {
+  char *ptr;
+  char *path;
+  size_t pathlen;
+
+  if (cmd->arg == NULL) {
+    return NULL;
+  }
+
+  ptr = path = cmd->arg;
+
+  pathlen = strlen(path);
+  if (pathlen == 0) {
+    return NULL;
+  }
+
+  while (isspace((int) *ptr)) {
+    pr_signals_handle();
+    ptr++;
+  }
+
+  if (*ptr == '-') {
+    /* Options are found; skip past the leading whitespace. */
+    path = ptr;
+  }
+
+  while (path &&
+         *path == '-') {
+    /* Advance to the next whitespace */
+    while (*path != '\0' &&
+           !isspace((int) *path)) {
+      path++;
+    }
+
+    ptr = path;
+
+    while (*ptr &&
+           isspace((int) *ptr)) {
+      pr_signals_handle();
+      ptr++;
+    }
+
+    if (*ptr == '-') {
+      /* Options are found; skip past the leading whitespace. */
+      path = ptr;
+
+    } else if (*(path + 1) == ' ') {
+      /* If the next character is a blank space, advance just one
+       * character.
+       */
+      path++;
+      break;
+
+    } else {
+      path = ptr;
+      break;
+    }
+  }
+
+  pathlen = strlen(path);
+  if (pathlen == 0) {
+    return NULL;
+  }
+
+  *path_index = (ptr - cmd->arg);
+  return path;
+}
+
+static void case_replace_copy_paths(cmd_rec *cmd, int proto,
+    const char *src_path, const char *dst_path) {
+
+  /* Minor nit: if src_path/dst_path is "//", then reduce it to just "/". */
+  if (strcmp(src_path, "//") == 0) {
+    src_path = case_pstrdup(cmd->tmp_pool, "/");
+  }
+
+  if (strcmp(dst_path, "//") == 0) {
+    dst_path = case_pstrdup(cmd->tmp_pool, "/");
+  }
+
+  if (proto == CASE_PROTO_FTP) {
+    array_header *argv;
+
+    /* We should only be handling SITE COPY (over FTP/FTPS) requests here */
+
+    argv = case_make_array(cmd->pool, 4, sizeof(char *));
+    *((char **) case_push_array(argv)) = case_pstrdup(cmd->pool, cmd->argv[0]);
+    *((char **) case_push_array(argv)) = case_pstrdup(cmd->pool, cmd->argv[1]);
+    *((char **) case_push_array(argv)) = case_pstrdup(cmd->pool, src_path);
+    *((char **) case_push_array(argv)) = case_pstrdup(cmd->pool, dst_path);
+
+    cmd->argc = argv->nelts;
+
+    *((char **) case_push_array(argv)) = NULL;
+    cmd->argv = argv->elts;
+
+    cmd->arg = case_pstrcat(cmd->pool, cmd->argv[1], " ", src_path, " ",
+      dst_path, NULL);
+  }
+
+  pr_cmd_clear_cache(cmd);
+}
+
+static void case_replace_link_paths(cmd_rec *cmd, int proto,
+    const char *src_path, const char *dst_path) {
+
+  /* Minor nit: if src_path/dst_path is "//", then reduce it to just "/". */
+  if (strcmp(src_path, "//") == 0) {
+    src_path = case_pstrdup(cmd->tmp_pool, "/");
+  }
+
+  if (strcmp(dst_path, "//") == 0) {
+    dst_path = case_pstrdup(cmd->tmp_pool, "/");
+  }
+
+  if (proto == CASE_PROTO_SFTP) {
+    /* We should only be handling SFTP SYMLINK and LINK requests here. */
+
+    cmd->arg = case_pstrcat(cmd->pool, src_path, "\t", dst_path, NULL);
+
+    if (cmd->argv[1] != cmd->arg) {
+      cmd->argv[1] = cmd->arg;
+    }
+  }
+
+  pr_cmd_clear_cache(cmd);
+}
+
+static void case_replace_path(cmd_rec *cmd, int proto, const char *path,
+    int path_index) {
+  int flags;
+
+  flags = case_cmd_get_flags(cmd);
+
+  if (proto == CASE_PROTO_FTP) {
+
+    /* Special handling of LIST/NLST/STAT commands, which can take options */
+    if (flags & CASE_CMD_FL_FTP_OPTS) {
+
+      /* XXX Be sure to overwrite the entire cmd->argv array, not just
+       * cmd->arg.
+       */
+
+      if (path_index > 0) {
+        unsigned int i;
+        char *arg;
+
+        arg = case_pstrdup(cmd->tmp_pool, cmd->arg);
+        arg[path_index] = '\0';
+        arg = case_pstrcat(cmd->pool, arg, path, NULL);
+        cmd->arg = arg;
+
+        /* We also need to find the index into cmd->argv to replace.  Look
+         * for the first item that does not start with `-`.
+         */
+        for (i = 1; i < cmd->argc; i++) {
+          if (*((char *) cmd->argv[i]) != '-') {
+            break;
+          }
+        }
+
+        cmd->argv[i] = case_pstrdup(cmd->pool, path);
+
+      } else {
+        cmd->arg = case_pstrdup(cmd->pool, path);
+      }
+
+      pr_cmd_clear_cache(cmd);
+
+    } else {
+      char *arg, *dup_path;
+      array_header *argv;
+      int str_flags = PR_STR_FL_PRESERVE_COMMENTS;
+
+      /* The words of the path are split out of this copy in place, and the
+       * leading arguments are kept as is, as they already live in cmd->pool;
+       * only the argv array itself, and this copy, are allocated.
+       */
+      dup_path = case_pstrdup(cmd->pool, path);
+
+      /* Be sure to overwrite the entire cmd->argv array, not just cmd->arg. */
+      argv = case_make_array(cmd->pool, cmd->argc + 4, sizeof(char *));
+      *((char **) case_push_array(argv)) = cmd->argv[0];
+
+      if (flags & CASE_CMD_FL_FTP_SITE) {
+        if (strncmp(cmd->argv[1], "CHGRP", 6) == 0 ||
+            strncmp(cmd->argv[1], "CHMOD", 6) == 0) {
+
+          *((char **) case_push_array(argv)) = cmd->argv[1];
+          *((char **) case_push_array(argv)) = cmd->argv[2];
+
+        } else if (strncmp(cmd->argv[1], "CPFR", 5) == 0 ||
+                   strncmp(cmd->argv[1], "CPTO", 5) == 0) {
+          *((char **) case_push_array(argv)) = cmd->argv[1];
+        }
+      }
+
+      /* Handle spaces in the new path properly by breaking them up and adding
+       * them into the argv.
+       */
+      arg = pr_str_get_word(&dup_path, str_flags);
+      while (arg != NULL) {
+        pr_signals_handle();
+
+        *((char **) case_push_array(argv)) = arg;
+        arg = pr_str_get_word(&dup_path, str_flags);
+      }
+
+      cmd->argc = argv->nelts;
+
+      *((char **) case_push_array(argv)) = NULL;
+      cmd->argv = argv->elts;
+
+      pr_cmd_clear_cache(cmd);
+
+      /* In the case of many commands, we also need to overwrite cmd->arg. */
+      if (flags & CASE_CMD_FL_FTP_ARG) {
+        cmd->arg = case_pstrdup(cmd->pool, path);
+        }
+    }
+
+    if (pr_trace_get_level(trace_channel) >= 19) {
+      register unsigned int i;
+
+      pr_trace_msg(trace_channel, 19,
+        "replacing path: cmd->argc = %d (%u allocations)", cmd->argc,
+        case_path_nallocs);
+      for (i = 0; i < cmd->argc; i++) {
+        pr_trace_msg(trace_channel, 19, "replacing path: cmd->argv[%u] = '%s'",
+          i, (char *) cmd->argv[i]);
+      }
+    }
+
+    return;
+  }
+
+  if (proto == CASE_PROTO_SFTP) {
+    /* Main SFTP commands */
+    if (flags & CASE_CMD_FL_SFTP_ARG) {
+      cmd->arg = case_pstrdup(cmd->pool, path);
+    }
+    pr_cmd_clear_cache(cmd);
+
+    return;
+  }
+}
+
+/* Returns TRUE if the given path is on the real filesystem, i.e. is handled
+ * by the system FS, or by mod_case's FSes stacked on it.
+ */
+static int case_fs_is_system(const char *path) {
+  pr_fs_t *fs;
+
+  fs = pr_get_fs(path, NULL);
+  if (fs == NULL) {
+    return FALSE;
+  }
+
+  /* Look through mod_case's own FSes, to the FS below them. */
+  while (fs->fs_next != NULL &&
+         (strcmp(fs->fs_name, CASE_FS_NAME) == 0 ||
+          strcmp(fs->fs_name, CASE_FSIO_COUNTS_FS_NAME) == 0)) {
+    fs = fs->fs_next;
+  }
+
+  if (strcmp(fs->fs_name, "system") == 0) {
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Returns the directory portion of the given path, ignoring any trailing
+ * slashes, and sets `name` to the last component.
+ */
+static char *case_dir_name(pool *p, const char *path, char **name) {
+  char *dir_path, *ptr;
+
+  dir_path = case_pstrdup(p, path);
+
+  /* Ignore any trailing slashes, as for MKD. */
+  ptr = dir_path + strlen(dir_path) - 1;
+  while (ptr > dir_path &&
+         *ptr == '/') {
+    *ptr-- = '\0';
+  }
+
+  ptr = strrchr(dir_path, '/');
+  if (ptr == NULL) {
+    *name = dir_path;
+    return ".";
+  }
+
+  *name = ptr + 1;
+  if (ptr == dir_path) {
+    return "/";
+  }
+
+  *ptr = '\0';
+  return dir_path;
+}
+
+/* Directory index cache routines
+ */
+
+static unsigned int case_name_hash(const char *name) {
+  register const unsigned char *ptr;
+  unsigned int hash = 2166136261U;
+
+  /* FNV-1a, on the folded bytes of the name. */
+  for (ptr = (const unsigned char *) name; *ptr; ptr++) {
+    hash ^= (unsigned int) tolower((int) *ptr);
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+/* Returns the key in case_key_buf, unless it is the given path itself; only
+ * a key too long for the buffer is allocated.
+ */
+static const char *case_cache_key(pool *p, const char *dir_path) {
+  const char *cwd;
+  size_t cwd_len;
+
+  /* Relative directory paths are keyed by their absolute path, so that
+   * changing directories does not lead to the wrong index being used.
+   */
+  if (*dir_path == '/') {
+    return dir_path;
+  }
+
+  cwd = pr_fs_getcwd();
+  if (strcmp(dir_path, ".") == 0) {
+    return cwd;
+  }
+
+  if (strncmp(dir_path, "./", 2) == 0) {
+    dir_path += 2;
+  }
+
+  cwd_len = strlen(cwd);
+  if (cwd_len + strlen(dir_path) + 2 > sizeof(case_key_buf)) {
+    return case_pdircat(p, cwd, dir_path);
+  }
+
+  pr_snprintf(case_key_buf, sizeof(case_key_buf), "%s%s%s", cwd,
+    cwd_len > 0 && cwd[cwd_len-1] == '/' ? "" : "/", dir_path);
+  return case_key_buf;
+}
+
+/* Directory watch routines
+ */
+
+static void case_watch_remove(struct case_dir_index *idx) {
+#if defined(CASE_USE_INOTIFY)
+  if (idx->watch_wd < 0) {
+    return;
+  }
+
+  (void) inotify_rm_watch(case_watch_fd, idx->watch_wd);
+  (void) pr_table_remove(case_watch_tab, idx->watch_key, NULL);
+
+  idx->watch_wd = -1;
+  idx->watch_key = NULL;
+  case_watch_nwatches--;
+#endif /* CASE_USE_INOTIFY */
+}
+
+/* Watches the directory of a newly cached index, evicting the watch of the
+ * least recently used index if need be.  Failure to add a watch, e.g. due to
+ * the system's inotify(7) limits, is not an error; the index is then
+ * validated against its directory's mtime, as usual.
+ */
+static void case_watch_add(struct case_dir_index *idx) {
+#if defined(CASE_USE_INOTIFY)
+  int wd;
+  char key[32];
+
+  if (case_watch_fd < 0) {
+    return;
+  }
+
+  /* Only directories on the real filesystem can be watched. */
+  if (case_fs_is_system(idx->path) == FALSE) {
+    return;
+  }
+
+  if (case_watch_nwatches >= case_watch_max_watches) {
+    struct case_dir_index *lru_idx;
+
+    for (lru_idx = case_cache_tail; lru_idx != NULL; lru_idx = lru_idx->prev) {
+      if (lru_idx->watch_wd >= 0) {
+        pr_trace_msg(trace_channel, 17,
+          "evicting watch for directory '%s'", lru_idx->path);
+        case_watch_remove(lru_idx);
+        break;
+      }
+    }
+  }
+
+  wd = inotify_add_watch(case_watch_fd, idx->path, CASE_WATCH_MASK);
+  if (wd < 0) {
+    pr_trace_msg(trace_channel, 3,
+      "error watching directory '%s', using mtime validation: %s", idx->path,
+      strerror(errno));
+    return;
+  }
+
+  /* A directory may be cached under several paths; only one index can own
+   * the watch.
+   */
+  pr_snprintf(key, sizeof(key), "%d", wd);
+  if (pr_table_get(case_watch_tab, key, NULL) != NULL) {
+    return;
+  }
+
+  idx->watch_key = case_pstrdup(idx->pool, key);
+  if (case_table_add(case_watch_tab, idx->watch_key, idx,
+      sizeof(struct case_dir_index)) < 0) {
+    (void) inotify_rm_watch(case_watch_fd, wd);
+    idx->watch_key = NULL;
+    return;
+  }
+
+  /* The directory may have changed after it was scanned, but before the
+   * watch was added; the index must be validated once more, as usual.
+   */
+  idx->watch_wd = wd;
+  idx->watch_dirty = TRUE;
+  case_watch_nwatches++;
+#endif /* CASE_USE_INOTIFY */
+}
+
+/* Reads any pending events, without blocking, marking the indexes of the
+ * changed directories for revalidation.
+ */
+static void case_watch_drain(void) {
+#if defined(CASE_USE_INOTIFY)
+  char buf[4096]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  if (case_watch_fd < 0) {
+    return;
+  }
+
+  while ((len = read(case_watch_fd, buf, sizeof(buf))) > 0) {
+    char *ptr;
+
+    for (ptr = buf; ptr < buf + len;
+         ptr += sizeof(struct inotify_event) +
+           ((struct inotify_event *) ptr)->len) {
+      struct inotify_event *event;
+      struct case_dir_index *idx;
+      char key[32];
+
+      event = (struct inotify_event *) ptr;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        /* Events were lost; revalidate everything. */
+        pr_trace_msg(trace_channel, 17, "%s",
+          "inotify event queue overflowed, revalidating all watched indexes");
+        for (idx = case_cache_head; idx != NULL; idx = idx->next) {
+          idx->watch_dirty = TRUE;
+        }
+
+        continue;
+      }
+
+      pr_snprintf(key, sizeof(key), "%d", event->wd);
+      idx = (struct case_dir_index *) pr_table_get(case_watch_tab, key, NULL);
+      if (idx == NULL) {
+        continue;
+      }
+
+      if (event->mask & IN_IGNORED) {
+        /* The kernel removed the watch, e.g. as the directory was deleted. */
+        (void) pr_table_remove(case_watch_tab, idx->watch_key, NULL);
+        idx->watch_wd = -1;
+        idx->watch_key = NULL;
+        case_watch_nwatches--;
+      }
+
+      idx->watch_dirty = TRUE;
+    }
+  }
+#endif /* CASE_USE_INOTIFY */
+}
+
+static void case_cache_unlink(struct case_dir_index *idx) {
+  if (idx->prev != NULL) {
+    idx->prev->next = idx->next;
+
+  } else {
+    case_cache_head = idx->next;
+  }
+
+  if (idx->next != NULL) {
+    idx->next->prev = idx->prev;
+
+  } else {
+    case_cache_tail = idx->prev;
+  }
+
+  idx->prev = idx->next = NULL;
+}
+
+static void case_cache_remove(struct case_dir_index *idx) {
+  case_watch_remove(idx);
+  case_cache_unlink(idx);
+  (void) pr_table_remove(case_cache_tab, idx->path, NULL);
+
+  case_cache_nentries--;
+  case_cache_nbytes -= idx->nbytes;
+
+  destroy_pool(idx->pool);
+}
+
+static struct case_dir_index *case_cache_create(const char *dir_path,
+    struct stat *st) {
+  pool *idx_pool;
+  struct case_dir_index *idx;
+
+  idx_pool = case_make_sub_pool(case_cache_pool);
+  pr_pool_tag(idx_pool, "Case Directory Index Pool");
+
+  idx = case_pcalloc(idx_pool, sizeof(struct case_dir_index));
+  idx->pool = idx_pool;
+  idx->path = case_pstrdup(idx_pool, dir_path);
+  idx->dev = st->st_dev;
+  idx->ino = st->st_ino;
+  idx->mtime = st->st_mtime;
+  idx->built = time(NULL);
+  idx->watch_wd = -1;
+
+  idx->nbuckets = 64;
+  idx->buckets = case_pcalloc(idx_pool,
+    idx->nbuckets * sizeof(struct case_name *));
+  idx->nbytes = sizeof(struct case_dir_index) + strlen(dir_path) + 1 +
+    (idx->nbuckets * sizeof(struct case_name *));
+
+  return idx;
+}
+
+/* Adds the given name to the index.  Only the first name (in readdir(3)
+ * order) for a given folded name is kept, matching the scan semantics.
+ * Returns -1 if the index grows too large to be cached.
+ */
+static int case_cache_add_name(struct case_dir_index *idx, const char *name) {
+  unsigned int hash, i;
+  struct case_name *cn;
+
+  hash = case_name_hash(name);
+  for (cn = idx->buckets[hash % idx->nbuckets]; cn != NULL; cn = cn->next) {
+    if (cn->hash == hash &&
+        strcasecmp(cn->name, name) == 0) {
+      if (strcmp(cn->name, name) != 0) {
+        idx->has_dups = TRUE;
+      }
+
+      return 0;
+    }
+  }
+
+  if (idx->nnames >= (idx->nbuckets * 2)) {
+    struct case_name **buckets;
+    unsigned int nbuckets;
+
+    /* Grow the bucket array, rehashing the existing names. */
+    nbuckets = idx->nbuckets * 4;
+    buckets = case_pcalloc(idx->pool, nbuckets * sizeof(struct case_name *));
+
+    for (i = 0; i < idx->nbuckets; i++) {
+      struct case_name *next_cn;
+
+      for (cn = idx->buckets[i]; cn != NULL; cn = next_cn) {
+        next_cn = cn->next;
+        cn->next = buckets[cn->hash % nbuckets];
+        buckets[cn->hash % nbuckets] = cn;
+      }
+    }
+
+    idx->buckets = buckets;
+    idx->nbuckets = nbuckets;
+    idx->nbytes += (nbuckets * sizeof(struct case_name *));
+  }
+
+  cn = case_palloc(idx->pool, sizeof(struct case_name));
+  cn->hash = hash;
+  cn->name = case_pstrdup(idx->pool, name);
+  cn->next = idx->buckets[hash % idx->nbuckets];
+  idx->buckets[hash % idx->nbuckets] = cn;
+
+  idx->nnames++;
+  idx->nbytes += sizeof(struct case_name) + strlen(name) + 1;
+
+  if (idx->nbytes > case_cache_max_bytes) {
+    errno = EFBIG;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Removes the given name from the index.  Returns -1 if the index cannot be
+ * updated, as when another name differing only in case may now need to take
+ * the removed name's place.
+ */
+static int case_cache_remove_name(struct case_dir_index *idx,
+    const char *name) {
+  unsigned int hash;
+  struct case_name *cn, **prev_cn;
+
+  if (idx->has_dups == TRUE) {
+    errno = EPERM;
+    return -1;
+  }
+
+  hash = case_name_hash(name);
+  prev_cn = &(idx->buckets[hash % idx->nbuckets]);
+  for (cn = *prev_cn; cn != NULL; prev_cn = &(cn->next), cn = cn->next) {
+    if (cn->hash == hash &&
+        strcmp(cn->name, name) == 0) {
+      *prev_cn = cn->next;
+
+      idx->nnames--;
+      idx->nbytes -= sizeof(struct case_name) + strlen(name) + 1;
+      break;
+    }
+  }
+
+  return 0;
+}
+
+static int case_cache_find(struct case_dir_index *idx,
+    const char *file, char **matched_file) {
+  unsigned int hash;
+  struct case_name *cn;
+
+  hash = case_name_hash(file);
+  for (cn = idx->buckets[hash % idx->nbuckets]; cn != NULL; cn = cn->next) {
+    if (cn->hash != hash ||
+        strcasecmp(cn->name, file) != 0) {
+      continue;
+    }
+
+    if (strcmp(cn->name, file) == 0) {
+      pr_trace_msg(trace_channel, 9,
+        "found cached exact match for file '%s' in directory '%s'", file,
+        idx->path);
+      *matched_file = NULL;
+      return 0;
+    }
+
+    (void) case_log(
+      "found cached case-insensitive match '%s' for '%s' in directory '%s'",
+      cn->name, file, idx->path);
+    sstrncpy(case_name_buf, cn->name, sizeof(case_name_buf));
+    *matched_file = case_name_buf;
+    return 0;
+  }
+
+  errno = ENOENT;
+  return -1;
+}
+
+/* Moves the index to the front of the LRU list. */
+static void case_cache_touch(struct case_dir_index *idx) {
+  if (idx != case_cache_head) {
+    case_cache_unlink(idx);
+    idx->next = case_cache_head;
+    case_cache_head->prev = idx;
+    case_cache_head = idx;
+  }
+}
+
+/* Returns the cached index for the given directory, if there is one and it
+ * is still valid, per the directory's current stat(2) information in `st`.
+ */
+static struct case_dir_index *case_cache_get(pool *p, const char *dir_path,
+    struct stat *st) {
+  const char *key;
+  struct case_dir_index *idx;
+
+  key = case_cache_key(p, dir_path);
+  idx = (struct case_dir_index *) pr_table_get(case_cache_tab, key, NULL);
+  if (idx == NULL) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  /* Note that the mtime only has a granularity of seconds; an index built
+   * in the same second as the directory was last modified may have missed
+   * later changes in that second, and thus cannot be trusted.
+   */
+  if (idx->dev != st->st_dev ||
+      idx->ino != st->st_ino ||
+      idx->mtime != st->st_mtime ||
+      idx->mtime >= idx->built) {
+    pr_trace_msg(trace_channel, 17,
+      "cached index for directory '%s' is stale, removing", key);
+    case_cache_remove(idx);
+
+    errno = ENOENT;
+    return NULL;
+  }
+
+  /* The index is valid as of now; any later changes will be seen as events
+   * for its watch, if it has one.
+   */
+  idx->watch_dirty = FALSE;
+
+  case_cache_touch(idx);
+  return idx;
+}
+
+/* Returns the cached index for the given directory, if it is watched and
+ * there have been no events for the directory since the index was last
+ * validated; its mtime then need not be checked.  The watch follows the
+ * directory's inode, whereas the cache is keyed by path, so the directory at
+ * the path must still be the one watched: after an ancestor is renamed, or a
+ * symlink in the path retargeted, the path leads elsewhere without any event
+ * for the watched directory.
+ */
+static struct case_dir_index *case_cache_get_watched(pool *p,
+    const char *dir_path, struct stat *dir_st) {
+  const char *key;
+  struct case_dir_index *idx;
+
+  if (case_watch_nwatches == 0) {
+    return NULL;
+  }
+
+  key = case_cache_key(p, dir_path);
+  idx = (struct case_dir_index *) pr_table_get(case_cache_tab, key, NULL);
+  if (idx == NULL ||
+      idx->watch_wd < 0 ||
+      idx->watch_dirty == TRUE) {
+    return NULL;
+  }
+
+  if (idx->dev != dir_st->st_dev ||
+      idx->ino != dir_st->st_ino) {
+    pr_trace_msg(trace_channel, 17,
+      "path of watched directory '%s' now leads elsewhere, removing its "
+      "cached index", key);
+    case_cache_remove(idx);
+    return NULL;
+  }
+
+  pr_trace_msg(trace_channel, 19,
+    "using watched cached index for directory '%s'", key);
+  case_cache_touch(idx);
+  return idx;
+}
+
+static void case_cache_put(pool *p, struct case_dir_index *idx) {
+  const char *key;
+
+  key = case_cache_key(p, idx->path);
+  if (key != idx->path) {
+    idx->path = case_pstrdup(idx->pool, key);
+  }
+
+  /* Make room for the new index, evicting the least recently used ones. */
+  while (case_cache_tail != NULL &&
+         (case_cache_nentries + 1 > case_cache_max_entries ||
+          case_cache_nbytes + idx->nbytes > case_cache_max_bytes)) {
+    pr_trace_msg(trace_channel, 17, "evicting cached index for directory '%s'",
+      case_cache_tail->path);
+    case_cache_remove(case_cache_tail);
+  }
+
+  if (case_table_add(case_cache_tab, idx->path, idx,
+      sizeof(struct case_dir_index)) < 0) {
+    pr_trace_msg(trace_channel, 3,
+      "error caching index for directory '%s': %s", idx->path,
+      strerror(errno));
+    destroy_pool(idx->pool);
+    return;
+  }
+
+  idx->next = case_cache_head;
+  if (case_cache_head != NULL) {
+    case_cache_head->prev = idx;
+  }
+  case_cache_head = idx;
+
+  if (case_cache_tail == NULL) {
+    case_cache_tail = idx;
+  }
+
+  case_cache_nentries++;
+  case_cache_nbytes += idx->nbytes;
+
+  pr_trace_msg(trace_channel, 17,
+    "cached index of %u names (%lu bytes) for directory '%s'", idx->nnames,
+    (unsigned long) idx->nbytes, idx->path);
+
+  if (case_watch_engine == TRUE) {
+    case_watch_add(idx);
+  }
+}
+
+/* Notes the change which a command is about to make to the given path, if
+ * the index of the path's directory is cached, and currently valid.
+ */
+static void case_cache_add_op(pool *p, array_header *ops, const char *path) {
+  char *dir_path, *name = NULL;
+  const char *key;
+  struct case_dir_index *idx;
+  struct case_cache_op *op;
+  struct stat st;
+
+  dir_path = case_dir_name(p, path, &name);
+
+  if (*name == '\0' ||
+      strcmp(name, ".") == 0 ||
+      strcmp(name, "..") == 0) {
+    return;
+  }
+
+  key = case_cache_key(p, dir_path);
+  idx = (struct case_dir_index *) pr_table_get(case_cache_tab, key, NULL);
+  if (idx == NULL) {
+    return;
+  }
+
+  if (pr_fsio_stat(dir_path, &st) < 0 ||
+      idx->dev != st.st_dev ||
+      idx->ino != st.st_ino ||
+      idx->mtime != st.st_mtime ||
+      idx->mtime >= idx->built) {
+    return;
+  }
+
+  op = case_push_array(ops);
+  op->idx = idx;
+  op->key = case_pstrdup(p, key);
+  op->dir_path = dir_path;
+  op->path = case_pdircat(p, dir_path, name);
+  op->name = name;
+  op->mtime = st.st_mtime;
+  op->started = time(NULL);
+}
+
+/* Updates a directory's cached index for the change noted before a command,
+ * according to whether the changed name now exists, rather than scanning the
+ * directory again.  The index is then taken to be current as of the
+ * directory's new mtime, which would hide changes made by other processes
+ * while the command ran; so this is only done if the command finished within
+ * the second in which it started (and in which the index was known to be
+ * current).  Changes by others within that second still go unnoticed until
+ * the directory changes again.
+ */
+static void case_cache_apply_op(struct case_cache_op *op) {
+  int res;
+  size_t nbytes;
+  struct case_dir_index *idx;
+  struct stat st;
+
+  /* Make sure the index was not evicted in the meantime. */
+  idx = op->idx;
+  if (pr_table_get(case_cache_tab, op->key, NULL) != idx) {
+    return;
+  }
+
+  if (pr_fsio_stat(op->dir_path, &st) < 0 ||
+      idx->dev != st.st_dev ||
+      idx->ino != st.st_ino) {
+    case_cache_remove(idx);
+    return;
+  }
+
+  if (st.st_mtime == op->mtime &&
+      op->mtime < op->started) {
+    /* The directory did not change, e.g. as the command failed. */
+    return;
+  }
+
+  /* Others changing the directory after the command's first second would
+   * show in its modification time; within that second, they would not.
+   */
+  if (st.st_mtime != op->started) {
+    pr_trace_msg(trace_channel, 17,
+      "directory '%s' changed outside of the command's first second, "
+      "removing its cached index", idx->path);
+    case_cache_remove(idx);
+    return;
+  }
+
+  nbytes = idx->nbytes;
+
+  if (pr_fsio_lstat(op->path, &st) == 0) {
+    res = case_cache_add_name(idx, op->name);
+
+  } else {
+    res = (errno == ENOENT ? case_cache_remove_name(idx, op->name) : -1);
+  }
+
+  case_cache_nbytes += idx->nbytes;
+  case_cache_nbytes -= nbytes;
+
+  if (res < 0) {
+    pr_trace_msg(trace_channel, 17,
+      "unable to update cached index for directory '%s', removing", idx->path);
+    case_cache_remove(idx);
+    return;
+  }
+
+  if (pr_fsio_stat(op->dir_path, &st) < 0 ||
+      st.st_mtime != op->started) {
+    case_cache_remove(idx);
+    return;
+  }
+
+  idx->mtime = st.st_mtime;
+  idx->built = idx->mtime + 1;
+
+  pr_trace_msg(trace_channel, 17,
+    "updated cached index for directory '%s' for '%s'", idx->path, op->name);
+}
+
+/* Shared cache routines
+ */
+
+static int case_shm_create(void) {
+  config_rec *c;
+  void *addr;
+
+  c = find_config(main_server->conf, CONF_PARAM, "CaseSharedCache", FALSE);
+  if (c == NULL) {
+    return 0;
+  }
+
+  case_shm_nentries = *((unsigned int *) c->argv[0]);
+  if (case_shm_nentries == 0) {
+    return 0;
+  }
+
+  /* Round up to a whole number of sets. */
+  case_shm_nentries = ((case_shm_nentries + CASE_SHM_NWAYS - 1) /
+    CASE_SHM_NWAYS) * CASE_SHM_NWAYS;
+  case_shm_size = case_shm_nentries * sizeof(struct case_shm_entry);
+
+  addr = mmap(NULL, case_shm_size, PROT_READ|PROT_WRITE,
+    MAP_SHARED|MAP_ANON, -1, 0);
+  if (addr == MAP_FAILED) {
+    int xerrno = errno;
+
+    pr_log_pri(PR_LOG_NOTICE, MOD_CASE_VERSION
+      ": error allocating CaseSharedCache of %lu bytes: %s",
+      (unsigned long) case_shm_size, strerror(xerrno));
+    case_shm_nentries = 0;
+    case_shm_size = 0;
+
+    errno = xerrno;
+    return -1;
+  }
+
+  case_shm_entries = addr;
+  pr_log_debug(DEBUG5, MOD_CASE_VERSION
+    ": allocated CaseSharedCache of %u entries (%lu bytes)", case_shm_nentries,
+    (unsigned long) case_shm_size);
+  return 0;
+}
+
+static void case_shm_destroy(void) {
+  if (case_shm_entries != NULL) {
+    (void) munmap((void *) case_shm_entries, case_shm_size);
+    case_shm_entries = NULL;
+  }
+
+  case_shm_nentries = 0;
+  case_shm_size = 0;
+}
+
+/* The key includes everything which affects how the client-sent path is
+ * resolved: the session's chroot, its current directory (for relative paths),
+ * and the path itself.
+ */
+static const char *case_shm_key(pool *p, const char *path) {
+  const char *key;
+
+  key = case_pstrcat(p, session.chroot_path ? session.chroot_path : "", "\n",
+    *path != '/' ? pr_fs_getcwd() : "", "\n", path, NULL);
+  if (strlen(key) >= CASE_SHM_KEY_MAX) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+
+  return key;
+}
+
+static int case_shm_stat_dir(const char *path, struct case_shm_dir *dir) {
+  struct stat st;
+
+  if (pr_fsio_stat(path, &st) < 0) {
+    return -1;
+  }
+
+  dir->dev = st.st_dev;
+  dir->ino = st.st_ino;
+  dir->mtime = st.st_mtime;
+  return 0;
+}
+
+/* Stats the directory of each component of the given resolved path.
+ * Returns -1 if one cannot be stat'd, or if there are too many.
+ */
+static int case_shm_stat_dirs(const char *path, struct case_shm_dir *dirs,
+    unsigned int *ndirs) {
+  char buf[CASE_SHM_VALUE_MAX], *ptr;
+  unsigned int n = 0;
+
+  if (*path == '\0') {
+    return -1;
+  }
+
+  sstrncpy(buf, path, sizeof(buf));
+
+  /* The directory of the first component is either the root, or the
+   * current directory.
+   */
+  if (case_shm_stat_dir(*buf == '/' ? "/" : ".", &(dirs[n++])) < 0) {
+    return -1;
+  }
+
+  for (ptr = strchr(buf + 1, '/'); ptr != NULL; ptr = strchr(ptr + 1, '/')) {
+    int res;
+
+    if (n == CASE_SHM_MAX_DIRS) {
+      return -1;
+    }
+
+    *ptr = '\0';
+    res = case_shm_stat_dir(buf, &(dirs[n++]));
+    *ptr = '/';
+
+    if (res < 0) {
+      return -1;
+    }
+  }
+
+  *ndirs = n;
+  return 0;
+}
+
+static const char *case_shm_get(pool *p, const char *path, int *changed) {
+  register unsigned int i, j;
+  unsigned int hash, set;
+  const char *key;
+  struct case_shm_entry entry;
+  struct case_shm_dir dirs[CASE_SHM_MAX_DIRS];
+
+  if (case_shm_entries == NULL) {
+    return NULL;
+  }
+
+  key = case_shm_key(p, path);
+  if (key == NULL) {
+    return NULL;
+  }
+
+  hash = case_name_hash(key);
+  set = (hash % (case_shm_nentries / CASE_SHM_NWAYS)) * CASE_SHM_NWAYS;
+
+  for (i = set; i < set + CASE_SHM_NWAYS; i++) {
+    struct case_shm_entry *e;
+    unsigned int ndirs, seq;
+
+    e = &(case_shm_entries[i]);
+
+    seq = e->seq;
+    if (seq == 0 ||
+        (seq & 1) ||
+        e->hash != hash) {
+      continue;
+    }
+
+    __sync_synchronize();
+    memcpy(&entry, e, sizeof(entry));
+    __sync_synchronize();
+
+    if (e->seq != seq) {
+      /* Modified while we were reading it. */
+      pr_trace_msg(trace_channel, 17,
+        "shared cache entry for '%s' contended, ignoring", path);
+      continue;
+    }
+
+    if (entry.uid != session.uid ||
+        strncmp(entry.key, key, sizeof(entry.key)) != 0) {
+      continue;
+    }
+
+    entry.value[sizeof(entry.value)-1] = '\0';
+
+    if (case_shm_stat_dirs(entry.value, dirs, &ndirs) < 0 ||
+        ndirs != entry.ndirs) {
+      pr_trace_msg(trace_channel, 17,
+        "shared cache entry for '%s' is stale, ignoring", path);
+      return NULL;
+    }
+
+    for (j = 0; j < ndirs; j++) {
+      if (dirs[j].dev != entry.dirs[j].dev ||
+          dirs[j].ino != entry.dirs[j].ino ||
+          dirs[j].mtime != entry.dirs[j].mtime ||
+          entry.dirs[j].mtime >= entry.stored) {
+        pr_trace_msg(trace_channel, 17,
+          "shared cache entry for '%s' is stale, ignoring", path);
+        return NULL;
+      }
+    }
+
+    if (changed != NULL &&
+        entry.changed == TRUE) {
+      *changed = TRUE;
+    }
+
+    pr_trace_msg(trace_channel, 17, "found shared cache entry '%s' for '%s'",
+      entry.value, path);
+    return case_pstrdup(p, entry.value);
+  }
+
+  return NULL;
+}
+
+static void case_shm_put(pool *p, const char *path, const char *value,
+    int changed) {
+  register unsigned int i;
+  unsigned int hash, set, seq;
+  const char *key;
+  struct case_shm_entry *e = NULL;
+  struct case_shm_dir dirs[CASE_SHM_MAX_DIRS];
+  unsigned int ndirs;
+
+  if (case_shm_entries == NULL ||
+      strlen(value) >= CASE_SHM_VALUE_MAX) {
+    return;
+  }
+
+  key = case_shm_key(p, path);
+  if (key == NULL) {
+    return;
+  }
+
+  if (case_shm_stat_dirs(value, dirs, &ndirs) < 0) {
+    return;
+  }
+
+  hash = case_name_hash(key);
+  set = (hash % (case_shm_nentries / CASE_SHM_NWAYS)) * CASE_SHM_NWAYS;
+
+  /* Prefer an existing entry for this key, then an empty entry, then the
+   * oldest entry in the set.
+   */
+  for (i = set; i < set + CASE_SHM_NWAYS; i++) {
+    struct case_shm_entry *iter;
+
+    iter = &(case_shm_entries[i]);
+    if (iter->hash == hash &&
+        strncmp(iter->key, key, sizeof(iter->key)) == 0) {
+      e = iter;
+      break;
+    }
+
+    if (e == NULL ||
+        iter->stored < e->stored) {
+      e = iter;
+    }
+  }
+
+  seq = e->seq;
+  if ((seq & 1) ||
+      !__sync_bool_compare_and_swap(&(e->seq), seq, seq + 1)) {
+    /* Another process is writing this entry; let it. */
+    pr_trace_msg(trace_channel, 17,
+      "shared cache entry for '%s' contended, not caching", path);
+    return;
+  }
+
+  __sync_synchronize();
+
+  e->hash = hash;
+  e->uid = session.uid;
+  e->changed = changed;
+  e->ndirs = ndirs;
+  memcpy(e->dirs, dirs, ndirs * sizeof(struct case_shm_dir));
+  e->stored = time(NULL);
+  sstrncpy(e->key, key, sizeof(e->key));
+  sstrncpy(e->value, value, sizeof(e->value));
+
+  __sync_synchronize();
+  e->seq = seq + 2;
+}
+
+/* Negative cache routines
+ */
+
+/* The key for a name in a directory; the name is folded, so that all of the
+ * case variants of a name share an entry.
+ */
+static const char *case_neg_key(pool *p, const char *dir_path,
+    const char *name) {
+  register unsigned int i;
+  const char *dir_key;
+  char *folded;
+  size_t dir_len;
+
+  dir_key = case_cache_key(p, dir_path);
+  dir_len = strlen(dir_key);
+  if (dir_len + strlen(name) + 2 > sizeof(case_neg_key_buf)) {
+    return NULL;
+  }
+
+  memcpy(case_neg_key_buf, dir_key, dir_len);
+  if (dir_len == 0 ||
+      dir_key[dir_len-1] != '/') {
+    case_neg_key_buf[dir_len++] = '/';
+  }
+
+  folded = case_neg_key_buf + dir_len;
+  for (i = 0; name[i]; i++) {
+    folded[i] = (char) case_fold_tab[(unsigned char) name[i]];
+  }
+  folded[i] = '\0';
+
+  return case_neg_key_buf;
+}
+
+/* Returns TRUE if the given name is known not to exist, in any case, in the
+ * given directory, per the directory's current stat(2) information in `st`.
+ */
+static int case_neg_get(pool *p, const char *dir_path, struct stat *st,
+    const char *name) {
+  register unsigned int i;
+  unsigned int hash, set;
+  const char *key;
+
+  key = case_neg_key(p, dir_path, name);
+  if (key == NULL) {
+    return FALSE;
+  }
+
+  hash = case_name_hash(key);
+  set = (hash % (case_neg_nentries / CASE_NEG_NWAYS)) * CASE_NEG_NWAYS;
+
+  for (i = set; i < set + CASE_NEG_NWAYS; i++) {
+    struct case_neg_entry *e;
+
+    e = &(case_neg_entries[i]);
+    if (e->stored == 0 ||
+        e->hash != hash ||
+        strcmp(e->key, key) != 0) {
+      continue;
+    }
+
+    /* As for cached indexes, an entry stored in the same second as the
+     * directory was last modified cannot be trusted.
+     */
+    if (e->dir_dev != st->st_dev ||
+        e->dir_ino != st->st_ino ||
+        e->dir_mtime != st->st_mtime ||
+        e->dir_mtime >= e->stored ||
+        time(NULL) - e->stored >= (time_t) case_neg_ttl) {
+      pr_trace_msg(trace_channel, 17,
+        "negative cache entry for '%s' is stale, removing", key);
+      e->stored = 0;
+      return FALSE;
+    }
+
+    pr_trace_msg(trace_channel, 9,
+      "found negative cache entry for file '%s' in directory '%s'", name,
+      dir_path);
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Notes that a scan of the given directory, starting at `scanned`, found no
+ * match for the given name.
+ */
+static void case_neg_put(pool *p, const char *dir_path, struct stat *st,
+    const char *name, time_t scanned) {
+  register unsigned int i;
+  unsigned int hash, set;
+  const char *key;
+  struct case_neg_entry *e = NULL;
+
+  /* Such an entry would never be trusted. */
+  if (st->st_mtime >= scanned) {
+    return;
+  }
+
+  key = case_neg_key(p, dir_path, name);
+  if (key == NULL) {
+    return;
+  }
+
+  hash = case_name_hash(key);
+  set = (hash % (case_neg_nentries / CASE_NEG_NWAYS)) * CASE_NEG_NWAYS;
+
+  /* Prefer an existing entry for this key, then an empty entry, then the
+   * oldest entry in the set.
+   */
+  for (i = set; i < set + CASE_NEG_NWAYS; i++) {
+    struct case_neg_entry *iter;
+
+    iter = &(case_neg_entries[i]);
+    if (iter->stored != 0 &&
+        iter->hash == hash &&
+        strcmp(iter->key, key) == 0) {
+      e = iter;
+      break;
+    }
+
+    if (e == NULL ||
+        iter->stored < e->stored) {
+      e = iter;
+    }
+  }
+
+  e->hash = hash;
+  e->dir_dev = st->st_dev;
+  e->dir_ino = st->st_ino;
+  e->dir_mtime = st->st_mtime;
+  e->stored = scanned;
+  sstrncpy(e->key, key, sizeof(e->key));
+}
+
+/* Statistics routines
+ */
+
+static void case_stats_create(void) {
+  void *addr;
+
+  addr = mmap(NULL, sizeof(struct case_stats), PROT_READ|PROT_WRITE,
+    MAP_SHARED|MAP_ANON, -1, 0);
+  if (addr == MAP_FAILED) {
+    /* Each process keeps its own statistics, then. */
+    pr_log_pri(PR_LOG_NOTICE, MOD_CASE_VERSION
+      ": error allocating shared statistics: %s", strerror(errno));
+    return;
+  }
+
+  case_stats = addr;
+  case_stats->since = time(NULL);
+}
+
+static void case_stats_add(unsigned long *counter, unsigned long n) {
+  (void) __sync_fetch_and_add(counter, n);
+}
+
+static void case_stats_max(unsigned long *counter, unsigned long n) {
+  unsigned long curr;
+
+  curr = *counter;
+  while (n > curr) {
+    if (__sync_bool_compare_and_swap(counter, curr, n)) {
+      break;
+    }
+
+    curr = *counter;
+  }
+}
+
+static void case_stats_scan(const char *dir_path, unsigned long nentries,
+    int matched) {
+  unsigned int seq;
+
+  case_stats_add(&(case_stats->scans), 1);
+  case_stats_add(&(case_stats->entries_scanned), nentries);
+  case_stats_add(matched ? &(case_stats->matches) : &(case_stats->misses), 1);
+
+  if (nentries <= case_stats->largest_nentries) {
+    return;
+  }
+
+  /* As for the shared cache entries, a writer which finds the largest scan
+   * being updated by another process simply leaves it be.
+   */
+  seq = case_stats->largest_seq;
+  if ((seq & 1) ||
+      !__sync_bool_compare_and_swap(&(case_stats->largest_seq), seq,
+        seq + 1)) {
+    return;
+  }
+
+  __sync_synchronize();
+  case_stats->largest_nentries = nentries;
+  sstrncpy(case_stats->largest_path, dir_path,
+    sizeof(case_stats->largest_path));
+  __sync_synchronize();
+  case_stats->largest_seq = seq + 2;
+}
+
+static void case_stats_lookup(struct timeval *start) {
+  struct timeval now;
+  unsigned long usecs;
+
+  gettimeofday(&now, NULL);
+  usecs = ((now.tv_sec - start->tv_sec) * 1000000L) +
+    (now.tv_usec - start->tv_usec);
+
+  case_stats_add(&(case_stats->lookup_usecs), usecs);
+  case_stats_max(&(case_stats->max_lookup_usecs), usecs);
+}
+
+#if defined(PR_USE_CTRLS)
+static void case_stats_reset(void) {
+  unsigned int seq;
+
+  case_stats->lookups = 0;
+  case_stats->shared_cache_hits = 0;
+  case_stats->cache_hits = 0;
+  case_stats->negative_cache_hits = 0;
+  case_stats->index_hits = 0;
+  case_stats->canonical_hits = 0;
+  case_stats->probes = 0;
+  case_stats->probe_hits = 0;
+  case_stats->casefold_hits = 0;
+  case_stats->scans = 0;
+  case_stats->entries_scanned = 0;
+  case_stats->matches = 0;
+  case_stats->misses = 0;
+  case_stats->lookup_usecs = 0;
+  case_stats->max_lookup_usecs = 0;
+
+  seq = case_stats->largest_seq;
+  if ((seq & 1) == 0 &&
+      __sync_bool_compare_and_swap(&(case_stats->largest_seq), seq,
+        seq + 1)) {
+    __sync_synchronize();
+    case_stats->largest_nentries = 0;
+    case_stats->largest_path[0] = '\0';
+    __sync_synchronize();
+    case_stats->largest_seq = seq + 2;
+  }
+
+  memset(case_stats->timings, 0, sizeof(case_stats->timings));
+  case_stats->since = time(NULL);
+}
+
+/* Empties the shared cache; entries being written are left be. */
+static void case_shm_flush(void) {
+  register unsigned int i;
+
+  for (i = 0; i < case_shm_nentries; i++) {
+    struct case_shm_entry *e;
+    unsigned int seq;
+
+    e = &(case_shm_entries[i]);
+    seq = e->seq;
+    if (seq == 0 ||
+        (seq & 1) ||
+        !__sync_bool_compare_and_swap(&(e->seq), seq, seq + 1)) {
+      continue;
+    }
+
+    __sync_synchronize();
+    e->hash = 0;
+    e->stored = 0;
+    e->key[0] = '\0';
+    __sync_synchronize();
+    e->seq = seq + 2;
+  }
+}
+#endif /* PR_USE_CTRLS */
+
+/* Drops the session's caches, if "case flush" has been used since this
+ * session last looked.
+ */
+static void case_stats_check_flush(void) {
+  unsigned int gen;
+
+  gen = case_stats->cache_gen;
+  if (gen == case_stats_cache_gen) {
+    return;
+  }
+
+  case_stats_cache_gen = gen;
+
+  while (case_cache_head != NULL) {
+    case_cache_remove(case_cache_head);
+  }
+
+  if (case_neg_entries != NULL) {
+    memset(case_neg_entries, 0,
+      case_neg_nentries * sizeof(struct case_neg_entry));
+  }
+
+  memset(case_probe_dirs, 0, sizeof(case_probe_dirs));
+#if defined(CASE_USE_CASEFOLD)
+  memset(case_casefold_dirs, 0, sizeof(case_casefold_dirs));
+  case_casefold_tick = 0;
+  case_casefold_nnodevs = 0;
+#endif /* CASE_USE_CASEFOLD */
+
+  pr_trace_msg(trace_channel, 9, "flushed session caches, as requested");
+}
+
+/* Timing routines
+ */
+
+static void case_timing_init(void) {
+  register unsigned int i;
+  cmdtable *tab;
+
+  for (tab = case_module.cmdtable; tab->command != NULL; tab++) {
+    if (tab->cmd_type != PRE_CMD ||
+        strcmp(tab->command, C_ANY) == 0) {
+      continue;
+    }
+
+    for (i = 0; i < case_timing_ncmds; i++) {
+      if (strcmp(case_timing_cmds[i], tab->command) == 0) {
+        break;
+      }
+    }
+
+    if (i == case_timing_ncmds &&
+        case_timing_ncmds < CASE_TIMING_MAX_CMDS) {
+      case_timing_cmds[case_timing_ncmds++] = tab->command;
+    }
+  }
+}
+
+static void case_timing_now(struct timespec *ts) {
+#if defined(CLOCK_MONOTONIC)
+  if (clock_gettime(CLOCK_MONOTONIC, ts) == 0) {
+    return;
+  }
+#endif /* CLOCK_MONOTONIC */
+
+  {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    ts->tv_sec = tv.tv_sec;
+    ts->tv_nsec = tv.tv_usec * 1000;
+  }
+}
+
+static unsigned int case_timing_bucket(unsigned long usecs) {
+  unsigned int bucket = 0;
+
+  while (usecs > 0 &&
+         bucket < CASE_TIMING_NBUCKETS - 1) {
+    usecs >>= 1;
+    bucket++;
+  }
+
+  return bucket;
+}
+
+static void case_timing_start(struct timespec *start) {
+  case_timing_dir[0] = '\0';
+  case_timing_now(start);
+}
+
+static void case_timing_stop(cmd_rec *cmd, struct timespec *start) {
+  register unsigned int i;
+  struct timespec now;
+  unsigned long usecs;
+  struct case_timing *timing;
+
+  case_timing_now(&now);
+  usecs = ((now.tv_sec - start->tv_sec) * 1000000L) +
+    ((now.tv_nsec - start->tv_nsec) / 1000L);
+
+  for (i = 0; i < case_timing_ncmds; i++) {
+    if (strcmp(case_timing_cmds[i], cmd->argv[0]) == 0) {
+      break;
+    }
+  }
+
+  if (i == case_timing_ncmds) {
+    return;
+  }
+
+  timing = &(case_timings[i]);
+  timing->buckets[case_timing_bucket(usecs)]++;
+
+  if (usecs >= timing->max_usecs) {
+    timing->max_usecs = usecs;
+    sstrncpy(timing->max_dir, case_timing_dir, sizeof(timing->max_dir));
+  }
+}
+
+/* Returns the upper bound, in microseconds, of the bucket containing the
+ * given percentile, and the total count.
+ */
+static unsigned long case_timing_percentile(struct case_timing *timing,
+    unsigned int pct, unsigned long *count) {
+  register unsigned int i;
+  unsigned long total = 0, sum = 0, rank;
+
+  for (i = 0; i < CASE_TIMING_NBUCKETS; i++) {
+    total += timing->buckets[i];
+  }
+
+  *count = total;
+  if (total == 0) {
+    return 0;
+  }
+
+  rank = ((total * pct) + 99) / 100;
+
+  for (i = 0; i < CASE_TIMING_NBUCKETS; i++) {
+    sum += timing->buckets[i];
+    if (sum >= rank) {
+      break;
+    }
+  }
+
+  return (i == 0 ? 1 : (1UL << i));
+}
+
+/* Logs the session's histograms, and adds them to the shared statistics. */
+static void case_timing_summary(void) {
+  register unsigned int i, j;
+
+  for (i = 0; i < case_timing_ncmds; i++) {
+    struct case_timing *timing, *shared;
+    unsigned long count, p50, p99;
+    unsigned int seq;
+
+    timing = &(case_timings[i]);
+    p50 = case_timing_percentile(timing, 50, &count);
+    if (count == 0) {
+      continue;
+    }
+
+    p99 = case_timing_percentile(timing, 99, &count);
+
+    (void) case_log("timing: %s: %lu %s, p50 <= %lu usecs, p99 <= %lu usecs, "
+      "max %lu usecs%s%s%s", case_timing_cmds[i], count,
+      count == 1 ? "call" : "calls", p50, p99, timing->max_usecs,
+      *timing->max_dir ? " (in directory '" : "", timing->max_dir,
+      *timing->max_dir ? "')" : "");
+
+    shared = &(case_stats->timings[i]);
+    for (j = 0; j < CASE_TIMING_NBUCKETS; j++) {
+      if (timing->buckets[j] > 0) {
+        case_stats_add(&(shared->buckets[j]), timing->buckets[j]);
+      }
+    }
+
+    if (timing->max_usecs <= shared->max_usecs) {
+      continue;
+    }
+
+    seq = shared->max_seq;
+    if ((seq & 1) ||
+        !__sync_bool_compare_and_swap(&(shared->max_seq), seq, seq + 1)) {
+      continue;
+    }
+
+    __sync_synchronize();
+    shared->max_usecs = timing->max_usecs;
+    sstrncpy(shared->max_dir, timing->max_dir, sizeof(shared->max_dir));
+    __sync_synchronize();
+    shared->max_seq = seq + 2;
+  }
+}
+
+/* FSIO counting routines
+ */
+
+/* The counting FS passes its calls on to the FS below it, e.g. that of
+ * mod_vroot, so that the calls counted are those which would be made
+ * without it.
+ */
+static int case_fsio_stat(pr_fs_t *fs, const char *path, struct stat *st) {
+  case_fsio_counts.nstat++;
+  return fs->fs_next->stat(fs->fs_next, path, st);
+}
+
+static int case_fsio_lstat(pr_fs_t *fs, const char *path, struct stat *st) {
+  case_fsio_counts.nstat++;
+  return fs->fs_next->lstat(fs->fs_next, path, st);
+}
+
+static int case_fsio_open(pr_fh_t *fh, const char *path, int flags) {
+  int (*next_open)(pr_fh_t *, const char *, int);
+
+  next_open = fh->fh_fs->fs_next->open;
+
+  case_fsio_counts.nopen++;
+  return next_open(fh, path, flags);
+}
+
+static void *case_fsio_opendir(pr_fs_t *fs, const char *path) {
+  case_fsio_counts.nopendir++;
+  return fs->fs_next->opendir(fs->fs_next, path);
+}
+
+static struct dirent *case_fsio_readdir(pr_fs_t *fs, void *dirh) {
+  case_fsio_counts.nreaddir++;
+  return fs->fs_next->readdir(fs->fs_next, dirh);
+}
+
+static int case_fsio_closedir(pr_fs_t *fs, void *dirh) {
+  return fs->fs_next->closedir(fs->fs_next, dirh);
+}
+
+/* The calls which are not counted are passed on as well, lest the FS's
+ * default handlers, i.e. those of the system FS, be used for them.
+ */
+static int case_fsio_rename(pr_fs_t *fs, const char *from, const char *to) {
+  return fs->fs_next->rename(fs->fs_next, from, to);
+}
+
+static int case_fsio_unlink(pr_fs_t *fs, const char *path) {
+  return fs->fs_next->unlink(fs->fs_next, path);
+}
+
+static int case_fsio_link(pr_fs_t *fs, const char *target, const char *path) {
+  return fs->fs_next->link(fs->fs_next, target, path);
+}
+
+static int case_fsio_readlink(pr_fs_t *fs, const char *path, char *buf,
+    size_t bufsz) {
+  return fs->fs_next->readlink(fs->fs_next, path, buf, bufsz);
+}
+
+static int case_fsio_symlink(pr_fs_t *fs, const char *target,
+    const char *path) {
+  return fs->fs_next->symlink(fs->fs_next, target, path);
+}
+
+static int case_fsio_truncate(pr_fs_t *fs, const char *path, off_t len) {
+  return fs->fs_next->truncate(fs->fs_next, path, len);
+}
+
+static int case_fsio_chmod(pr_fs_t *fs, const char *path, mode_t mode) {
+  return fs->fs_next->chmod(fs->fs_next, path, mode);
+}
+
+static int case_fsio_chown(pr_fs_t *fs, const char *path, uid_t uid,
+    gid_t gid) {
+  return fs->fs_next->chown(fs->fs_next, path, uid, gid);
+}
+
+static int case_fsio_lchown(pr_fs_t *fs, const char *path, uid_t uid,
+    gid_t gid) {
+  return fs->fs_next->lchown(fs->fs_next, path, uid, gid);
+}
+
+static int case_fsio_access(pr_fs_t *fs, const char *path, int mode,
+    uid_t uid, gid_t gid, array_header *suppl_gids) {
+  return fs->fs_next->access(fs->fs_next, path, mode, uid, gid,
+    suppl_gids);
+}
+
+static int case_fsio_utimes(pr_fs_t *fs, const char *path,
+    struct timeval *tvs) {
+  return fs->fs_next->utimes(fs->fs_next, path, tvs);
+}
+
+static int case_fsio_chdir(pr_fs_t *fs, const char *path) {
+  return fs->fs_next->chdir(fs->fs_next, path);
+}
+
+static int case_fsio_chroot(pr_fs_t *fs, const char *path) {
+  return fs->fs_next->chroot(fs->fs_next, path);
+}
+
+static int case_fsio_mkdir(pr_fs_t *fs, const char *path, mode_t mode) {
+  return fs->fs_next->mkdir(fs->fs_next, path, mode);
+}
+
+static int case_fsio_rmdir(pr_fs_t *fs, const char *path) {
+  return fs->fs_next->rmdir(fs->fs_next, path);
+}
+
+static void case_fsio_counts_init(void) {
+  pr_fs_t *fs;
+
+  fs = pr_register_fs(session.pool, CASE_FSIO_COUNTS_FS_NAME, "/");
+  if (fs == NULL) {
+    pr_log_debug(DEBUG2, MOD_CASE_VERSION
+      ": error registering '%s' FS: %s", CASE_FSIO_COUNTS_FS_NAME,
+      strerror(errno));
+    return;
+  }
+
+  if (fs->fs_next == NULL) {
+    pr_log_debug(DEBUG2, MOD_CASE_VERSION
+      ": no FS below '%s' FS, ignoring CaseFSIOCounts",
+      CASE_FSIO_COUNTS_FS_NAME);
+    return;
+  }
+
+  fs->stat = case_fsio_stat;
+  fs->lstat = case_fsio_lstat;
+  fs->open = case_fsio_open;
+  fs->opendir = case_fsio_opendir;
+  fs->readdir = case_fsio_readdir;
+  fs->closedir = case_fsio_closedir;
+  fs->rename = case_fsio_rename;
+  fs->unlink = case_fsio_unlink;
+  fs->link = case_fsio_link;
+  fs->readlink = case_fsio_readlink;
+  fs->symlink = case_fsio_symlink;
+  fs->truncate = case_fsio_truncate;
+  fs->chmod = case_fsio_chmod;
+  fs->chown = case_fsio_chown;
+  fs->lchown = case_fsio_lchown;
+  fs->access = case_fsio_access;
+  fs->utimes = case_fsio_utimes;
+  fs->chdir = case_fsio_chdir;
+  fs->chroot = case_fsio_chroot;
+  fs->mkdir = case_fsio_mkdir;
+  fs->rmdir = case_fsio_rmdir;
+
+  case_fsio_counting = TRUE;
+}
+
+/* On-disk index routines
+ */
+
+static uint32_t case_index_checksum(const unsigned char *data, size_t len) {
+  register size_t i;
+  uint32_t sum = CASE_INDEX_FNV_OFFSET;
+
+  for (i = 0; i < len; i++) {
+    sum ^= data[i];
+    sum *= CASE_INDEX_FNV_PRIME;
+  }
+
+  return sum;
+}
+
+/* Returns the path of the directory's index, in case_index_path_buf, or
+ * NULL if that would be too long.
+ */
+static const char *case_index_path(const char *dir_path,
+    struct stat *dir_st) {
+  int len;
+
+  if (case_index_dir == NULL) {
+    len = pr_snprintf(case_index_path_buf, sizeof(case_index_path_buf),
+      "%s/%s/%s", dir_path, CASE_INDEX_SIDECAR_DIR, CASE_INDEX_SIDECAR_FILE);
+
+  } else {
+    len = pr_snprintf(case_index_path_buf, sizeof(case_index_path_buf),
+      "%s/%llx-%llx.idx", case_index_dir, (unsigned long long) dir_st->st_dev,
+      (unsigned long long) dir_st->st_ino);
+  }
+
+  if (len < 0 ||
+      (size_t) len >= sizeof(case_index_path_buf)) {
+    return NULL;
+  }
+
+  return case_index_path_buf;
+}
+
+static int case_index_validate(const struct case_index_header *hdr,
+    size_t len, struct stat *dir_st, struct stat *index_st) {
+  const char *names;
+
+  /* Anyone who can write to the index could forge it; only trust indexes
+   * written by root, or by the directory's owner, and writable only by them.
+   */
+  if ((index_st->st_uid != 0 &&
+       index_st->st_uid != dir_st->st_uid) ||
+      (index_st->st_mode & (S_IWGRP|S_IWOTH))) {
+    return -1;
+  }
+
+  if (hdr->magic != CASE_INDEX_MAGIC ||
+      hdr->version != CASE_INDEX_VERSION ||
+      hdr->fold_hash != case_index_fold_hash) {
+    return -1;
+  }
+
+  /* As for CaseCache, an index built in the same second as the directory
+   * was last modified cannot be trusted.
+   */
+  if (hdr->dir_dev != (uint64_t) dir_st->st_dev ||
+      hdr->dir_ino != (uint64_t) dir_st->st_ino ||
+      hdr->dir_mtime != (int64_t) dir_st->st_mtime ||
+      hdr->dir_mtime >= hdr->built) {
+    return -1;
+  }
+
+  if (hdr->nslots == 0 ||
+      (hdr->nslots & (hdr->nslots - 1)) != 0 ||
+      hdr->nslots > (len / sizeof(struct case_index_slot)) ||
+      hdr->names_len == 0 ||
+      len != sizeof(struct case_index_header) +
+        ((size_t) hdr->nslots * sizeof(struct case_index_slot)) +
+        hdr->names_len) {
+    return -1;
+  }
+
+  names = (const char *) (((const struct case_index_slot *) (hdr + 1)) +
+    hdr->nslots);
+  if (names[0] != '\0' ||
+      names[hdr->names_len - 1] != '\0') {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Returns the session's mapping of the given index file, if any. */
+static struct case_index_map *case_index_map_get(struct stat *index_st) {
+  register unsigned int i;
+
+  for (i = 0; i < CASE_INDEX_NMAPS; i++) {
+    struct case_index_map *map;
+
+    map = &(case_index_maps[i]);
+    if (map->addr != NULL &&
+        map->dev == index_st->st_dev &&
+        map->ino == index_st->st_ino &&
+        map->mtime == index_st->st_mtime &&
+        map->len == (size_t) index_st->st_size) {
+      map->used = ++case_index_maps_tick;
+      return map;
+    }
+  }
+
+  return NULL;
+}
+
+/* Maps, and checksums, the given index file, replacing the least recently
+ * used mapping.  Returns NULL if the index cannot be used.
+ */
+static struct case_index_map *case_index_map_add(const char *index_path,
+    struct stat *dir_st) {
+  register unsigned int i;
+  struct case_index_map *map;
+  pr_fh_t *fh;
+  struct stat st;
+  void *addr;
+  size_t len;
+
+  fh = pr_fsio_open(index_path, O_RDONLY|O_NOFOLLOW);
+  if (fh == NULL) {
+    return NULL;
+  }
+
+  if (pr_fsio_fstat(fh, &st) < 0 ||
+      st.st_size < (off_t) sizeof(struct case_index_header)) {
+    (void) pr_fsio_close(fh);
+    return NULL;
+  }
+
+  len = (size_t) st.st_size;
+  addr = mmap(NULL, len, PROT_READ, MAP_SHARED, PR_FH_FD(fh), 0);
+  (void) pr_fsio_close(fh);
+
+  if (addr == MAP_FAILED) {
+    pr_trace_msg(trace_channel, 3, "error mapping index '%s': %s",
+      index_path, strerror(errno));
+    return NULL;
+  }
+
+  if (case_index_validate(addr, len, dir_st, &st) < 0 ||
+      case_index_checksum((const unsigned char *) addr +
+        sizeof(struct case_index_header),
+        len - sizeof(struct case_index_header)) !=
+        ((const struct case_index_header *) addr)->checksum) {
+    (void) munmap(addr, len);
+    return NULL;
+  }
+
+  map = &(case_index_maps[0]);
+  for (i = 1; i < CASE_INDEX_NMAPS; i++) {
+    if (case_index_maps[i].used < map->used) {
+      map = &(case_index_maps[i]);
+    }
+  }
+
+  if (map->addr != NULL) {
+    (void) munmap(map->addr, map->len);
+  }
+
+  map->dev = st.st_dev;
+  map->ino = st.st_ino;
+  map->mtime = st.st_mtime;
+  map->addr = addr;
+  map->len = len;
+  map->used = ++case_index_maps_tick;
+
+  return map;
+}
+
+static int case_walk_lstat(struct case_walk *, const char *, struct stat *);
+
+static int case_index_check_name(struct case_walk *walk, const char *name) {
+  struct stat st;
+
+  if (*name == '\0' ||
+      strchr(name, '/') != NULL ||
+      strcmp(name, ".") == 0 ||
+      strcmp(name, "..") == 0) {
+    return -1;
+  }
+
+  return case_walk_lstat(walk, name, &st);
+}
+
+/* Returns 0 if the file was found in the directory's index, 1 if the index
+ * shows that the directory has no such file, and -1 if there is no usable
+ * index for the directory.
+ */
+static int case_index_find(struct case_walk *walk,
+    struct stat *dir_st, const char *file, char **matched_file) {
+  register uint32_t i;
+  int res = 1;
+  const char *dir_path, *index_path, *names;
+  const struct case_index_header *hdr;
+  const struct case_index_slot *slots;
+  struct case_index_map *map;
+  uint32_t hash, mask;
+  struct stat st;
+
+  dir_path = walk->path;
+
+  /* The index must not reveal names which the user could not see by
+   * listing the directory.
+   */
+  if (pr_fsio_access(dir_path, R_OK, session.uid, session.gid,
+      session.gids) < 0) {
+    return -1;
+  }
+
+  index_path = case_index_path(dir_path, dir_st);
+  if (index_path == NULL) {
+    return -1;
+  }
+
+  /* As when it was opened with O_NOFOLLOW, the index must not be a
+   * symlink.
+   */
+  if (pr_fsio_lstat(index_path, &st) < 0 ||
+      !S_ISREG(st.st_mode)) {
+    return -1;
+  }
+
+  /* A mapped index is still checked against the directory, which may have
+   * changed since.
+   */
+  map = case_index_map_get(&st);
+  if (map != NULL &&
+      case_index_validate(map->addr, map->len, dir_st, &st) < 0) {
+    map = NULL;
+
+  } else if (map == NULL) {
+    map = case_index_map_add(index_path, dir_st);
+  }
+
+  if (map == NULL) {
+    pr_trace_msg(trace_channel, 17,
+      "index '%s' for directory '%s' is stale or invalid, ignoring",
+      index_path, dir_path);
+    return -1;
+  }
+
+  hdr = map->addr;
+
+  slots = (const struct case_index_slot *) (hdr + 1);
+  names = (const char *) (slots + hdr->nslots);
+
+  hash = case_name_hash(file);
+  mask = hdr->nslots - 1;
+
+  for (i = 0; i < hdr->nslots; i++) {
+    const struct case_index_slot *slot;
+
+    slot = &(slots[(hash + i) & mask]);
+    if (slot->name_off == 0) {
+      break;
+    }
+
+    if (slot->name_off >= hdr->names_len) {
+      res = -1;
+      break;
+    }
+
+    if (slot->hash != hash ||
+        strcasecmp(names + slot->name_off, file) != 0) {
+      continue;
+    }
+
+    /* A name from the index is used as a path component; make sure it is
+     * one, and that it is in the directory.
+     */
+    if (case_index_check_name(walk, names + slot->name_off) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "index '%s' for directory '%s' has bogus entry for '%s', ignoring",
+        index_path, dir_path, file);
+      res = -1;
+      break;
+    }
+
+    if (strcmp(names + slot->name_off, file) == 0) {
+      pr_trace_msg(trace_channel, 9,
+        "found indexed exact match for file '%s' in directory '%s'", file,
+        dir_path);
+      *matched_file = NULL;
+
+    } else {
+      (void) case_log(
+        "found indexed case-insensitive match '%s' for '%s' in directory '%s'",
+        names + slot->name_off, file, dir_path);
+      sstrncpy(case_name_buf, names + slot->name_off, sizeof(case_name_buf));
+      *matched_file = case_name_buf;
+    }
+
+    res = 0;
+    break;
+  }
+
+  return res;
+}
+
+/* Writes a new index of the given names, read from the directory starting at
+ * the `built` time.
+ */
+static int case_index_write(pool *p, const char *dir_path,
+    struct stat *dir_st, time_t built, array_header *names) {
+  register unsigned int i;
+  const char *index_path, *tmp_path;
+  char *buf, *name_tab, suffix[32];
+  struct case_index_header *hdr;
+  struct case_index_slot *slots;
+  uint32_t nslots, nnames = 0, name_off = 1, mask;
+  size_t buflen, names_len = 1, written = 0;
+  pr_fh_t *fh;
+
+  if (dir_st->st_mtime >= built) {
+    pr_trace_msg(trace_channel, 9,
+      "directory '%s' changed too recently to index", dir_path);
+    return 0;
+  }
+
+  for (i = 0; i < names->nelts; i++) {
+    names_len += strlen(((char **) names->elts)[i]) + 1;
+  }
+
+  nslots = 16;
+  while (nslots < (uint32_t) names->nelts * 2) {
+    nslots *= 2;
+  }
+  mask = nslots - 1;
+
+  buflen = sizeof(struct case_index_header) +
+    (nslots * sizeof(struct case_index_slot)) + names_len;
+  buf = case_pcalloc(p, buflen);
+
+  hdr = (struct case_index_header *) buf;
+  slots = (struct case_index_slot *) (hdr + 1);
+  name_tab = (char *) (slots + nslots);
+
+  /* As when scanning, the first of several names which differ only in case
+   * wins.
+   */
+  for (i = 0; i < names->nelts; i++) {
+    const char *name;
+    uint32_t hash, j;
+    size_t name_len;
+
+    name = ((char **) names->elts)[i];
+    hash = case_name_hash(name);
+
+    for (j = hash & mask; slots[j].name_off != 0; j = (j + 1) & mask) {
+      if (slots[j].hash == hash &&
+          strcasecmp(name_tab + slots[j].name_off, name) == 0) {
+        break;
+      }
+    }
+
+    if (slots[j].name_off != 0) {
+      continue;
+    }
+
+    name_len = strlen(name) + 1;
+    memcpy(name_tab + name_off, name, name_len);
+    slots[j].hash = hash;
+    slots[j].name_off = name_off;
+    name_off += name_len;
+    nnames++;
+  }
+
+  buflen -= (names_len - name_off);
+
+  hdr->magic = CASE_INDEX_MAGIC;
+  hdr->version = CASE_INDEX_VERSION;
+  hdr->fold_hash = case_index_fold_hash;
+  hdr->dir_dev = (uint64_t) dir_st->st_dev;
+  hdr->dir_ino = (uint64_t) dir_st->st_ino;
+  hdr->dir_mtime = (int64_t) dir_st->st_mtime;
+  hdr->built = (int64_t) built;
+  hdr->nslots = nslots;
+  hdr->nnames = nnames;
+  hdr->names_len = name_off;
+  hdr->checksum = case_index_checksum((unsigned char *) slots,
+    buflen - sizeof(struct case_index_header));
+
+  if (case_index_dir == NULL) {
+    const char *sidecar_dir;
+
+    sidecar_dir = case_pdircat(p, dir_path, CASE_INDEX_SIDECAR_DIR);
+    if (pr_fsio_mkdir(sidecar_dir, 0755) == 0) {
+      /* Creating the sidecar directory has just changed the directory's
+       * mtime, and thus this index would already be stale; the next scan of
+       * the directory will write it.
+       */
+      pr_trace_msg(trace_channel, 9, "created index directory '%s'",
+        sidecar_dir);
+      return 0;
+    }
+
+    if (errno != EEXIST) {
+      pr_trace_msg(trace_channel, 3, "error creating index directory '%s': %s",
+        sidecar_dir, strerror(errno));
+      return -1;
+    }
+  }
+
+  index_path = case_index_path(dir_path, dir_st);
+  if (index_path == NULL) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  memset(suffix, '\0', sizeof(suffix));
+  pr_snprintf(suffix, sizeof(suffix)-1, ".%lu.tmp",
+    (unsigned long) session.pid);
+  tmp_path = case_pstrcat(p, index_path, suffix, NULL);
+
+  fh = pr_fsio_open(tmp_path, O_WRONLY|O_CREAT|O_EXCL);
+  if (fh == NULL) {
+    pr_trace_msg(trace_channel, 3, "error opening index '%s': %s", tmp_path,
+      strerror(errno));
+    return -1;
+  }
+
+  /* Whatever the session's umask, an index writable by others is ignored. */
+  (void) pr_fsio_fchmod(fh, 0644);
+
+  while (written < buflen) {
+    int res;
+
+    res = pr_fsio_write(fh, buf + written, buflen - written);
+    if (res < 0) {
+      int xerrno = errno;
+
+      if (xerrno == EINTR) {
+        pr_signals_handle();
+        continue;
+      }
+
+      pr_trace_msg(trace_channel, 3, "error writing index '%s': %s", tmp_path,
+        strerror(xerrno));
+      (void) pr_fsio_close(fh);
+      (void) pr_fsio_unlink(tmp_path);
+      return -1;
+    }
+
+    written += res;
+  }
+
+  if (pr_fsio_close(fh) < 0 ||
+      pr_fsio_rename(tmp_path, index_path) < 0) {
+    pr_trace_msg(trace_channel, 3, "error writing index '%s': %s", index_path,
+      strerror(errno));
+    (void) pr_fsio_unlink(tmp_path);
+    return -1;
+  }
+
+  pr_trace_msg(trace_channel, 9,
+    "wrote index of %lu names for directory '%s' to '%s'",
+    (unsigned long) nnames, dir_path, index_path);
+  return 0;
+}
+
+/* Path walking routines
+ */
+
+/* Appends the given name to the walk's path, as pdircat() would. */
+static int case_walk_append(struct case_walk *walk, const char *name) {
+  size_t len, name_len;
+
+  len = walk->len;
+  name_len = strlen(name);
+
+  if (len + name_len + 1 > PR_TUNABLE_PATH_MAX) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  if (len > 0 &&
+      walk->buf[len-1] != '/') {
+    walk->buf[len++] = '/';
+  }
+
+  memcpy(walk->buf + len, name, name_len + 1);
+  walk->len = len + name_len;
+  return 0;
+}
+
+/* Sets the walk's path to the given directory, plus the given components. */
+static int case_walk_set_path(struct case_walk *walk, const char *dir_path,
+    char **elts, unsigned int count) {
+  register unsigned int i;
+  size_t len;
+
+  len = strlen(dir_path);
+  if (len > PR_TUNABLE_PATH_MAX) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  walk->buf = case_walk_buf;
+  walk->path = walk->buf;
+  memcpy(walk->buf, dir_path, len + 1);
+  walk->len = len;
+
+  for (i = 0; i < count; i++) {
+    if (case_walk_append(walk, elts[i]) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void case_walk_truncate(struct case_walk *walk, size_t len) {
+  walk->buf[len] = '\0';
+  walk->len = len;
+}
+
+/* Opens the directory at the walk's path. */
+static int case_walk_open(struct case_walk *walk) {
+  walk->fd = -1;
+  walk->dir_fd = -1;
+  walk->dirh = NULL;
+  walk->have_dev = FALSE;
+
+#if defined(CASE_USE_OPENAT)
+  if (case_fs_is_system(walk->path) == TRUE) {
+    case_fsio_counts.nopen++;
+    walk->fd = open(walk->path, CASE_O_DIRPATH|CASE_O_CLOEXEC);
+    if (walk->fd < 0) {
+      return -1;
+    }
+  }
+#endif /* CASE_USE_OPENAT */
+
+  return 0;
+}
+
+static void case_walk_close(struct case_walk *walk) {
+  if (walk->fd >= 0) {
+    (void) close(walk->fd);
+    walk->fd = -1;
+  }
+}
+
+/* Descends into the given subdirectory of the current directory. */
+static int case_walk_next(struct case_walk *walk, const char *name) {
+  size_t len;
+
+  len = walk->len;
+  if (case_walk_append(walk, name) < 0) {
+    return -1;
+  }
+
+#if defined(CASE_USE_OPENAT)
+  if (walk->fd >= 0) {
+    int fd;
+
+    /* Another FS (e.g. a mod_vroot alias) may be registered for a deeper
+     * component; if so, the rest of the walk goes through the FSIO API.
+     */
+    if (case_fs_is_system(walk->path) == FALSE) {
+      pr_trace_msg(trace_channel, 17,
+        "directory '%s' is not on the system FS, not using openat(2)",
+        walk->path);
+      case_walk_close(walk);
+      return 0;
+    }
+
+    case_fsio_counts.nopen++;
+    fd = openat(walk->fd, name, CASE_O_DIRPATH|CASE_O_CLOEXEC);
+    if (fd < 0) {
+      int xerrno = errno;
+
+      case_walk_truncate(walk, len);
+      errno = xerrno;
+      return -1;
+    }
+
+    (void) close(walk->fd);
+    walk->fd = fd;
+  }
+#endif /* CASE_USE_OPENAT */
+
+  return 0;
+}
+
+/* Stats the named entry in the current directory, or the current directory
+ * itself if `name` is NULL.
+ */
+static int case_walk_stat(struct case_walk *walk, const char *name,
+    struct stat *st) {
+  int res, xerrno;
+  size_t len;
+
+  if (name == NULL) {
+#if defined(CASE_USE_OPENAT)
+    if (walk->fd >= 0) {
+      case_fsio_counts.nstat++;
+      res = fstat(walk->fd, st);
+
+    } else {
+      res = pr_fsio_stat(walk->path, st);
+    }
+#else
+    res = pr_fsio_stat(walk->path, st);
+#endif /* CASE_USE_OPENAT */
+
+    if (res == 0) {
+      walk->dev = st->st_dev;
+      walk->have_dev = TRUE;
+    }
+
+    return res;
+  }
+
+#if defined(CASE_USE_OPENAT)
+  if (walk->fd >= 0) {
+    case_fsio_counts.nstat++;
+    return fstatat(walk->fd, name, st, 0);
+  }
+#endif /* CASE_USE_OPENAT */
+
+  len = walk->len;
+  if (case_walk_append(walk, name) < 0) {
+    return -1;
+  }
+
+  res = pr_fsio_stat(walk->path, st);
+  xerrno = errno;
+
+  case_walk_truncate(walk, len);
+
+  errno = xerrno;
+  return res;
+}
+
+/* As case_walk_stat(), but does not follow a symlink. */
+static int case_walk_lstat(struct case_walk *walk, const char *name,
+    struct stat *st) {
+  int res, xerrno;
+  size_t len;
+
+#if defined(CASE_USE_OPENAT)
+  if (walk->fd >= 0) {
+    case_fsio_counts.nstat++;
+    return fstatat(walk->fd, name, st, AT_SYMLINK_NOFOLLOW);
+  }
+#endif /* CASE_USE_OPENAT */
+
+  len = walk->len;
+  if (case_walk_append(walk, name) < 0) {
+    return -1;
+  }
+
+  res = pr_fsio_lstat(walk->path, st);
+  xerrno = errno;
+
+  case_walk_truncate(walk, len);
+
+  errno = xerrno;
+  return res;
+}
+
+#if defined(CASE_USE_CASEFOLD)
+/* Reads the inode flags of the current directory. */
+static int case_walk_getflags(struct case_walk *walk, int *flags) {
+  int fd, res, xerrno;
+
+  /* Descriptors opened with O_PATH do not support ioctl(2). */
+  case_fsio_counts.nopen++;
+  fd = openat(walk->fd, ".", O_RDONLY|O_DIRECTORY|CASE_O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  res = ioctl(fd, FS_IOC_GETFLAGS, flags);
+  xerrno = errno;
+
+  (void) close(fd);
+
+  errno = xerrno;
+  return res;
+}
+#endif /* CASE_USE_CASEFOLD */
+
+#if defined(CASE_USE_CASEFOLD)
+static int case_casefold_nodev(dev_t dev) {
+  register unsigned int i;
+
+  for (i = 0; i < case_casefold_nnodevs && i < CASE_CASEFOLD_NDEVS; i++) {
+    if (case_casefold_nodevs[i] == dev) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+#endif /* CASE_USE_CASEFOLD */
+
+/* Returns FALSE if the current directory is known to be on a filesystem
+ * which does not support casefolding, without a stat(2) of the directory.
+ * The device last seen by the walk is used; a directory on another
+ * filesystem, mounted below it, is thus not checked, and merely scanned as
+ * usual.
+ */
+static int case_walk_may_casefold(struct case_walk *walk) {
+#if defined(CASE_USE_CASEFOLD)
+  if (walk->fd < 0) {
+    return FALSE;
+  }
+
+  if (walk->have_dev == TRUE &&
+      case_casefold_nodev(walk->dev) == TRUE) {
+    return FALSE;
+  }
+
+  return TRUE;
+#else
+  return FALSE;
+#endif /* CASE_USE_CASEFOLD */
+}
+
+/* Returns TRUE if the current directory, whose stat(2) information is in
+ * `st`, is casefolded by the filesystem.  The walk must have a descriptor
+ * for the directory.
+ */
+static int case_walk_is_casefold(struct case_walk *walk, struct stat *st) {
+#if defined(CASE_USE_CASEFOLD)
+  register unsigned int i;
+  int flags = 0;
+  unsigned int set;
+  struct case_casefold_dir *dir = NULL;
+
+  if (case_casefold_nodev(st->st_dev) == TRUE) {
+    return FALSE;
+  }
+
+  set = ((unsigned long) (st->st_ino ^ st->st_dev) %
+    (CASE_CASEFOLD_NDIRS / CASE_CASEFOLD_NWAYS)) * CASE_CASEFOLD_NWAYS;
+
+  /* Use the entry for this directory, if any, else the least recently used
+   * entry in the set.
+   */
+  for (i = set; i < set + CASE_CASEFOLD_NWAYS; i++) {
+    struct case_casefold_dir *iter;
+
+    iter = &(case_casefold_dirs[i]);
+    if (iter->used != 0 &&
+        iter->dev == st->st_dev &&
+        iter->ino == st->st_ino) {
+      iter->used = ++case_casefold_tick;
+      return iter->casefold;
+    }
+
+    if (dir == NULL ||
+        iter->used < dir->used) {
+      dir = iter;
+    }
+  }
+
+  if (case_walk_getflags(walk, &flags) < 0) {
+    /* Filesystems without the flag fail with ENOTTY, or EOPNOTSUPP; none of
+     * their directories need be checked again.
+     */
+    if (errno == ENOTTY ||
+        errno == EOPNOTSUPP) {
+      pr_trace_msg(trace_channel, 17,
+        "filesystem of directory '%s' does not support casefolding",
+        walk->path);
+      case_casefold_nodevs[case_casefold_nnodevs++ % CASE_CASEFOLD_NDEVS] =
+        st->st_dev;
+    }
+
+    return FALSE;
+  }
+
+  dir->dev = st->st_dev;
+  dir->ino = st->st_ino;
+  dir->used = ++case_casefold_tick;
+  dir->casefold = FALSE;
+
+  if (flags & FS_CASEFOLD_FL) {
+    pr_trace_msg(trace_channel, 17, "directory '%s' is casefolded",
+      walk->path);
+    dir->casefold = TRUE;
+  }
+
+  return dir->casefold;
+#else
+  return FALSE;
+#endif /* CASE_USE_CASEFOLD */
+}
+
+static int case_walk_opendir(struct case_walk *walk) {
+  walk->dir_fd = -1;
+  walk->dirh = NULL;
+  walk->nread = 0;
+
+#if defined(CASE_USE_OPENAT)
+  if (walk->fd >= 0) {
+    int fd;
+
+    case_fsio_counts.nopendir++;
+    fd = openat(walk->fd, ".", O_RDONLY|O_DIRECTORY|CASE_O_CLOEXEC);
+    if (fd < 0) {
+      return -1;
+    }
+
+# if defined(CASE_USE_GETDENTS)
+    if (case_dents_buf == NULL) {
+      case_dents_buf = case_palloc(session.pool, CASE_DENTS_BUFSZ);
+    }
+
+    walk->dir_fd = fd;
+    walk->dents_len = walk->dents_pos = 0;
+    return 0;
+# else
+    walk->dirh = fdopendir(fd);
+    if (walk->dirh == NULL) {
+      int xerrno = errno;
+
+      (void) close(fd);
+      errno = xerrno;
+      return -1;
+    }
+
+    return 0;
+# endif /* CASE_USE_GETDENTS */
+  }
+#endif /* CASE_USE_OPENAT */
+
+  walk->dirh = pr_fsio_opendir(walk->path);
+  if (walk->dirh == NULL) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Returns the name of the next entry in the current directory, or NULL once
+ * there are no more.  Pending signals are handled once per batch of entries,
+ * not once per entry.
+ */
+static const char *case_walk_readdir(struct case_walk *walk) {
+  struct dirent *dent;
+
+#if defined(CASE_USE_GETDENTS)
+  if (walk->dir_fd >= 0) {
+    struct case_dirent64 *dent64;
+
+    case_fsio_counts.nreaddir++;
+
+    if (walk->dents_pos >= walk->dents_len) {
+      long res;
+
+      pr_signals_handle();
+
+      res = syscall(SYS_getdents64, walk->dir_fd, case_dents_buf,
+        CASE_DENTS_BUFSZ);
+      while (res < 0 &&
+             errno == EINTR) {
+        pr_signals_handle();
+        res = syscall(SYS_getdents64, walk->dir_fd, case_dents_buf,
+          CASE_DENTS_BUFSZ);
+      }
+
+      if (res <= 0) {
+        return NULL;
+      }
+
+      walk->dents_len = (size_t) res;
+      walk->dents_pos = 0;
+    }
+
+    dent64 = (struct case_dirent64 *) (case_dents_buf + walk->dents_pos);
+    walk->dents_pos += dent64->d_reclen;
+
+    return dent64->d_name;
+  }
+#endif /* CASE_USE_GETDENTS */
+
+  if (walk->nread++ % CASE_SCAN_BATCH_SIZE == 0) {
+    pr_signals_handle();
+  }
+
+  if (walk->fd >= 0) {
+    case_fsio_counts.nreaddir++;
+    dent = readdir(walk->dirh);
+
+  } else {
+    dent = pr_fsio_readdir(walk->dirh);
+  }
+
+  if (dent == NULL) {
+    return NULL;
+  }
+
+  return dent->d_name;
+}
+
+static void case_walk_closedir(struct case_walk *walk) {
+  if (walk->dir_fd >= 0) {
+    (void) close(walk->dir_fd);
+    walk->dir_fd = -1;
+    return;
+  }
+
+  if (walk->fd >= 0) {
+    (void) closedir(walk->dirh);
+
+  } else {
+    (void) pr_fsio_closedir(walk->dirh);
+  }
+
+  walk->dirh = NULL;
+}
+
+/* Name matching routines
+ */
+
+static void case_fold_init(void) {
+  register unsigned int i;
+
+  for (i = 0; i < sizeof(case_fold_tab); i++) {
+    case_fold_tab[i] = (unsigned char) tolower((int) i);
+  }
+
+  case_index_fold_hash = case_index_checksum(case_fold_tab,
+    sizeof(case_fold_tab));
+}
+
+/* Returns a copy of the given name, of at most PR_TUNABLE_PATH_MAX bytes, in
+ * the CaseUploadPolicy's case, in case_name_buf.
+ */
+static char *case_canonical_name(const char *name, size_t len) {
+  register size_t i;
+  char *canon;
+
+  canon = case_name_buf;
+
+  for (i = 0; i < len; i++) {
+    unsigned char c;
+
+    c = (unsigned char) name[i];
+    canon[i] = (char) (case_upload_policy == CASE_UPLOAD_POLICY_UPPER ?
+      toupper((int) c) : case_fold_tab[c]);
+  }
+  canon[len] = '\0';
+
+  return canon;
+}
+
+/* Returns the given path with its last component in the CaseUploadPolicy's
+ * case, or NULL if that is the path as given.
+ */
+static const char *case_canonical_path(pool *p, const char *path) {
+  const char *name, *end;
+  char *canon;
+
+  end = path + strlen(path);
+  while (end > path &&
+         end[-1] == '/') {
+    end--;
+  }
+
+  name = end;
+  while (name > path &&
+         name[-1] != '/') {
+    name--;
+  }
+
+  if ((size_t) (end - name) >= sizeof(case_name_buf)) {
+    return NULL;
+  }
+
+  canon = case_canonical_name(name, end - name);
+  if (strncmp(canon, name, end - name) == 0) {
+    return NULL;
+  }
+
+  return case_pstrcat(p, case_pstrndup(p, path, name - path), canon, end, NULL);
+}
+
+/* Returns a copy of the given name, converted to the given CaseProbe
+ * convention, in the given buffer.
+ */
+static char *case_probe_name(char *variant, size_t variantsz, const char *name,
+    int convention) {
+  register size_t i;
+
+  sstrncpy(variant, name, variantsz);
+  for (i = 0; variant[i]; i++) {
+    unsigned char c;
+
+    c = (unsigned char) variant[i];
+    if (convention == CASE_PROBE_UPPER ||
+        (convention == CASE_PROBE_CAPITALIZED && i == 0)) {
+      variant[i] = (char) toupper((int) c);
+
+    } else {
+      variant[i] = (char) case_fold_tab[c];
+    }
+  }
+
+  return variant;
+}
+
+/* Returns the convention which the given name follows, or CASE_PROBE_UNKNOWN
+ * if the name has no letters.
+ */
+static int case_probe_classify(const char *name) {
+  register size_t i;
+  int has_alpha = FALSE, is_lower = TRUE, is_upper = TRUE;
+  int is_capitalized = TRUE;
+
+  for (i = 0; name[i]; i++) {
+    unsigned char c;
+
+    c = (unsigned char) name[i];
+    if (isalpha((int) c)) {
+      has_alpha = TRUE;
+    }
+
+    if (case_fold_tab[c] != c) {
+      is_lower = FALSE;
+    }
+
+    if (toupper((int) c) != c) {
+      is_upper = FALSE;
+    }
+
+    if ((i == 0 && toupper((int) c) != c) ||
+        (i > 0 && case_fold_tab[c] != c)) {
+      is_capitalized = FALSE;
+    }
+  }
+
+  if (has_alpha == FALSE) {
+    return CASE_PROBE_UNKNOWN;
+  }
+
+  if (is_lower == TRUE) {
+    return CASE_PROBE_LOWER;
+  }
+
+  if (is_upper == TRUE) {
+    return CASE_PROBE_UPPER;
+  }
+
+  if (is_capitalized == TRUE) {
+    return CASE_PROBE_CAPITALIZED;
+  }
+
+  return CASE_PROBE_MIXED;
+}
+
+static struct case_probe_dir *case_probe_get_dir(pool *p, const char *dir_path,
+    unsigned int *hash) {
+  *hash = case_name_hash(case_cache_key(p, dir_path));
+  return &(case_probe_dirs[*hash % CASE_PROBE_NDIRS]);
+}
+
+/* Notes the convention followed by a name found in the given directory. */
+static void case_probe_learn(pool *p, const char *dir_path, const char *name) {
+  int convention;
+  unsigned int hash;
+  struct case_probe_dir *dir;
+
+  convention = case_probe_classify(name);
+  if (convention == CASE_PROBE_UNKNOWN) {
+    return;
+  }
+
+  dir = case_probe_get_dir(p, dir_path, &hash);
+  dir->hash = hash;
+  dir->convention = convention;
+}
+
+/* Looks for the given name, by stat(2) of its case variants, in the walk's
+ * current directory.  Returns 0 if a variant exists, -1 otherwise.
+ */
+static int case_probe(pool *p, struct case_walk *walk, const char *name,
+    char **matched_name, struct stat *st) {
+  register unsigned int i, j;
+  int conventions[CASE_PROBE_NVARIANTS+1], learned = CASE_PROBE_UNKNOWN;
+  unsigned int hash, nconventions = 0, nvariants = 0;
+  char *variants[CASE_PROBE_NVARIANTS+1];
+  struct case_probe_dir *dir;
+
+  dir = case_probe_get_dir(p, walk->path, &hash);
+  if (dir->hash == hash) {
+    learned = dir->convention;
+  }
+
+  if (learned == CASE_PROBE_MIXED) {
+    pr_trace_msg(trace_channel, 17,
+      "names in directory '%s' follow no convention, not probing", walk->path);
+    return -1;
+  }
+
+  if (learned != CASE_PROBE_UNKNOWN) {
+    conventions[nconventions++] = learned;
+  }
+
+  for (i = CASE_PROBE_LOWER; i <= CASE_PROBE_CAPITALIZED; i++) {
+    if ((int) i != learned) {
+      conventions[nconventions++] = (int) i;
+    }
+  }
+
+  case_stats_add(&(case_stats->probes), 1);
+
+  for (i = 0; i < nconventions; i++) {
+    char *variant;
+    int tried = FALSE;
+
+    /* Each variant tried is kept, to be compared with the later ones. */
+    variant = case_probe_name(case_probe_bufs[nvariants],
+      sizeof(case_probe_bufs[nvariants]), name, conventions[i]);
+
+    /* The name as given, and the CaseUploadPolicy variant, have already been
+     * looked for; so may have another variant, e.g. "1A" is both uppercase
+     * and capitalized.
+     */
+    if (strcmp(variant, name) == 0 ||
+        (conventions[i] == CASE_PROBE_LOWER &&
+         case_upload_policy == CASE_UPLOAD_POLICY_LOWER) ||
+        (conventions[i] == CASE_PROBE_UPPER &&
+         case_upload_policy == CASE_UPLOAD_POLICY_UPPER)) {
+      continue;
+    }
+
+    for (j = 0; j < nvariants; j++) {
+      if (strcmp(variants[j], variant) == 0) {
+        tried = TRUE;
+        break;
+      }
+    }
+
+    if (tried == TRUE) {
+      continue;
+    }
+
+    variants[nvariants++] = variant;
+
+    if (case_walk_stat(walk, variant, st) == 0) {
+      pr_trace_msg(trace_channel, 9,
+        "found '%s' as '%s' in directory '%s' by probing", name, variant,
+        walk->path);
+
+      dir->hash = hash;
+      dir->convention = conventions[i];
+
+      *matched_name = variant;
+      case_stats_add(&(case_stats->probe_hits), 1);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+static void case_needle_init(struct case_needle *needle, const char *name) {
+  register size_t i;
+  unsigned char *folded;
+
+  needle->name = (const unsigned char *) name;
+  needle->len = strlen(name);
+
+  folded = case_needle_buf;
+  for (i = 0; i <= needle->len; i++) {
+    folded[i] = case_fold_tab[needle->name[i]];
+  }
+
+  needle->folded = folded;
+}
+
+/* Returns 0 if the name is an exact match for the needle, 1 if it matches
+ * only when case is ignored, and -1 otherwise.
+ */
+static int case_needle_match(const struct case_needle *needle,
+    const char *name) {
+  register size_t i;
+  const unsigned char *ptr;
+  int exact = TRUE;
+
+  ptr = (const unsigned char *) name;
+
+  /* Most entries in a large directory differ in their first byte. */
+  if (case_fold_tab[ptr[0]] != needle->folded[0]) {
+    return -1;
+  }
+
+  /* Note that a name shorter than the needle fails here on its NUL, so no
+   * separate length check is needed.
+   */
+  for (i = 0; i < needle->len; i++) {
+    if (ptr[i] != needle->name[i]) {
+      if (case_fold_tab[ptr[i]] != needle->folded[i]) {
+        return -1;
+      }
+
+      exact = FALSE;
+    }
+  }
+
+  if (ptr[i] != '\0') {
+    return -1;
+  }
+
+  return exact ? 0 : 1;
+}
+
+/* Scans the current directory for the given file.  If `idx` points to a
+ * cache index, or `names` to a list for an on-disk index, the names read are
+ * added to it; a list which ends up with fewer than the CaseIndex minimum of
+ * entries is dropped.
+ */
+static int case_scan_directory(pool *p, struct case_walk *walk,
+    const char *file, char **matched_file, struct case_dir_index **idx,
+    array_header **names) {
+  int res = -1;
+  unsigned long nentries = 0;
+  const char *dir_name = walk->path, *name;
+  struct case_needle needle;
+
+  case_needle_init(&needle, file);
+
+  /* For each file in the directory, check it against the given name, both
+   * as an exact match and as a possible match.  If we are also building an
+   * index of the directory, we need to read all of its entries.
+   */
+  name = case_walk_readdir(walk);
+  while (name != NULL) {
+    nentries++;
+
+    if (names != NULL &&
+        *names != NULL) {
+      *((char **) case_push_array(*names)) = case_pstrdup(p, name);
+    }
+
+    if (idx != NULL &&
+        *idx != NULL) {
+      if (case_cache_add_name(*idx, name) < 0) {
+        pr_trace_msg(trace_channel, 9,
+          "directory '%s' is too large to cache its index", dir_name);
+        destroy_pool((*idx)->pool);
+        *idx = NULL;
+
+        if (res == 0 &&
+            (names == NULL || *names == NULL)) {
+          case_stats_scan(dir_name, nentries, TRUE);
+          return 0;
+        }
+      }
+    }
+
+    if (res < 0) {
+      int matched;
+
+      matched = case_needle_match(&needle, name);
+      if (matched == 0) {
+        pr_trace_msg(trace_channel, 9,
+         "found exact match for file '%s' in directory '%s'", file, dir_name);
+        *matched_file = NULL;
+        res = 0;
+
+      } else if (matched == 1) {
+        (void) case_log(
+          "found case-insensitive match '%s' for '%s' in directory '%s'",
+          name, file, dir_name);
+        sstrncpy(case_name_buf, name, sizeof(case_name_buf));
+        *matched_file = case_name_buf;
+        res = 0;
+      }
+
+      if (res == 0) {
+        /* Not enough entries so far to be worth reading the rest of the
+         * directory for an on-disk index.
+         */
+        if (names != NULL &&
+            *names != NULL &&
+            (unsigned int) (*names)->nelts < case_index_min_entries) {
+          *names = NULL;
+        }
+
+        if ((idx == NULL || *idx == NULL) &&
+            (names == NULL || *names == NULL)) {
+          case_stats_scan(dir_name, nentries, TRUE);
+          return 0;
+        }
+      }
+    }
+
+    name = case_walk_readdir(walk);
+  }
+
+  if (names != NULL &&
+      *names != NULL &&
+      (unsigned int) (*names)->nelts < case_index_min_entries) {
+    *names = NULL;
+  }
+
+  case_stats_scan(dir_name, nentries, res == 0);
+
+  if (res < 0) {
+    errno = ENOENT;
+  }
+
+  return res;
+}
+
+/* Returns the number of leading path components which exist as is, i.e. the
+ * index of the first component which needs to be scanned for; the walk's
+ * path is set to the directory containing that component.  The full path is
+ * assumed not to exist.
+ */
+static int case_get_prefix_len(struct case_walk *walk, const char *dir_path,
+    char **elts, unsigned int nelts, unsigned int *prefix_len) {
+  unsigned int len;
+  struct stat st;
+
+  if (nelts == 0) {
+    *prefix_len = 0;
+    return case_walk_set_path(walk, dir_path, elts, 0);
+  }
+
+  /* The most common case is that only the last component is not found;
+   * check for that first.  Otherwise, search for the longest existing
+   * prefix; if a prefix does not exist, neither do any longer prefixes.
+   */
+  len = nelts - 1;
+  if (case_walk_set_path(walk, dir_path, elts, len) < 0) {
+    return -1;
+  }
+
+  if (len > 0 &&
+      pr_fsio_stat(walk->path, &st) < 0) {
+    unsigned int lo = 0, hi = len - 1;
+
+    while (lo < hi) {
+      unsigned int mid;
+
+      mid = lo + ((hi - lo + 1) / 2);
+      if (case_walk_set_path(walk, dir_path, elts, mid) < 0) {
+        return -1;
+      }
+
+      if (pr_fsio_stat(walk->path, &st) == 0) {
+        lo = mid;
+
+      } else {
+        hi = mid - 1;
+      }
+    }
+
+    len = lo;
+    if (case_walk_set_path(walk, dir_path, elts, len) < 0) {
+      return -1;
+    }
+  }
+
+  pr_trace_msg(trace_channel, 17,
+    "scanning from existing prefix '%s' (%u of %u components)", walk->path,
+    len, nelts);
+
+  *prefix_len = len;
+  return 0;
+}
+
+/* Splits the given path into its components.  As for
+ * pr_str_text_to_array(), empty components are skipped.
+ */
+static int case_path_split(struct case_path *cp, const char *path) {
+  const char *ptr;
+  char *elt = NULL;
+  size_t len = 0;
+
+  cp->nelts = 0;
+
+  for (ptr = path; *ptr; ptr++) {
+    if (*ptr == '/') {
+      if (elt != NULL) {
+        cp->buf[len++] = '\0';
+        elt = NULL;
+      }
+
+      continue;
+    }
+
+    if (len + 2 > sizeof(cp->buf)) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+    if (elt == NULL) {
+      if (cp->nelts == CASE_PATH_MAX_COMPONENTS) {
+        errno = ENAMETOOLONG;
+        return -1;
+      }
+
+      elt = &(cp->buf[len]);
+      cp->elts[cp->nelts++] = elt;
+    }
+
+    cp->buf[len++] = *ptr;
+  }
+
+  if (elt != NULL) {
+    cp->buf[len++] = '\0';
+  }
+
+  cp->len = len;
+  return 0;
+}
+
+/* Replaces the given component with the matched name, in place.  The names
+ * of case-insensitive matches are usually of the same length.
+ */
+static int case_path_set(struct case_path *cp, unsigned int i,
+    const char *name) {
+  register unsigned int j;
+  size_t elt_len, name_len, tail_len;
+  char *elt;
+
+  elt = cp->elts[i];
+  elt_len = strlen(elt);
+  name_len = strlen(name);
+
+  if (name_len != elt_len) {
+    if (cp->len - elt_len + name_len > sizeof(cp->buf)) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+    tail_len = cp->len - ((elt + elt_len + 1) - cp->buf);
+    memmove(elt + name_len + 1, elt + elt_len + 1, tail_len);
+
+    for (j = i + 1; j < cp->nelts; j++) {
+      cp->elts[j] += (name_len - elt_len);
+    }
+
+    cp->len = cp->len - elt_len + name_len;
+  }
+
+  memcpy(elt, name, name_len + 1);
+  return 0;
+}
+
+/* Joins the components back into a path, allocated once. */
+static char *case_path_join(pool *p, struct case_path *cp, int absolute) {
+  register unsigned int i;
+  char *path, *ptr;
+
+  ptr = path = case_palloc(p, cp->len + 2);
+
+  if (absolute) {
+    *ptr++ = '/';
+  }
+
+  for (i = 0; i < cp->nelts; i++) {
+    size_t elt_len;
+
+    if (i > 0) {
+      *ptr++ = '/';
+    }
+
+    elt_len = strlen(cp->elts[i]);
+    memcpy(ptr, cp->elts[i], elt_len);
+    ptr += elt_len;
+  }
+
+  *ptr = '\0';
+  return path;
+}
+
+/* If `path_st` is not NULL, it is filled in with the stat(2) information for
+ * the returned path, when known, so that callers need not stat the path
+ * again; otherwise its st_mode is left zero.
+ */
+static const char *case_normalize_path(pool *p, const char *path,
+    int *changed, struct stat *path_st) {
+  register unsigned int i;
+  unsigned int nelts, prefix_len;
+  int xerrno, path_changed = FALSE;
+  struct case_walk walk;
+  const char *cached_path;
+  char *normalized_path, **elts;
+  size_t path_len;
+  pool *iter_pool;
+  struct stat target_st;
+  struct timeval start;
+
+  if (path_st == NULL) {
+    path_st = &target_st;
+  }
+
+  memset(path_st, 0, sizeof(struct stat));
+  case_path_nallocs = 0;
+
+  /* Special cases. */
+  path_len = strlen(path);
+  if (path_len == 1) {
+    if (path[0] == '/' ||
+        path[1] == '.') {
+      /* Nothing to do. */
+      return path;
+    }
+  }
+
+  /* Does the path exist as is?  If so, we can avoid the more expensive
+   * filesystem walk.  Note that the path might point to a directory, and
+   * that, as with open(2), symlinks are followed; a dangling symlink is
+   * treated as a missing path.
+   */
+  if (pr_fsio_stat(path, path_st) == 0) {
+    return path;
+  }
+
+  xerrno = errno;
+  memset(path_st, 0, sizeof(struct stat));
+
+  if (xerrno != ENOENT) {
+    /* The path exists as is; that's OK. */
+    return path;
+  }
+
+  gettimeofday(&start, NULL);
+  case_stats_add(&(case_stats->lookups), 1);
+
+  /* Has another session already resolved this path? */
+  cached_path = case_shm_get(p, path, changed);
+  if (cached_path != NULL) {
+    case_stats_add(&(case_stats->shared_cache_hits), 1);
+    case_stats_lookup(&start);
+    return cached_path;
+  }
+
+  /* Note that it is tempting to use `pr_fs_split_path()`, however its
+   * semantics (resolving to an absolute path first) are not quite expected
+   * here.
+   */
+  if (case_path_split(&case_path, path) < 0) {
+    xerrno = errno;
+
+    (void) case_log("error splitting path '%s': %s", path, strerror(xerrno));
+
+    errno = xerrno;
+    return NULL;
+  }
+
+  elts = case_path.elts;
+  nelts = case_path.nelts;
+
+  /* Skip past the leading components which exist as is; there is no need
+   * to scan their directories.  For the first component, what is the
+   * directory to open?  Depends; did the path start with '/', or not?
+   */
+  if (case_get_prefix_len(&walk, *path == '/' ? "/" : ".", elts, nelts,
+      &prefix_len) < 0 ||
+      case_walk_open(&walk) < 0) {
+    xerrno = errno;
+
+    (void) case_log(
+      "error opening directory '%s': %s", walk.path, strerror(xerrno));
+
+    errno = xerrno;
+    return NULL;
+  }
+
+  /* One pool serves the lookups for all of the components, cleared after
+   * each one.
+   */
+  iter_pool = case_make_sub_pool(p);
+  pr_pool_tag(iter_pool, "Case Normalize Pool");
+
+  for (i = prefix_len; i < nelts; i++) {
+    int res = -1, scan_dir = TRUE, have_dir_st = FALSE;
+    char *matched_elt = NULL;
+    struct case_dir_index *idx = NULL;
+    array_header *names = NULL;
+    time_t index_built = 0, scanned = 0;
+    struct stat st;
+
+    /* Once a component has been matched, the components after it may well
+     * exist as is; a stat(2) is cheaper than a scan.  (The component at the
+     * end of the existing prefix is already known not to exist.)
+     */
+    if (i > prefix_len &&
+        case_walk_stat(&walk, elts[i], &st) == 0) {
+      res = 0;
+
+      if (i + 1 == nelts) {
+        memcpy(path_st, &st, sizeof(struct stat));
+      }
+    }
+
+    if (res < 0 &&
+        case_timing_engine == TRUE) {
+      sstrncpy(case_timing_dir, walk.path, sizeof(case_timing_dir));
+    }
+
+    /* A name not found as is in a casefolded directory does not exist, in
+     * any case.
+     */
+    if (res < 0 &&
+        case_casefold_engine == TRUE &&
+        case_walk_may_casefold(&walk) == TRUE &&
+        case_walk_stat(&walk, NULL, &st) == 0) {
+      have_dir_st = TRUE;
+
+      if (case_walk_is_casefold(&walk, &st) == TRUE) {
+        scan_dir = FALSE;
+        case_stats_add(&(case_stats->casefold_hits), 1);
+      }
+    }
+
+    if (res < 0 &&
+        scan_dir == TRUE &&
+        case_watch_engine == TRUE &&
+        case_watch_nwatches > 0 &&
+        (have_dir_st == TRUE ||
+         case_walk_stat(&walk, NULL, &st) == 0)) {
+      have_dir_st = TRUE;
+
+      idx = case_cache_get_watched(iter_pool, walk.path, &st);
+      if (idx != NULL) {
+        res = case_cache_find(idx, elts[i], &matched_elt);
+        scan_dir = FALSE;
+        case_stats_add(&(case_stats->cache_hits), 1);
+      }
+    }
+
+    /* Names created under a CaseUploadPolicy are in the policy's case; a
+     * stat(2) of the component in that case is cheaper than a scan.
+     */
+    if (res < 0 &&
+        scan_dir == TRUE &&
+        case_upload_policy != CASE_UPLOAD_POLICY_PRESERVE) {
+      char *canon;
+      struct stat canon_st;
+
+      canon = case_canonical_name(elts[i], strlen(elts[i]));
+      if (strcmp(canon, elts[i]) != 0 &&
+          case_walk_stat(&walk, canon, &canon_st) == 0) {
+        res = 0;
+        matched_elt = canon;
+        scan_dir = FALSE;
+        case_stats_add(&(case_stats->canonical_hits), 1);
+
+        if (i + 1 == nelts) {
+          memcpy(path_st, &canon_st, sizeof(struct stat));
+        }
+      }
+    }
+
+    if (res < 0 &&
+        scan_dir == TRUE &&
+        (case_cache_engine == TRUE || case_index_engine == TRUE ||
+         case_neg_engine == TRUE) &&
+        (have_dir_st == TRUE ||
+         case_walk_stat(&walk, NULL, &st) == 0)) {
+      have_dir_st = TRUE;
+
+      if (case_cache_engine == TRUE) {
+        idx = case_cache_get(iter_pool, walk.path, &st);
+        if (idx != NULL) {
+          res = case_cache_find(idx, elts[i], &matched_elt);
+          scan_dir = FALSE;
+          case_stats_add(&(case_stats->cache_hits), 1);
+        }
+      }
+
+      if (scan_dir == TRUE &&
+          case_neg_engine == TRUE) {
+        if (case_neg_get(iter_pool, walk.path, &st, elts[i]) == TRUE) {
+          scan_dir = FALSE;
+          case_stats_add(&(case_stats->negative_cache_hits), 1);
+
+        } else {
+          scanned = time(NULL);
+        }
+      }
+
+      if (scan_dir == TRUE &&
+          case_index_engine == TRUE) {
+        int found;
+
+        found = case_index_find(&walk, &st, elts[i],
+          &matched_elt);
+        if (found >= 0) {
+          res = (found == 0 ? 0 : -1);
+          scan_dir = FALSE;
+          case_stats_add(&(case_stats->index_hits), 1);
+
+        } else {
+          /* Collect the names as we scan, in case the directory is large
+           * enough to be worth indexing.
+           */
+          names = case_make_array(iter_pool, 64, sizeof(char *));
+          index_built = time(NULL);
+        }
+      }
+    }
+
+    if (res < 0 &&
+        scan_dir == TRUE &&
+        case_probe_engine == TRUE) {
+      struct stat probe_st;
+
+      res = case_probe(iter_pool, &walk, elts[i], &matched_elt, &probe_st);
+      if (res == 0) {
+        scan_dir = FALSE;
+
+        if (i + 1 == nelts) {
+          memcpy(path_st, &probe_st, sizeof(struct stat));
+        }
+      }
+    }
+
+    /* On a cache miss, index the directory as we scan it. */
+    if (res < 0 &&
+        scan_dir == TRUE &&
+        have_dir_st == TRUE &&
+        case_cache_engine == TRUE) {
+      idx = case_cache_create(walk.path, &st);
+    }
+
+    if (res < 0 &&
+        scan_dir == TRUE) {
+      if (case_walk_opendir(&walk) < 0) {
+        int xerrno = errno;
+
+        /* This should never happen, right? It could, due to races with other
+         * processes' changes to the filesystem.
+         */
+        (void) case_log(
+          "error opening directory '%s': %s", walk.path, strerror(xerrno));
+        case_walk_close(&walk);
+        destroy_pool(iter_pool);
+
+        errno = xerrno;
+        return NULL;
+      }
+
+      res = case_scan_directory(iter_pool, &walk, elts[i], &matched_elt, &idx,
+        &names);
+      case_walk_closedir(&walk);
+
+      if (res == 0 &&
+          matched_elt != NULL &&
+          case_probe_engine == TRUE) {
+        case_probe_learn(iter_pool, walk.path, matched_elt);
+      }
+
+      if (res < 0 &&
+          scanned > 0) {
+        case_neg_put(iter_pool, walk.path, &st, elts[i], scanned);
+      }
+
+      if (idx != NULL) {
+        case_cache_put(iter_pool, idx);
+      }
+
+      if (names != NULL) {
+        (void) case_index_write(iter_pool, walk.path, &st, index_built, names);
+      }
+    }
+
+    if (res == 0 &&
+        matched_elt != NULL) {
+      if (case_path_set(&case_path, i, matched_elt) < 0) {
+        xerrno = errno;
+
+        case_walk_close(&walk);
+        destroy_pool(iter_pool);
+
+        errno = xerrno;
+        return NULL;
+      }
+
+      path_changed = TRUE;
+
+      /* The target was found by name; fetch its metadata, relative to its
+       * already-open directory, for the caller, unless already known.
+       */
+      if (i + 1 == nelts &&
+          path_st->st_mode == 0) {
+        (void) case_walk_stat(&walk, elts[i], path_st);
+      }
+    }
+
+    clear_pool(iter_pool);
+
+    /* Note that the last component in the list should be the target; we
+     * don't want to descend into the target.
+     */
+    if (i + 1 < nelts &&
+        case_walk_next(&walk, elts[i]) < 0) {
+      xerrno = errno;
+
+      (void) case_log("error opening directory '%s/%s': %s", walk.path,
+        elts[i], strerror(xerrno));
+      case_walk_close(&walk);
+      destroy_pool(iter_pool);
+
+      errno = xerrno;
+      return NULL;
+    }
+  }
+
+  case_walk_close(&walk);
+  destroy_pool(iter_pool);
+
+  /* Now return the normalized path, built from our possibly-modified
+   * components.  We would use `pr_fs_join_join()`, but it has a now-corrected
+   * bug.
+   */
+  normalized_path = case_path_join(p, &case_path, *path == '/');
+
+  if (changed != NULL &&
+      path_changed == TRUE) {
+    *changed = TRUE;
+  }
+
+  case_shm_put(p, path, normalized_path, path_changed);
+  case_stats_lookup(&start);
+
+  pr_trace_msg(trace_channel, 19,
+    "normalized path '%s' to '%s' (%u allocations)", path, normalized_path,
+    case_path_nallocs);
+  return normalized_path;
+}
+
+static int case_have_file(pool *p, const char *path,
+    const char **matched_path, struct stat *st) {
+  int changed = FALSE;
+  const char *normalized_path;
+
+  normalized_path = case_normalize_path(p, path, &changed, st);
+  if (normalized_path == NULL) {
+    return FALSE;
+  }
+
+  if (changed == TRUE) {
+    *matched_path = normalized_path;
+  }
+
+  return TRUE;
+}
+
+/* CaseFSIO routines
+ */
+
+/* The <Directory> sections, HideFiles and <Limit>s which apply to the
+ * command were checked against the path given, not against the path which
+ * it was resolved to; they are checked again, for the resolved path.
+ */
+static int case_fs_check(cmd_rec *cmd, const char *path) {
+  int hidden = FALSE, res;
+  const char *best_path;
+  config_rec *dir_config;
+
+  best_path = dir_best_path(case_fs_pool, path);
+  if (best_path == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  /* The command's own configuration is left as found for its path. */
+  dir_config = session.dir_config;
+  res = dir_check(case_fs_pool, cmd, cmd->group, best_path, &hidden);
+  session.dir_config = dir_config;
+
+  if (hidden == TRUE) {
+    pr_trace_msg(trace_channel, 9, "resolved path '%s' hidden for %s",
+      best_path, (char *) cmd->argv[0]);
+    errno = ENOENT;
+    return -1;
+  }
+
+  if (res == 0) {
+    pr_trace_msg(trace_channel, 9, "resolved path '%s' denied for %s",
+      best_path, (char *) cmd->argv[0]);
+    errno = EACCES;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Sets the path to use instead of the given path, or NULL if there is none.
+ * A path to be created is resolved as the command handlers would: to an
+ * existing name in another case, if any, or else to the name per the
+ * CaseUploadPolicy.  Returns -1, with errno set, if the command may not use
+ * the resolved path.
+ */
+static int case_fs_resolve(const char *path, int create,
+    const char **resolved_path) {
+  int changed = FALSE, res = 0;
+  const char *resolved;
+  struct stat st;
+
+  *resolved_path = NULL;
+
+  /* Resolving a path makes calls of its own. */
+  if (case_fs_resolving == TRUE) {
+    return 0;
+  }
+
+  if (session.curr_cmd_rec == NULL ||
+      case_ignore_cmd(session.curr_cmd_rec) == FALSE) {
+    return 0;
+  }
+
+  case_fs_resolving = TRUE;
+  clear_pool(case_fs_pool);
+
+  resolved = case_normalize_path(case_fs_pool, path, &changed, &st);
+  if (resolved != NULL &&
+      create == TRUE &&
+      case_upload_policy != CASE_UPLOAD_POLICY_PRESERVE &&
+      st.st_mode == 0 &&
+      (changed == FALSE ||
+       pr_fsio_stat(resolved, &st) < 0)) {
+    const char *canon_path;
+
+    canon_path = case_canonical_path(case_fs_pool, resolved);
+    if (canon_path != NULL) {
+      resolved = canon_path;
+      changed = TRUE;
+    }
+  }
+
+  if (resolved != NULL &&
+      changed == TRUE) {
+    pr_trace_msg(trace_channel, 9, "resolved '%s' to '%s' for %s", path,
+      resolved, (char *) session.curr_cmd_rec->argv[0]);
+
+    res = case_fs_check(session.curr_cmd_rec, resolved);
+    if (res == 0) {
+      *resolved_path = resolved;
+    }
+  }
+
+  case_fs_resolving = FALSE;
+  return res;
+}
+
+/* The FS's calls are passed on to the FS below it.  A path is first tried
+ * as given; only if it is not found is it resolved, and the call retried.
+ * Paths to be created are resolved first.
+ */
+static int case_fs_stat(pr_fs_t *fs, const char *path, struct stat *st) {
+  int res;
+  const char *resolved;
+
+  res = fs->fs_next->stat(fs->fs_next, path, st);
+  if (res < 0 &&
+      errno == ENOENT) {
+    if (case_fs_resolve(path, FALSE, &resolved) < 0) {
+      return -1;
+    }
+
+    if (resolved != NULL) {
+      return fs->fs_next->stat(fs->fs_next, resolved, st);
+    }
+
+    errno = ENOENT;
+  }
+
+  return res;
+}
+
+static int case_fs_lstat(pr_fs_t *fs, const char *path, struct stat *st) {
+  int res;
+  const char *resolved;
+
+  res = fs->fs_next->lstat(fs->fs_next, path, st);
+  if (res < 0 &&
+      errno == ENOENT) {
+    if (case_fs_resolve(path, FALSE, &resolved) < 0) {
+      return -1;
+    }
+
+    if (resolved != NULL) {
+      return fs->fs_next->lstat(fs->fs_next, resolved, st);
+    }
+
+    errno = ENOENT;
+  }
+
+  return res;
+}
+
+static int case_fs_open(pr_fh_t *fh, const char *path, int flags) {
+  int res;
+  const char *resolved;
+  int (*next_open)(pr_fh_t *, const char *, int);
+
+  next_open = fh->fh_fs->fs_next->open;
+
+  if (flags & O_CREAT) {
+    if (case_fs_resolve(path, TRUE, &resolved) < 0) {
+      return -1;
+    }
+
+    return next_open(fh, resolved != NULL ? resolved : path, flags);
+  }
+
+  res = next_open(fh, path, flags);
+  if (res < 0 &&
+      errno == ENOENT) {
+    if (case_fs_resolve(path, FALSE, &resolved) < 0) {
+      return -1;
+    }
+
+    if (resolved != NULL) {
+      return next_open(fh, resolved, flags);
+    }
+
+    errno = ENOENT;
+  }
+
+  return res;
+}
+
+static void *case_fs_opendir(pr_fs_t *fs, const char *path) {
+  void *dirh;
+  const char *resolved;
+
+  dirh = fs->fs_next->opendir(fs->fs_next, path);
+  if (dirh == NULL &&
+      errno == ENOENT) {
+    if (case_fs_resolve(path, FALSE, &resolved) < 0) {
+      return NULL;
+    }
+
+    if (resolved != NULL) {
+      return fs->fs_next->opendir(fs->fs_next, resolved);
+    }
+
+    errno = ENOENT;
+  }
+
+  return dirh;
+}
+
+static struct dirent *case_fs_readdir(pr_fs_t *fs, void *dirh) {
+  return fs->fs_next->readdir(fs->fs_next, dirh);
+}
+
+static int case_fs_closedir(pr_fs_t *fs, void *dirh) {
+  return fs->fs_next->closedir(fs->fs_next, dirh);
+}
+
+static int case_fs_rename(pr_fs_t *fs, const char *from, const char *to) {
+  const char *resolved;
+  char from_path[PR_TUNABLE_PATH_MAX+1];
+
+  if (case_fs_resolve(from, FALSE, &resolved) < 0) {
+    return -1;
+  }
+
+  if (resolved != NULL) {
+    sstrncpy(from_path, resolved, sizeof(from_path));
+    from = from_path;
+  }
+
+  if (case_fs_resolve(to, TRUE, &resolved) < 0) {
+    return -1;
+  }
+
+  if (resolved != NULL) {
+    to = resolved;
+  }
+
+  return fs->fs_next->rename(fs->fs_next, from, to);
+}
+
+static int case_fs_unlink(pr_fs_t *fs, const char *path) {
+  int res;
+  const char *resolved;
+
+  res = fs->fs_next->unlink(fs->fs_next, path);
+  if (res < 0 &&
+      errno == ENOENT) {
+    if (case_fs_resolve(path, FALSE, &resolved) < 0) {
+      return -1;
+    }
+
+    if (resolved != NULL) {
+      return fs->fs_next->unlink(fs->fs_next, resolved);
+    }
+
+    errno = ENOENT;
+  }
+
+  return res;
+}
+
+static int case_fs_mkdir(pr_fs_t *fs, const char *path, mode_t mode) {
+  const char *resolved;
+
+  if (case_fs_resolve(path, TRUE, &resolved) < 0) {
+    return -1;
+  }
+
+  return fs->fs_next->mkdir(fs->fs_next, resolved != NULL ? resolved : path,
+    mode);
+}
+
+static int case_fs_rmdir(pr_fs_t *fs, const char *path) {
+  int res;
+  const char *resolved;
+
+  res = fs->fs_next->rmdir(fs->fs_next, path);
+  if (res < 0 &&
+      errno == ENOENT) {
+    if (case_fs_resolve(path, FALSE, &resolved) < 0) {
+      return -1;
+    }
+
+    if (resolved != NULL) {
+      return fs->fs_next->rmdir(fs->fs_next, resolved);
+    }
+
+    errno = ENOENT;
+  }
+
+  return res;
+}
+
+static int case_fs_chmod(pr_fs_t *fs, const char *path, mode_t mode) {
+  int res;
+  const char *resolved;
+
+  res = fs->fs_next->chmod(fs->fs_next, path, mode);
+  if (res < 0 &&
+      errno == ENOENT) {
+    if (case_fs_resolve(path, FALSE, &resolved) < 0) {
+      return -1;
+    }
+
+    if (resolved != NULL) {
+      return fs->fs_next->chmod(fs->fs_next, resolved, mode);
+    }
+
+    errno = ENOENT;
+  }
+
+  return res;
+}
+
+static int case_fs_chown(pr_fs_t *fs, const char *path, uid_t uid,
+    gid_t gid) {
+  int res;
+  const char *resolved;
+
+  res = fs->fs_next->chown(fs->fs_next, path, uid, gid);
+  if (res < 0 &&
+      errno == ENOENT) {
+    if (case_fs_resolve(path, FALSE, &resolved) < 0) {
+      return -1;
+    }
+
+    if (resolved != NULL) {
+      return fs->fs_next->chown(fs->fs_next, resolved, uid, gid);
+    }
+
+    errno = ENOENT;
+  }
+
+  return res;
+}
+
+static int case_fs_utimes(pr_fs_t *fs, const char *path,
+    struct timeval *tvs) {
+  int res;
+  const char *resolved;
+
+  res = fs->fs_next->utimes(fs->fs_next, path, tvs);
+  if (res < 0 &&
+      errno == ENOENT) {
+    if (case_fs_resolve(path, FALSE, &resolved) < 0) {
+      return -1;
+    }
+
+    if (resolved != NULL) {
+      return fs->fs_next->utimes(fs->fs_next, resolved, tvs);
+    }
+
+    errno = ENOENT;
+  }
+
+  return res;
+}
+
+static int case_fs_chdir(pr_fs_t *fs, const char *path) {
+  int res;
+  const char *resolved;
+
+  res = fs->fs_next->chdir(fs->fs_next, path);
+  if (res < 0 &&
+      errno == ENOENT) {
+    if (case_fs_resolve(path, FALSE, &resolved) < 0) {
+      return -1;
+    }
+
+    if (resolved != NULL) {
+      return fs->fs_next->chdir(fs->fs_next, resolved);
+    }
+
+    errno = ENOENT;
+  }
+
+  return res;
+}
+
+static void case_fs_init(void) {
+  pr_fs_t *fs;
+
+  fs = pr_register_fs(session.pool, CASE_FS_NAME, "/");
+  if (fs == NULL) {
+    pr_log_debug(DEBUG2, MOD_CASE_VERSION
+      ": error registering '%s' FS: %s", CASE_FS_NAME, strerror(errno));
+    return;
+  }
+
+  /* There should always be an FS below, for "/"; if not, this FS simply
+   * behaves as the system FS.
+   */
+  if (fs->fs_next == NULL) {
+    pr_log_debug(DEBUG2, MOD_CASE_VERSION
+      ": no FS below '%s' FS, ignoring CaseFSIO", CASE_FS_NAME);
+    return;
+  }
+
+  fs->stat = case_fs_stat;
+  fs->lstat = case_fs_lstat;
+  fs->open = case_fs_open;
+  fs->opendir = case_fs_opendir;
+  fs->readdir = case_fs_readdir;
+  fs->closedir = case_fs_closedir;
+  fs->rename = case_fs_rename;
+  fs->unlink = case_fs_unlink;
+  fs->mkdir = case_fs_mkdir;
+  fs->rmdir = case_fs_rmdir;
+  fs->chmod = case_fs_chmod;
+  fs->chown = case_fs_chown;
+  fs->utimes = case_fs_utimes;
+  fs->chdir = case_fs_chdir;
+
+  case_fs_pool = make_sub_pool(session.pool);
+  pr_pool_tag(case_fs_pool, "Case FSIO Pool");
+
+  case_fs_engine = TRUE;
+}
+
+/* Command handlers
+ */
+
+/* The keys of the notes for a command's path, or for the source and
+ * destination paths of SITE COPY, LINK, and SYMLINK (see mod_case.h).
+ */
+#define CASE_NOTES_PATH			0
+#define CASE_NOTES_SRC_PATH		1
+#define CASE_NOTES_DST_PATH		2
+
+static const char *case_note_keys[3][3] = {
+  { CASE_NOTE_PATH, CASE_NOTE_STAT, CASE_NOTE_DIR },
+  { CASE_NOTE_SRC_PATH, CASE_NOTE_SRC_STAT, CASE_NOTE_SRC_DIR },
+  { CASE_NOTE_DST_PATH, CASE_NOTE_DST_STAT, CASE_NOTE_DST_DIR }
+};
+
+/* Leaves the resolved path, and what is known of it, in the command's notes,
+ * so that later handlers need not look it up again.
+ */
+static void case_add_notes(cmd_rec *cmd, int which, const char *path,
+    struct stat *st) {
+  const char **keys;
+  char *dir_path, *name = NULL;
+
+  if (cmd->notes == NULL) {
+    return;
+  }
+
+  keys = case_note_keys[which];
+
+  path = case_pstrdup(cmd->pool, path);
+  (void) case_table_add(cmd->notes, keys[0], path, 0);
+
+  /* A path resolved from the shared cache comes without its metadata. */
+  if (st != NULL &&
+      st->st_mode != 0) {
+    struct stat *noted_st;
+
+    noted_st = case_palloc(cmd->pool, sizeof(struct stat));
+    memcpy(noted_st, st, sizeof(struct stat));
+    (void) case_table_add(cmd->notes, keys[1], noted_st, sizeof(struct stat));
+  }
+
+  dir_path = case_dir_name(cmd->pool, path, &name);
+  (void) case_table_add(cmd->notes, keys[2], dir_path, 0);
+}
+
+/* The SITE COPY requests are different enough to warrant their own command
+ * handler.
+ */
+MODRET case_pre_copy(cmd_rec *cmd) {
+  const char *matched_path = NULL;
+  char *src_path, *dst_path;
+  int modified_arg = FALSE, proto, res;
+  struct stat st;
+
+  if (case_engine == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  case_watch_drain();
+  case_stats_check_flush();
+
+  if (case_ignore_cmd(cmd) == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  proto = case_get_protocol();
+
+  if (strncasecmp(cmd->argv[2], "HELP", 5) == 0) {
+    /* Ignore SITE COPY HELP requests */
+    return PR_DECLINED(cmd);
+  }
+
+  /* We know the protocol here will always be "ftp" or "ftps", right? And that
+   * we are only handling SITE COPY requests here.
+   */
+
+  if (cmd->argc != 4) {
+    /* Malformed SITE COPY cmd_rec */
+    (void) case_log("malformed SITE COPY request, ignoring");
+    return PR_DECLINED(cmd);
+  }
+
+  src_path = cmd->argv[2];
+  dst_path = cmd->argv[3];
+
+  pr_trace_msg(trace_channel, 9,
+    "checking client-sent source path '%s', destination path '%s'", src_path,
+    dst_path);
+
+  res = case_have_file(cmd->tmp_pool, src_path, &matched_path, &st);
+  if (res < 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  if (res == TRUE &&
+      matched_path != NULL) {
+    /* Replace the source path */
+    src_path = case_pstrdup(cmd->tmp_pool, matched_path);
+    modified_arg = TRUE;
+
+  } else {
+    pr_trace_msg(trace_channel, 9,
+      "no case-insensitive matches found for path '%s'", src_path);
+  }
+
+  if (res == TRUE) {
+    case_add_notes(cmd, CASE_NOTES_SRC_PATH, src_path, &st);
+  }
+
+  matched_path = NULL;
+  res = case_have_file(cmd->tmp_pool, dst_path, &matched_path, &st);
+  if (res == TRUE) {
+    if (matched_path != NULL) {
+      /* Replace the destination path */
+      dst_path = case_pstrdup(cmd->tmp_pool, matched_path);
+      modified_arg = TRUE;
+    }
+
+    case_add_notes(cmd, CASE_NOTES_DST_PATH, dst_path, &st);
+
+  } else {
+    pr_trace_msg(trace_channel, 9,
+      "no case-insensitive matches found for path '%s'", dst_path);
+  }
+
+  /* Overwrite the client-given paths. */
+  if (modified_arg == TRUE) {
+    case_replace_copy_paths(cmd, proto, src_path, dst_path);
+  }
+
+  return PR_DECLINED(cmd);
+}
+
+static modret_t *case_handle_cmd(cmd_rec *cmd) {
+  const char *matched_path = NULL;
+  char *path = NULL;
+  int flags, path_index = -1, proto, res;
+  struct stat st;
+
+  if (case_engine == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  case_watch_drain();
+  case_stats_check_flush();
+
+  if (case_ignore_cmd(cmd) == FALSE) {
+    return PR_DECLINED(cmd);
+  }
+
+  proto = case_get_protocol();
+
+  flags = case_cmd_get_flags(cmd);
+
+  if (proto == CASE_PROTO_SFTP) {
+    path = case_pstrdup(cmd->tmp_pool, cmd->arg);
+
+  } else {
+    /* Special handling of LIST/NLST/STAT, given that they may have options
+     * in the command.
+     */
+    if (flags & CASE_CMD_FL_FTP_OPTS) {
+      path = case_get_opts_path(cmd, &path_index);
+
+      /* LIST, NLST, and STAT can send no path arguments.  If that's the
+       * case, we're done.
+       */
+      if (path == NULL) {
+        return PR_DECLINED(cmd);
+      }
+
+      /* Make sure we operate on a duplicate of the extracted path. */
+      path = case_pstrdup(cmd->tmp_pool, path);
+
+    } else if (flags & CASE_CMD_FL_FTP_SITE) {
+      register unsigned int i;
+
+      if (strncmp(cmd->argv[1], "COPY", 5) == 0) {
+        return case_pre_copy(cmd);
+      }
+
+      if (strncmp(cmd->argv[1], "CHGRP", 6) == 0 ||
+          strncmp(cmd->argv[1], "CHMOD", 6) == 0) {
+
+        if (cmd->argc < 4) {
+          pr_trace_msg(trace_channel, 3,
+            "ignoring SITE %s: not enough parameters (%d)",
+            (char *) cmd->argv[1], cmd->argc - 2);
+          return PR_DECLINED(cmd);
+        }
+
+        path = "";
+
+        /* Skip over "SITE, "CHMOD" (or "CHGRP"), and the mode (or group). */
+        for (i = 3; i < cmd->argc; i++) {
+          path = case_pstrcat(cmd->tmp_pool, path, *path ? " " : "",
+            pr_fs_decode_path(cmd->tmp_pool, cmd->argv[i]), NULL);
+        }
+
+      } else if (strncmp(cmd->argv[1], "CPFR", 5) == 0 ||
+                 strncmp(cmd->argv[1], "CPTO", 5) == 0) {
+
+        if (cmd->argc < 3) {
+          pr_trace_msg(trace_channel, 3,
+            "ignoring SITE %s: not enough parameters (%d)",
+            (char *) cmd->argv[1], cmd->argc - 2);
+          return PR_DECLINED(cmd);
+        }
+
+        path = "";
+
+        /* Skip over "SITE, and "CPFR" (or "CPTO"). */
+        for (i = 2; i < cmd->argc; i++) {
+          path = case_pstrcat(cmd->tmp_pool, path, *path ? " " : "",
+            pr_fs_decode_path(cmd->tmp_pool, cmd->argv[i]), NULL);
+        }
+
+      } else {
+        (void) case_log(
+          "unsupported SITE %s command, ignoring", (char *) cmd->argv[1]);
+        return PR_DECLINED(cmd);
+      }
+
+    } else {
+      path = case_pstrdup(cmd->tmp_pool, cmd->arg);
+    }
+  }
+
+  pr_trace_msg(trace_channel, 9, "checking client-sent path '%s'", path);
+  res = case_have_file(cmd->tmp_pool, path, &matched_path, &st);
+  if (res < 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  if (res == FALSE) {
+    /* No match found. */
+    pr_trace_msg(trace_channel, 9,
+      "no case-insensitive matches found for path '%s'", path);
+    return PR_DECLINED(cmd);
+  }
+
+  /* A new file or directory is named per the CaseUploadPolicy; an existing
+   * one, in whatever case, keeps its name.  Note that a path resolved from
+   * the shared cache comes without its metadata.
+   */
+  if ((flags & CASE_CMD_FL_UPLOAD) &&
+      case_upload_policy != CASE_UPLOAD_POLICY_PRESERVE &&
+      st.st_mode == 0 &&
+      (matched_path == NULL ||
+       pr_fsio_stat(matched_path, &st) < 0)) {
+    const char *canon_path;
+
+    canon_path = case_canonical_path(cmd->tmp_pool,
+      matched_path != NULL ? matched_path : path);
+    if (canon_path != NULL) {
+      (void) case_log("creating '%s' as '%s', per CaseUploadPolicy", path,
+        canon_path);
+      matched_path = canon_path;
+    }
+  }
+
+  /* We found a match for the given file. */
+  case_add_notes(cmd, CASE_NOTES_PATH,
+    matched_path != NULL ? matched_path : path, &st);
+
+  if (matched_path == NULL) {
+    /* Exact match found; nothing more to do. */
+    return PR_DECLINED(cmd);
+  }
+
+  /* Overwrite the client-given path. */
+  pr_trace_msg(trace_channel, 9, "replacing path '%s' with '%s'",
+    path, matched_path);
+
+  case_replace_path(cmd, proto, matched_path, path_index);
+  return PR_DECLINED(cmd);
+}
+
+MODRET case_pre_cmd(cmd_rec *cmd) {
+  struct timespec start;
+  modret_t *mr;
+
+  /* With CaseFSIO, the calls made while looking the command's path up are
+   * not to be resolved themselves.
+   */
+  case_fs_resolving = TRUE;
+
+  if (case_timing_engine == FALSE) {
+    mr = case_handle_cmd(cmd);
+
+  } else {
+    case_timing_start(&start);
+    mr = case_handle_cmd(cmd);
+    case_timing_stop(cmd, &start);
+  }
+
+  case_fs_resolving = FALSE;
+  return mr;
+}
+
+/* For commands which change directories, the cached indexes of those
+ * directories are updated afterwards, rather than discarded.
+ */
+MODRET case_pre_modify_cmd(cmd_rec *cmd) {
+  modret_t *mr;
+  array_header *ops;
+  const char *path;
+
+  mr = case_pre_cmd(cmd);
+
+  if (case_cache_engine == FALSE ||
+      cmd->notes == NULL) {
+    return mr;
+  }
+
+  /* Prefer the path as resolved, if the command was looked at. */
+  path = pr_table_get(cmd->notes, CASE_NOTE_PATH, NULL);
+  if (path == NULL) {
+    path = cmd->arg;
+  }
+
+  if (pr_cmd_cmp(cmd, PR_CMD_RNFR_ID) == 0) {
+    sstrncpy(case_rnfr_path, path, sizeof(case_rnfr_path));
+    return mr;
+  }
+
+  ops = case_make_array(cmd->pool, 2, sizeof(struct case_cache_op));
+
+  if (pr_cmd_cmp(cmd, PR_CMD_RNTO_ID) == 0 &&
+      *case_rnfr_path != '\0') {
+    case_cache_add_op(cmd->pool, ops, case_rnfr_path);
+  }
+
+  case_cache_add_op(cmd->pool, ops, path);
+
+  if (ops->nelts > 0) {
+    (void) case_table_add(cmd->notes, "mod_case.cache-ops", ops,
+      sizeof(array_header));
+  }
+
+  return mr;
+}
+
+MODRET case_post_modify_cmd(cmd_rec *cmd) {
+  register unsigned int i;
+  array_header *ops;
+  struct case_cache_op *elts;
+
+  if (case_cache_engine == FALSE ||
+      cmd->notes == NULL) {
+    return PR_DECLINED(cmd);
+  }
+
+  if (pr_cmd_cmp(cmd, PR_CMD_RNTO_ID) == 0) {
+    *case_rnfr_path = '\0';
   }
 
-  c = find_config(CURRENT_CONF, CONF_PARAM, "CaseIgnore", FALSE);
-  if (c == NULL) {
+  ops = (array_header *) pr_table_get(cmd->notes, "mod_case.cache-ops", NULL);
+  if (ops == NULL) {
     return PR_DECLINED(cmd);
   }
 
-  if (*((unsigned int *) c->argv[0]) != TRUE) {
-    return PR_DECLINED(cmd);
+  elts = ops->elts;
+  for (i = 0; i < ops->nelts; i++) {
+    case_cache_apply_op(&(elts[i]));
   }
 
-  if (c->argv[1] != NULL &&
-      case_expr_eval_cmds(cmd, *((array_header **) c->argv[1])) == 0) {
+  return PR_DECLINED(cmd);
+}
+
+/* The SYMLINK/LINK SFTP requests are different enough to warrant their own
+ * command handler.
+ */
+static modret_t *case_handle_link(cmd_rec *cmd) {
+  const char *matched_path = NULL;
+  char *arg = NULL, *src_path, *dst_path, *ptr;
+  int modified_arg = FALSE, proto, res;
+  struct stat st;
+
+  if (case_engine == FALSE) {
     return PR_DECLINED(cmd);
   }
 
-  proto = pr_session_get_protocol(0);
+  case_watch_drain();
+  case_stats_check_flush();
 
-  if (strncasecmp(cmd->argv[2], "HELP", 5) == 0) {
-    /* Ignore SITE COPY HELP requests */
+  if (case_ignore_cmd(cmd) == FALSE) {
     return PR_DECLINED(cmd);
   }
 
-  /* We know the protocol here will always be "ftp" or "ftps", right? And that
-   * we are only handling SITE COPY requests here.
+  proto = case_get_protocol();
+
+  /* We know the protocol here will always be "sftp", right? And that we
+   * are only handling SFTP SYMLINK and LINK requests here.
    */
 
-  if (cmd->argc != 4) {
-    /* Malformed SITE COPY cmd_rec */
-    (void) pr_log_writefile(case_logfd, MOD_CASE_VERSION,
-      "malformed SITE COPY request, ignoring");
+  arg = case_pstrdup(cmd->tmp_pool, cmd->arg);
+  ptr = strchr(arg, '\t');
+  if (ptr == NULL) {
+    /* Malformed SFTP SYMLINK/LINK cmd_rec. */
+    (void) case_log(
+      "malformed SFTP %s request, ignoring", (char *) cmd->argv[0]);
     return PR_DECLINED(cmd);
   }
 
-  src_path = cmd->argv[2];
-  dst_path = cmd->argv[3];
+  *ptr = '\0';
+
+  src_path = arg;
+  dst_path = ptr + 1;
 
   pr_trace_msg(trace_channel, 9,
     "checking client-sent source path '%s', destination path '%s'", src_path,
     dst_path);
 
-  res = case_have_file(cmd->tmp_pool, src_path, &matched_path);
-  if (res < 0) {
-    return PR_DECLINED(cmd);
-  }
+  res = case_have_file(cmd->tmp_pool, src_path, &matched_path, &st);
+  if (res == TRUE) {
+    if (matched_path != NULL) {
+      /* Replace the source path */
+      src_path = case_pstrdup(cmd->tmp_pool, matched_path);
+      modified_arg = TRUE;
+    }
 
-  if (res == TRUE &&
-      matched_path != NULL) {
-    /* Replace the source path */
-    src_path = pstrdup(cmd->tmp_pool, matched_path);
-    modified_arg = TRUE;
+    case_add_notes(cmd, CASE_NOTES_SRC_PATH, src_path, &st);
 
   } else {
     pr_trace_msg(trace_channel, 9,
@@ -602,14 +5667,16 @@ MODRET case_pre_copy(cmd_rec *cmd) {
   }
 
   matched_path = NULL;
-  res = case_have_file(cmd->tmp_pool, dst_path, &matched_path);
+  res = case_have_file(cmd->tmp_pool, dst_path, &matched_path, &st);
   if (res == TRUE) {
     if (matched_path != NULL) {
       /* Replace the destination path */
-      dst_path = pstrdup(cmd->tmp_pool, matched_path);
+      dst_path = case_pstrdup(cmd->tmp_pool, matched_path);
       modified_arg = TRUE;
     }
 
+    case_add_notes(cmd, CASE_NOTES_DST_PATH, dst_path, &st);
+
   } else {
     pr_trace_msg(trace_channel, 9,
       "no case-insensitive matches found for path '%s'", dst_path);
@@ -617,233 +5684,481 @@ MODRET case_pre_copy(cmd_rec *cmd) {
 
   /* Overwrite the client-given paths. */
   if (modified_arg == TRUE) {
-    case_replace_copy_paths(cmd, proto, src_path, dst_path);
+    pr_trace_msg(trace_channel, 9, "replacing %s paths with '%s' and '%s'",
+      (char *) cmd->argv[0], src_path, dst_path);
+    case_replace_link_paths(cmd, proto, src_path, dst_path);
   }
 
   return PR_DECLINED(cmd);
 }
 
-MODRET case_pre_cmd(cmd_rec *cmd) {
-  config_rec *c;
-  const char *proto = NULL, *matched_path = NULL;
-  char *path = NULL;
-  int path_index = -1, res;
+MODRET case_pre_link(cmd_rec *cmd) {
+  struct timespec start;
+  modret_t *mr;
 
-  if (case_engine == FALSE) {
-    return PR_DECLINED(cmd);
+  case_fs_resolving = TRUE;
+
+  if (case_timing_engine == FALSE) {
+    mr = case_handle_link(cmd);
+
+  } else {
+    case_timing_start(&start);
+    mr = case_handle_link(cmd);
+    case_timing_stop(cmd, &start);
   }
 
-  c = find_config(CURRENT_CONF, CONF_PARAM, "CaseIgnore", FALSE);
-  if (c == NULL) {
-    return PR_DECLINED(cmd);
+  case_fs_resolving = FALSE;
+  return mr;
+}
+
+/* CaseFSIOCounts: the counts are reset before any other PRE_CMD handler
+ * runs, and logged once the command is done.
+ */
+MODRET case_pre_any(cmd_rec *cmd) {
+  if (case_fsio_counting == TRUE) {
+    memset(&case_fsio_counts, 0, sizeof(case_fsio_counts));
   }
 
-  if (*((unsigned int *) c->argv[0]) != TRUE) {
-    return PR_DECLINED(cmd);
+  /* With CaseFSIO, this is done here, as well as by the handlers for the
+   * commands whose paths are rewritten, since the paths of any command may
+   * be resolved.
+   */
+  if (case_fs_engine == TRUE) {
+    case_watch_drain();
+    case_stats_check_flush();
   }
 
-  if (c->argv[1] != NULL &&
-      case_expr_eval_cmds(cmd, *((array_header **) c->argv[1])) == 0) {
+  return PR_DECLINED(cmd);
+}
+
+MODRET case_log_any(cmd_rec *cmd) {
+  if (case_fsio_counting == FALSE) {
     return PR_DECLINED(cmd);
   }
 
-  proto = pr_session_get_protocol(0);
+  (void) case_log("fsio: %s%s%s: opendir %lu, readdir %lu, open %lu, stat %lu",
+    (char *) cmd->argv[0],
+    pr_cmd_cmp(cmd, PR_CMD_SITE_ID) == 0 && cmd->argc > 1 ? " " : "",
+    pr_cmd_cmp(cmd, PR_CMD_SITE_ID) == 0 && cmd->argc > 1 ?
+      (char *) cmd->argv[1] : "",
+    case_fsio_counts.nopendir, case_fsio_counts.nreaddir,
+    case_fsio_counts.nopen, case_fsio_counts.nstat);
 
-  if (strcmp(proto, "sftp") == 0) {
-    path = pstrdup(cmd->tmp_pool, cmd->arg);
+  return PR_DECLINED(cmd);
+}
 
-  } else {
-    /* Special handling of LIST/NLST/STAT, given that they may have options
-     * in the command.
+/* Controls handlers
+ */
+
+#if defined(PR_USE_CTRLS)
+static pool *case_ctrls_pool = NULL;
+
+static int case_handle_case(pr_ctrls_t *, int, char **);
+
+static ctrls_acttab_t case_acttab[] = {
+  { "case",	"report mod_case statistics, or flush its caches", NULL,
+    case_handle_case },
+
+  { NULL, NULL, NULL, NULL }
+};
+
+static void case_handle_case_stats(pr_ctrls_t *ctrl) {
+  register unsigned int i;
+  unsigned int seq;
+  unsigned long lookups, probes, largest_nentries = 0;
+  char largest_path[CASE_STATS_PATH_MAX];
+
+  lookups = case_stats->lookups;
+  probes = case_stats->probes;
+
+  pr_ctrls_add_response(ctrl, "case: statistics since %s",
+    pr_strtime(case_stats->since));
+  pr_ctrls_add_response(ctrl, "  lookups: %lu", lookups);
+  pr_ctrls_add_response(ctrl, "  shared cache hits: %lu",
+    case_stats->shared_cache_hits);
+  pr_ctrls_add_response(ctrl, "  cache hits: %lu", case_stats->cache_hits);
+  pr_ctrls_add_response(ctrl, "  negative cache hits: %lu",
+    case_stats->negative_cache_hits);
+  pr_ctrls_add_response(ctrl, "  index hits: %lu", case_stats->index_hits);
+  pr_ctrls_add_response(ctrl, "  upload policy name hits: %lu",
+    case_stats->canonical_hits);
+  pr_ctrls_add_response(ctrl, "  probes: %lu, hits: %lu (%lu%%)", probes,
+    case_stats->probe_hits,
+    probes > 0 ? (case_stats->probe_hits * 100) / probes : 0);
+  pr_ctrls_add_response(ctrl, "  casefolded directory lookups: %lu",
+    case_stats->casefold_hits);
+  pr_ctrls_add_response(ctrl, "  directory scans: %lu (%lu entries)",
+    case_stats->scans, case_stats->entries_scanned);
+  pr_ctrls_add_response(ctrl, "  scan matches: %lu, misses: %lu",
+    case_stats->matches, case_stats->misses);
+  pr_ctrls_add_response(ctrl, "  lookup time: %lu usecs average, %lu max",
+    lookups > 0 ? case_stats->lookup_usecs / lookups : 0,
+    case_stats->max_lookup_usecs);
+
+  largest_path[0] = '\0';
+  seq = case_stats->largest_seq;
+  if ((seq & 1) == 0) {
+    __sync_synchronize();
+    largest_nentries = case_stats->largest_nentries;
+    sstrncpy(largest_path, case_stats->largest_path, sizeof(largest_path));
+    __sync_synchronize();
+
+    if (case_stats->largest_seq != seq) {
+      largest_path[0] = '\0';
+    }
+  }
+
+  if (largest_path[0] != '\0') {
+    pr_ctrls_add_response(ctrl, "  largest scan: %lu entries in '%s'",
+      largest_nentries, largest_path);
+  }
+
+  for (i = 0; i < case_timing_ncmds; i++) {
+    struct case_timing *timing;
+    unsigned long count, p50, p99, max_usecs;
+    char max_dir[CASE_STATS_PATH_MAX];
+
+    timing = &(case_stats->timings[i]);
+    p50 = case_timing_percentile(timing, 50, &count);
+    if (count == 0) {
+      continue;
+    }
+
+    p99 = case_timing_percentile(timing, 99, &count);
+
+    max_dir[0] = '\0';
+    seq = timing->max_seq;
+    __sync_synchronize();
+    max_usecs = timing->max_usecs;
+    sstrncpy(max_dir, timing->max_dir, sizeof(max_dir));
+    __sync_synchronize();
+
+    if ((seq & 1) ||
+        timing->max_seq != seq) {
+      max_dir[0] = '\0';
+    }
+
+    pr_ctrls_add_response(ctrl, "  %s: %lu %s, p50 <= %lu usecs, "
+      "p99 <= %lu usecs, max %lu usecs%s%s%s", case_timing_cmds[i], count,
+      count == 1 ? "call" : "calls", p50, p99, max_usecs,
+      *max_dir ? " (in directory '" : "", max_dir, *max_dir ? "')" : "");
+  }
+}
+
+static int case_handle_case(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
+  if (!pr_ctrls_check_acl(ctrl, case_acttab, "case")) {
+    pr_ctrls_add_response(ctrl, "access denied");
+    return -1;
+  }
+
+  if (reqargc == 0 ||
+      reqargv == NULL) {
+    pr_ctrls_add_response(ctrl, "case: missing required parameters");
+    return -1;
+  }
+
+  if (strcmp(reqargv[0], "stats") == 0) {
+    case_handle_case_stats(ctrl);
+
+  } else if (strcmp(reqargv[0], "flush") == 0) {
+    /* The shared cache can be emptied here; the sessions' own caches are
+     * dropped by each session, when it next handles a command.
      */
-    if (pr_cmd_cmp(cmd, PR_CMD_LIST_ID) == 0 ||
-        pr_cmd_cmp(cmd, PR_CMD_NLST_ID) == 0 ||
-        pr_cmd_cmp(cmd, PR_CMD_STAT_ID) == 0) {
-      path = case_get_opts_path(cmd, &path_index);
+    case_shm_flush();
+    (void) __sync_fetch_and_add(&(case_stats->cache_gen), 1);
 
-      /* LIST, NLST, and STAT can send no path arguments.  If that's the
-       * case, we're done.
-       */
-      if (path == NULL) {
-        return PR_DECLINED(cmd);
-      }
+    pr_ctrls_add_response(ctrl, "case: caches flushed");
 
-      /* Make sure we operate on a duplicate of the extracted path. */
-      path = pstrdup(cmd->tmp_pool, path);
+  } else if (strcmp(reqargv[0], "reset") == 0) {
+    case_stats_reset();
+    pr_ctrls_add_response(ctrl, "case: statistics reset");
 
-    } else if (pr_cmd_cmp(cmd, PR_CMD_SITE_ID) == 0) {
-      register unsigned int i;
+  } else {
+    pr_ctrls_add_response(ctrl, "case: unsupported parameter: '%s'",
+      reqargv[0]);
+    return -1;
+  }
 
-      if (strncmp(cmd->argv[1], "COPY", 5) == 0) {
-        return case_pre_copy(cmd);
-      }
+  return 0;
+}
+#endif /* PR_USE_CTRLS */
 
-      if (strncmp(cmd->argv[1], "CHGRP", 6) == 0 ||
-          strncmp(cmd->argv[1], "CHMOD", 6) == 0) {
+/* Configuration handlers
+ */
 
-        if (cmd->argc < 4) {
-          pr_trace_msg(trace_channel, 3,
-            "ignoring SITE %s: not enough parameters (%d)",
-            (char *) cmd->argv[1], cmd->argc - 2);
-          return PR_DECLINED(cmd);
-        }
+/* usage: CaseCache on|off [max-entries [max-bytes]] */
+MODRET set_casecache(cmd_rec *cmd) {
+  int engine;
+  unsigned int max_entries = CASE_CACHE_DEFAULT_MAX_ENTRIES;
+  size_t max_bytes = CASE_CACHE_DEFAULT_MAX_BYTES;
+  config_rec *c;
 
-        path = "";
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
 
-        /* Skip over "SITE, "CHMOD" (or "CHGRP"), and the mode (or group). */
-        for (i = 3; i < cmd->argc; i++) {
-          path = pstrcat(cmd->tmp_pool, path, *path ? " " : "",
-            pr_fs_decode_path(cmd->tmp_pool, cmd->argv[i]), NULL);
-        }
+  if (cmd->argc < 2 ||
+      cmd->argc > 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
 
-      } else if (strncmp(cmd->argv[1], "CPFR", 5) == 0 ||
-                 strncmp(cmd->argv[1], "CPTO", 5) == 0) {
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
 
-        if (cmd->argc < 3) {
-          pr_trace_msg(trace_channel, 3,
-            "ignoring SITE %s: not enough parameters (%d)",
-            (char *) cmd->argv[1], cmd->argc - 2);
-          return PR_DECLINED(cmd);
-        }
+  if (cmd->argc >= 3) {
+    char *ptr = NULL;
+    long num;
 
-        path = "";
+    num = strtol(cmd->argv[2], &ptr, 10);
+    if ((ptr != NULL && *ptr) ||
+        num < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid max entries: ",
+        (char *) cmd->argv[2], NULL));
+    }
 
-        /* Skip over "SITE, and "CPFR" (or "CPTO"). */
-        for (i = 2; i < cmd->argc; i++) {
-          path = pstrcat(cmd->tmp_pool, path, *path ? " " : "",
-            pr_fs_decode_path(cmd->tmp_pool, cmd->argv[i]), NULL);
-        }
+    max_entries = (unsigned int) num;
+  }
 
-      } else {
-        (void) pr_log_writefile(case_logfd, MOD_CASE_VERSION,
-          "unsupported SITE %s command, ignoring", (char *) cmd->argv[1]);
-        return PR_DECLINED(cmd);
-      }
+  if (cmd->argc == 4) {
+    char *ptr = NULL;
+    long num;
 
-    } else {
-      path = pstrdup(cmd->tmp_pool, cmd->arg);
+    num = strtol(cmd->argv[3], &ptr, 10);
+    if ((ptr != NULL && *ptr) ||
+        num < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid max bytes: ",
+        (char *) cmd->argv[3], NULL));
     }
+
+    max_bytes = (size_t) num;
   }
 
-  pr_trace_msg(trace_channel, 9, "checking client-sent path '%s'", path);
-  res = case_have_file(cmd->tmp_pool, path, &matched_path);
-  if (res < 0) {
-    return PR_DECLINED(cmd);
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+  c->argv[1] = pcalloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = max_entries;
+  c->argv[2] = pcalloc(c->pool, sizeof(size_t));
+  *((size_t *) c->argv[2]) = max_bytes;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: CaseCacheWatch on|off [max-watches] */
+MODRET set_casecachewatch(cmd_rec *cmd) {
+  int engine;
+  unsigned int max_watches = CASE_WATCH_DEFAULT_MAX_WATCHES;
+  config_rec *c;
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
   }
 
-  if (res == FALSE) {
-    /* No match found. */
-    pr_trace_msg(trace_channel, 9,
-      "no case-insensitive matches found for path '%s'", path);
-    return PR_DECLINED(cmd);
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
   }
 
-  /* We found a match for the given file. */
+  if (cmd->argc == 3) {
+    char *ptr = NULL;
+    long num;
 
-  if (matched_path == NULL) {
-    /* Exact match found; nothing more to do. */
-    return PR_DECLINED(cmd);
+    num = strtol(cmd->argv[2], &ptr, 10);
+    if ((ptr != NULL && *ptr) ||
+        num < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid max watches: ",
+        (char *) cmd->argv[2], NULL));
+    }
+
+    max_watches = (unsigned int) num;
   }
 
-  /* Overwrite the client-given path. */
-  pr_trace_msg(trace_channel, 9, "replacing path '%s' with '%s'",
-    path, matched_path);
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+  c->argv[1] = pcalloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = max_watches;
 
-  case_replace_path(cmd, proto, matched_path, path_index);
-  return PR_DECLINED(cmd);
+  return PR_HANDLED(cmd);
 }
 
-/* The SYMLINK/LINK SFTP requests are different enough to warrant their own
- * command handler.
- */
-MODRET case_pre_link(cmd_rec *cmd) {
+/* usage: CaseCasefold on|off */
+MODRET set_casecasefold(cmd_rec *cmd) {
+  int engine;
   config_rec *c;
-  const char *proto = NULL, *matched_path = NULL;
-  char *arg = NULL, *src_path, *dst_path, *ptr;
-  int modified_arg = FALSE, res;
 
-  if (case_engine == FALSE) {
-    return PR_DECLINED(cmd);
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
   }
 
-  c = find_config(CURRENT_CONF, CONF_PARAM, "CaseIgnore", FALSE);
-  if (c == NULL) {
-    return PR_DECLINED(cmd);
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: CaseControlsACLs actions|all allow|deny user|group list */
+MODRET set_casecontrolsacls(cmd_rec *cmd) {
+#if defined(PR_USE_CTRLS)
+  char *bad_action = NULL, **actions = NULL;
+
+  CHECK_ARGS(cmd, 4);
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  actions = ctrls_parse_acl(cmd->tmp_pool, cmd->argv[1]);
+
+  if (strcmp(cmd->argv[2], "allow") != 0 &&
+      strcmp(cmd->argv[2], "deny") != 0) {
+    CONF_ERROR(cmd, "second parameter must be 'allow' or 'deny'");
   }
 
-  if (*((unsigned int *) c->argv[0]) != TRUE) {
-    return PR_DECLINED(cmd);
+  if (strcmp(cmd->argv[3], "user") != 0 &&
+      strcmp(cmd->argv[3], "group") != 0) {
+    CONF_ERROR(cmd, "third parameter must be 'user' or 'group'");
   }
 
-  if (c->argv[1] != NULL &&
-      case_expr_eval_cmds(cmd, *((array_header **) c->argv[1])) == 0) {
-    return PR_DECLINED(cmd);
+  bad_action = pr_ctrls_set_module_acls(case_acttab, case_ctrls_pool, actions,
+    cmd->argv[2], cmd->argv[3], cmd->argv[4]);
+  if (bad_action != NULL) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, ": unknown action: '",
+      bad_action, "'", NULL));
+  }
+
+  return PR_HANDLED(cmd);
+#else
+  CONF_ERROR(cmd, "requires Controls support (--enable-ctrls)");
+#endif /* PR_USE_CTRLS */
+}
+
+/* usage: CaseNegativeCache on|off [max-entries [ttl]] */
+MODRET set_casenegativecache(cmd_rec *cmd) {
+  int engine;
+  unsigned int max_entries = CASE_NEG_DEFAULT_MAX_ENTRIES;
+  unsigned int ttl = CASE_NEG_DEFAULT_TTL;
+  config_rec *c;
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  if (cmd->argc >= 3) {
+    char *ptr = NULL;
+    long num;
+
+    num = strtol(cmd->argv[2], &ptr, 10);
+    if ((ptr != NULL && *ptr) ||
+        num < CASE_NEG_NWAYS) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid max entries: ",
+        (char *) cmd->argv[2], NULL));
+    }
+
+    max_entries = (unsigned int) num;
+  }
+
+  if (cmd->argc == 4) {
+    char *ptr = NULL;
+    long num;
+
+    num = strtol(cmd->argv[3], &ptr, 10);
+    if ((ptr != NULL && *ptr) ||
+        num < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid TTL: ",
+        (char *) cmd->argv[3], NULL));
+    }
+
+    ttl = (unsigned int) num;
   }
 
-  proto = pr_session_get_protocol(0);
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+  c->argv[1] = pcalloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = max_entries;
+  c->argv[2] = pcalloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[2]) = ttl;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: CaseIndex on|off [[min-entries] path|"sidecar"] */
+MODRET set_caseindex(cmd_rec *cmd) {
+  int engine;
+  unsigned int min_entries = CASE_INDEX_DEFAULT_MIN_ENTRIES;
+  char *path = NULL;
+  config_rec *c;
 
-  /* We know the protocol here will always be "sftp", right? And that we
-   * are only handling SFTP SYMLINK and LINK requests here.
-   */
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
 
-  arg = pstrdup(cmd->tmp_pool, cmd->arg);
-  ptr = strchr(arg, '\t');
-  if (ptr == NULL) {
-    /* Malformed SFTP SYMLINK/LINK cmd_rec. */
-    (void) pr_log_writefile(case_logfd, MOD_CASE_VERSION,
-      "malformed SFTP %s request, ignoring", (char *) cmd->argv[0]);
-    return PR_DECLINED(cmd);
+  if (cmd->argc < 2 ||
+      cmd->argc > 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
   }
 
-  *ptr = '\0';
-
-  src_path = arg;
-  dst_path = ptr + 1;
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
 
-  pr_trace_msg(trace_channel, 9,
-    "checking client-sent source path '%s', destination path '%s'", src_path,
-    dst_path);
+  if (cmd->argc == 4) {
+    char *ptr = NULL;
+    long num;
 
-  res = case_have_file(cmd->tmp_pool, src_path, &matched_path);
-  if (res == TRUE) {
-    if (matched_path != NULL) {
-      /* Replace the source path */
-      src_path = pstrdup(cmd->tmp_pool, matched_path);
-      modified_arg = TRUE;
+    num = strtol(cmd->argv[2], &ptr, 10);
+    if ((ptr != NULL && *ptr) ||
+        num < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid min entries: ",
+        (char *) cmd->argv[2], NULL));
     }
 
-  } else {
-    pr_trace_msg(trace_channel, 9,
-      "no case-insensitive matches found for path '%s'", src_path);
+    min_entries = (unsigned int) num;
   }
 
-  matched_path = NULL;
-  res = case_have_file(cmd->tmp_pool, dst_path, &matched_path);
-  if (res == TRUE) {
-    if (matched_path != NULL) {
-      /* Replace the destination path */
-      dst_path = pstrdup(cmd->tmp_pool, matched_path);
-      modified_arg = TRUE;
+  /* Where the indexes are kept must be configured; the sidecar
+   * subdirectories, which appear in every indexed directory, only when asked
+   * for.
+   */
+  if (cmd->argc >= 3) {
+    path = cmd->argv[cmd->argc-1];
+    if (strcasecmp(path, "sidecar") == 0) {
+      path = NULL;
+
+    } else if (*path != '/') {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "path '", path,
+        "' is not an absolute path", NULL));
     }
 
-  } else {
-    pr_trace_msg(trace_channel, 9,
-      "no case-insensitive matches found for path '%s'", dst_path);
+  } else if (engine == TRUE) {
+    CONF_ERROR(cmd, "missing index path, or \"sidecar\"");
   }
 
-  /* Overwrite the client-given paths. */
-  if (modified_arg == TRUE) {
-    pr_trace_msg(trace_channel, 9, "replacing %s paths with '%s' and '%s'",
-      (char *) cmd->argv[0], src_path, dst_path);
-    case_replace_link_paths(cmd, proto, src_path, dst_path);
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+  c->argv[1] = pcalloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = min_entries;
+  if (path != NULL) {
+    c->argv[2] = pstrdup(c->pool, path);
   }
 
-  return PR_DECLINED(cmd);
+  return PR_HANDLED(cmd);
 }
 
-/* Configuration handlers
- */
-
 /* usage: CaseEngine on|off */
 MODRET set_caseengine(cmd_rec *cmd) {
   int engine;
@@ -864,6 +6179,46 @@ MODRET set_caseengine(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: CaseFSIOCounts on|off */
+MODRET set_casefsiocounts(cmd_rec *cmd) {
+  int engine;
+  config_rec *c;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: CaseFSIO on|off */
+MODRET set_casefsio(cmd_rec *cmd) {
+  int engine;
+  config_rec *c;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+
+  return PR_HANDLED(cmd);
+}
+
 /* usage: CaseIgnore on|off|cmd-list */
 MODRET set_caseignore(cmd_rec *cmd) {
   unsigned int argc;
@@ -891,18 +6246,20 @@ MODRET set_caseignore(cmd_rec *cmd) {
   argc = cmd->argc-1;
   argv = (char **) cmd->argv;
 
-  c->argv[1] = pcalloc(c->pool, sizeof(array_header *));
-  *((array_header **) c->argv[1]) = pr_expr_create(c->pool, &argc, argv);
+  c->argv[1] = case_cmd_set_create(c->pool,
+    pr_expr_create(c->pool, &argc, argv));
 
   return PR_HANDLED(cmd);
 }
 
-/* usage: CaseLog path|"none" */
+/* usage: CaseLog path|"syslog"|"none" */
 MODRET set_caselog(cmd_rec *cmd) {
   CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
   CHECK_ARGS(cmd, 1);
 
-  if (pr_fs_valid_path(cmd->argv[1]) < 0)
+  if (strcasecmp(cmd->argv[1], "none") != 0 &&
+      strcasecmp(cmd->argv[1], "syslog") != 0 &&
+      pr_fs_valid_path(cmd->argv[1]) < 0)
     CONF_ERROR(cmd, "must be an absolute path");
 
   add_config_param_str(cmd->argv[0], 1, cmd->argv[1]);
@@ -910,9 +6267,239 @@ MODRET set_caselog(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: CaseLogBuffer on|off [size [interval]] */
+MODRET set_caselogbuffer(cmd_rec *cmd) {
+  int engine;
+  unsigned int bufsz = CASE_LOG_DEFAULT_BUFFER_SIZE;
+  unsigned int interval = CASE_LOG_DEFAULT_FLUSH_INTERVAL;
+  config_rec *c;
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  if (cmd->argc >= 3) {
+    char *ptr = NULL;
+    long num;
+
+    num = strtol(cmd->argv[2], &ptr, 10);
+    if ((ptr != NULL && *ptr) ||
+        num < CASE_LOG_MIN_BUFFER_SIZE) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid buffer size: ",
+        (char *) cmd->argv[2], NULL));
+    }
+
+    bufsz = (unsigned int) num;
+  }
+
+  if (cmd->argc == 4) {
+    char *ptr = NULL;
+    long num;
+
+    num = strtol(cmd->argv[3], &ptr, 10);
+    if ((ptr != NULL && *ptr) ||
+        num < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid flush interval: ",
+        (char *) cmd->argv[3], NULL));
+    }
+
+    interval = (unsigned int) num;
+  }
+
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+  c->argv[1] = pcalloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = bufsz;
+  c->argv[2] = pcalloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[2]) = interval;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: CaseTiming on|off */
+MODRET set_casetiming(cmd_rec *cmd) {
+  int engine;
+  config_rec *c;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: CaseUploadPolicy lower|upper|preserve */
+MODRET set_caseuploadpolicy(cmd_rec *cmd) {
+  int policy;
+  config_rec *c;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (strcasecmp(cmd->argv[1], "lower") == 0) {
+    policy = CASE_UPLOAD_POLICY_LOWER;
+
+  } else if (strcasecmp(cmd->argv[1], "upper") == 0) {
+    policy = CASE_UPLOAD_POLICY_UPPER;
+
+  } else if (strcasecmp(cmd->argv[1], "preserve") == 0) {
+    policy = CASE_UPLOAD_POLICY_PRESERVE;
+
+  } else {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid policy: ",
+      (char *) cmd->argv[1], NULL));
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = policy;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: CaseProbe on|off */
+MODRET set_caseprobe(cmd_rec *cmd) {
+  int engine;
+  config_rec *c;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: CaseSharedCache entries|off */
+MODRET set_casesharedcache(cmd_rec *cmd) {
+  int engine;
+  unsigned int nentries = 0;
+  config_rec *c;
+
+  CHECK_CONF(cmd, CONF_ROOT);
+  CHECK_ARGS(cmd, 1);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    char *ptr = NULL;
+    long num;
+
+    num = strtol(cmd->argv[1], &ptr, 10);
+    if ((ptr != NULL && *ptr) ||
+        num < CASE_SHM_NWAYS) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid number of entries: ",
+        (char *) cmd->argv[1], NULL));
+    }
+
+    nentries = (unsigned int) num;
+
+  } else if (engine == TRUE) {
+    CONF_ERROR(cmd, "expected number of entries or \"off\"");
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = nentries;
+
+  return PR_HANDLED(cmd);
+}
+
+/* Event listeners
+ */
+
+static void case_exit_ev(const void *event_data, void *user_data) {
+  if (case_timing_engine == TRUE) {
+    case_timing_summary();
+  }
+
+  case_log_flush();
+
+  if (case_log_ndropped > 0) {
+    unsigned long ndropped;
+
+    /* Try once more to note how many messages were dropped. */
+    ndropped = case_log_ndropped;
+    case_log_ndropped = 0;
+    (void) case_log("dropped %lu buffered log messages", ndropped);
+    case_log_flush();
+  }
+
+  if (case_syslogfd >= 0) {
+    pr_closelog(case_syslogfd);
+    case_syslogfd = -1;
+  }
+}
+
+static void case_postparse_ev(const void *event_data, void *user_data) {
+  (void) case_shm_create();
+}
+
+static void case_restart_ev(const void *event_data, void *user_data) {
+  /* The shared cache will be recreated, with the new configuration, once
+   * the configuration has been re-read.
+   */
+  case_shm_destroy();
+}
+
 /* Initialization functions
  */
 
+static int case_init(void) {
+  case_cmd_flags_init();
+  case_stats_create();
+  case_timing_init();
+
+#if defined(PR_USE_CTRLS)
+  {
+    register unsigned int i;
+
+    case_ctrls_pool = make_sub_pool(permanent_pool);
+    pr_pool_tag(case_ctrls_pool, MOD_CASE_VERSION);
+
+    for (i = 0; case_acttab[i].act_action; i++) {
+      case_acttab[i].act_acl = pcalloc(case_ctrls_pool, sizeof(ctrls_acl_t));
+      pr_ctrls_init_acl(case_acttab[i].act_acl);
+
+      if (pr_ctrls_register(&case_module, case_acttab[i].act_action,
+          case_acttab[i].act_desc, case_acttab[i].act_cb) < 0) {
+        pr_log_pri(PR_LOG_INFO, MOD_CASE_VERSION
+          ": error registering '%s' control: %s",
+          case_acttab[i].act_action, strerror(errno));
+      }
+    }
+  }
+#endif /* PR_USE_CTRLS */
+
+  pr_event_register(&case_module, "core.postparse", case_postparse_ev, NULL);
+  pr_event_register(&case_module, "core.restart", case_restart_ev, NULL);
+
+  return 0;
+}
+
 static int case_sess_init(void) {
   config_rec *c;
 
@@ -926,12 +6513,123 @@ static int case_sess_init(void) {
     return 0;
   }
 
+  case_fold_init();
+  case_stats_cache_gen = case_stats->cache_gen;
+
+  pr_event_register(&case_module, "core.exit", case_exit_ev, NULL);
+
+  c = find_config(main_server->conf, CONF_PARAM, "CaseTiming", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    case_timing_engine = TRUE;
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "CaseFSIOCounts", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    case_fsio_counts_init();
+  }
+
+  /* Stacked on the counting FS, if any, so that its counts include the
+   * calls made for resolving paths.
+   */
+  c = find_config(main_server->conf, CONF_PARAM, "CaseFSIO", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    case_fs_init();
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "CaseUploadPolicy", FALSE);
+  if (c != NULL) {
+    case_upload_policy = *((int *) c->argv[0]);
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "CaseProbe", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    case_probe_engine = TRUE;
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "CaseCasefold", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    case_casefold_engine = TRUE;
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "CaseCache", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    case_cache_engine = TRUE;
+    case_cache_max_entries = *((unsigned int *) c->argv[1]);
+    case_cache_max_bytes = *((size_t *) c->argv[2]);
+
+    case_cache_pool = make_sub_pool(session.pool);
+    pr_pool_tag(case_cache_pool, "Case Cache Pool");
+
+    case_cache_tab = pr_table_alloc(case_cache_pool, 0);
+
+    c = find_config(main_server->conf, CONF_PARAM, "CaseCacheWatch", FALSE);
+    if (c != NULL &&
+        *((int *) c->argv[0]) == TRUE) {
+#if defined(CASE_USE_INOTIFY)
+      case_watch_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+      if (case_watch_fd >= 0) {
+        case_watch_engine = TRUE;
+        case_watch_max_watches = *((unsigned int *) c->argv[1]);
+        case_watch_tab = pr_table_alloc(case_cache_pool, 0);
+
+      } else {
+        /* Most likely the per-user limit on inotify instances. */
+        pr_log_debug(DEBUG2, MOD_CASE_VERSION
+          ": unable to watch cached directories, using mtime validation: %s",
+          strerror(errno));
+      }
+#else
+      pr_log_debug(DEBUG2, MOD_CASE_VERSION
+        ": CaseCacheWatch is not supported on this platform, ignoring");
+#endif /* CASE_USE_INOTIFY */
+    }
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "CaseNegativeCache", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    case_neg_engine = TRUE;
+    case_neg_ttl = *((unsigned int *) c->argv[2]);
+
+    /* Round up to a whole number of sets. */
+    case_neg_nentries = *((unsigned int *) c->argv[1]);
+    case_neg_nentries = ((case_neg_nentries + CASE_NEG_NWAYS - 1) /
+      CASE_NEG_NWAYS) * CASE_NEG_NWAYS;
+    case_neg_entries = pcalloc(session.pool,
+      case_neg_nentries * sizeof(struct case_neg_entry));
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "CaseIndex", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    case_index_engine = TRUE;
+    case_index_min_entries = *((unsigned int *) c->argv[1]);
+    case_index_dir = c->argv[2];
+  }
+
   c = find_config(main_server->conf, CONF_PARAM, "CaseLog", FALSE);
   if (c == NULL) {
     return 0;
   }
 
-  if (strncasecmp((char *) c->argv[0], "none", 5) != 0) {
+  if (strncasecmp((char *) c->argv[0], "syslog", 7) == 0) {
+    /* Open the syslog socket now, while it can still be reached, i.e. before
+     * any chroot.
+     */
+    case_syslogfd = pr_openlog("proftpd", LOG_NDELAY|LOG_PID,
+      CASE_LOG_SYSLOG_FACILITY);
+    if (case_syslogfd < 0) {
+      pr_log_pri(PR_LOG_NOTICE, MOD_CASE_VERSION
+        ": error opening syslog for CaseLog: %s", strerror(errno));
+    }
+
+  } else if (strncasecmp((char *) c->argv[0], "none", 5) != 0) {
     int res, xerrno;
 
     pr_signals_block();
@@ -948,6 +6646,39 @@ static int case_sess_init(void) {
     }
   }
 
+  if (case_logfd < 0 &&
+      case_syslogfd < 0) {
+    return 0;
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "CaseLogBuffer", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    unsigned int interval;
+
+    case_log_bufsz = *((unsigned int *) c->argv[1]);
+    case_log_buf = palloc(session.pool, case_log_bufsz);
+
+    /* Nor should the timed flushes wait, e.g. for a reader of a FIFO. */
+    if (case_logfd >= 0) {
+      int flags;
+
+      flags = fcntl(case_logfd, F_GETFL);
+      if (flags < 0 ||
+          fcntl(case_logfd, F_SETFL, flags|O_NONBLOCK) < 0) {
+        pr_log_debug(DEBUG2, MOD_CASE_VERSION
+          ": error making CaseLog non-blocking: %s", strerror(errno));
+      }
+    }
+
+    interval = *((unsigned int *) c->argv[2]);
+    if (pr_timer_add(interval, -1, &case_module, case_log_flush_cb,
+        "CaseLog flush") < 0) {
+      pr_log_debug(DEBUG2, MOD_CASE_VERSION
+        ": error adding CaseLog flush timer: %s", strerror(errno));
+    }
+  }
+
   return 0;
 }
 
@@ -955,33 +6686,71 @@ static int case_sess_init(void) {
  */
 
 static conftable case_conftab[] = {
+  { "CaseCache",	set_casecache,		NULL },
+  { "CaseCacheWatch",	set_casecachewatch,	NULL },
+  { "CaseCasefold",	set_casecasefold,	NULL },
+  { "CaseControlsACLs",	set_casecontrolsacls,	NULL },
   { "CaseEngine",	set_caseengine,		NULL },
+  { "CaseFSIO",		set_casefsio,		NULL },
+  { "CaseFSIOCounts",	set_casefsiocounts,	NULL },
   { "CaseIgnore",	set_caseignore,		NULL },
+  { "CaseIndex",	set_caseindex,		NULL },
   { "CaseLog",		set_caselog,		NULL },
+  { "CaseLogBuffer",	set_caselogbuffer,	NULL },
+  { "CaseNegativeCache",	set_casenegativecache,	NULL },
+  { "CaseProbe",	set_caseprobe,		NULL },
+  { "CaseSharedCache",	set_casesharedcache,	NULL },
+  { "CaseTiming",	set_casetiming,		NULL },
+  { "CaseUploadPolicy",	set_caseuploadpolicy,	NULL },
   { NULL }
 };
 
 static cmdtable case_cmdtab[] = {
-  { PRE_CMD,	C_APPE,	G_NONE,	case_pre_cmd,	TRUE,	FALSE },
+  { PRE_CMD,	C_ANY,	G_NONE,	case_pre_any,	FALSE,	FALSE },
+  { LOG_CMD,	C_ANY,	G_NONE,	case_log_any,	FALSE,	FALSE },
+  { LOG_CMD_ERR,C_ANY,	G_NONE,	case_log_any,	FALSE,	FALSE },
+
+  { PRE_CMD,	C_APPE,	G_NONE,	case_pre_modify_cmd,TRUE,	FALSE },
   { PRE_CMD,	C_CWD,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
-  { PRE_CMD,	C_DELE,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
+  { PRE_CMD,	C_DELE,	G_NONE, case_pre_modify_cmd,TRUE,	FALSE },
   { PRE_CMD,	C_LIST,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
   { PRE_CMD,	C_MDTM,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
-  { PRE_CMD,	C_MKD,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
+  { PRE_CMD,	C_MKD,	G_NONE, case_pre_modify_cmd,TRUE,	FALSE },
   { PRE_CMD,	C_MLSD,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
   { PRE_CMD,	C_MLST,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
   { PRE_CMD,	C_NLST,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
   { PRE_CMD,	C_RETR,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
-  { PRE_CMD,	C_RMD,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
-  { PRE_CMD,	C_RNFR,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
-  { PRE_CMD,	C_RNTO,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
+  { PRE_CMD,	C_RMD,	G_NONE, case_pre_modify_cmd,TRUE,	FALSE },
+  { PRE_CMD,	C_RNFR,	G_NONE, case_pre_modify_cmd,TRUE,	FALSE },
+  { PRE_CMD,	C_RNTO,	G_NONE, case_pre_modify_cmd,TRUE,	FALSE },
   { PRE_CMD,	C_SITE,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
   { PRE_CMD,	C_SIZE,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
   { PRE_CMD,	C_STAT,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
-  { PRE_CMD,	C_STOR,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
+  { PRE_CMD,	C_STOR,	G_NONE, case_pre_modify_cmd,TRUE,	FALSE },
   { PRE_CMD,	C_XCWD,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
-  { PRE_CMD,	C_XMKD,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
-  { PRE_CMD,	C_XRMD,	G_NONE, case_pre_cmd,	TRUE,	FALSE },
+  { PRE_CMD,	C_XMKD,	G_NONE, case_pre_modify_cmd,TRUE,	FALSE },
+  { PRE_CMD,	C_XRMD,	G_NONE, case_pre_modify_cmd,TRUE,	FALSE },
+
+  /* Keep the cached indexes of changed directories up to date.  Note that
+   * mod_sftp dispatches these commands for the corresponding SFTP requests,
+   * too.
+   */
+  { POST_CMD,	C_APPE,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD_ERR,C_APPE,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD,	C_DELE,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD_ERR,C_DELE,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD,	C_MKD,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD_ERR,C_MKD,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD,	C_RMD,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD_ERR,C_RMD,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD,	C_RNTO,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD_ERR,C_RNTO,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD,	C_STOR,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD_ERR,C_STOR,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD,	C_XMKD,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD_ERR,C_XMKD,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD,	C_XRMD,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
+  { POST_CMD_ERR,C_XRMD,	G_NONE, case_post_modify_cmd, FALSE, FALSE },
 
   /* The following are SFTP requests */
   { PRE_CMD,	"LINK",		G_NONE, case_pre_link,	TRUE,	FALSE },
@@ -1015,7 +6784,7 @@ module case_module = {
   NULL,
 
   /* Module initialization function */
-  NULL,
+  case_init,
 
   /* Session initialization function */
   case_sess_init,
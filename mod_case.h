@@ -0,0 +1,113 @@
+/*
+ * ProFTPD: mod_case -- provides case-insensivity
+ * Copyright (c) 2004-2025 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ */
+
+/* The on-disk CaseIndex format, shared by mod_case and the ftpcaseindex
+ * tool.  Neither depends on anything else, so that the tool can be built
+ * without the proftpd sources.  Also the keys of the command notes which
+ * mod_case leaves for other modules.
+ */
+
+#ifndef MOD_CASE_H
+#define MOD_CASE_H
+
+#include <stdint.h>
+
+/* An index file is the header, then the hash table of `nslots` slots, then
+ * the names table of `names_len` bytes.  All fields are in host byte order.
+ *
+ * The hash of a name is the 32-bit FNV-1a hash of its bytes, each folded by
+ * tolower(3); `fold_hash` is the FNV-1a hash of the 256-byte folding table,
+ * so that an index written under a different locale is not used.  Collisions
+ * are resolved by linear probing; the table is at most half full.  When
+ * several names differ only in case, only the first read from the directory
+ * is indexed.
+ *
+ * The checksum is the FNV-1a hash of everything after the header.  An index
+ * is only valid while its directory's device, inode, and mtime are as
+ * recorded, and only if that mtime precedes the second in which the directory
+ * was read.
+ */
+#define CASE_INDEX_MAGIC		0x49534346
+#define CASE_INDEX_VERSION		1
+#define CASE_INDEX_DEFAULT_MIN_ENTRIES	10000
+
+#define CASE_INDEX_FNV_OFFSET		2166136261U
+#define CASE_INDEX_FNV_PRIME		16777619U
+
+/* By default, the index for a directory is kept in a hidden subdirectory of
+ * it, so that replacing the index does not change the indexed directory's
+ * mtime.  Otherwise, indexes are kept in a configured directory, each named
+ * by the device and inode numbers of its directory, in hex:
+ * "<dev>-<ino>.idx".
+ */
+#define CASE_INDEX_SIDECAR_DIR		".ftpcase"
+#define CASE_INDEX_SIDECAR_FILE		"index"
+
+struct case_index_header {
+  uint32_t magic;
+  uint32_t version;
+
+  /* Hash of the case folding table used, since it depends on the locale. */
+  uint32_t fold_hash;
+
+  /* Checksum of everything after the header. */
+  uint32_t checksum;
+
+  /* The indexed directory, and when it was indexed. */
+  uint64_t dir_dev;
+  uint64_t dir_ino;
+  int64_t dir_mtime;
+  int64_t built;
+
+  uint32_t nslots;
+  uint32_t nnames;
+
+  /* Length of the names table, which starts with a NUL, so that an offset
+   * of zero marks an empty slot.
+   */
+  uint32_t names_len;
+  uint32_t padding;
+};
+
+struct case_index_slot {
+  uint32_t hash;
+  uint32_t name_off;
+};
+
+/* Once mod_case has resolved a command's path, in its PRE_CMD handler, it
+ * leaves the results in the command's notes: the path, as rewritten into the
+ * command; its struct stat, as of then, if it existed and its metadata was
+ * known; and its directory.  Later handlers can use these rather than looking
+ * up the path again.  For SITE COPY, and the SFTP LINK and SYMLINK requests,
+ * the source and destination paths have keys of their own.  With CaseFSIO,
+ * commands are not looked at, and there are no notes.
+ */
+#define CASE_NOTE_PATH			"mod_case.resolved-path"
+#define CASE_NOTE_STAT			"mod_case.resolved-stat"
+#define CASE_NOTE_DIR			"mod_case.resolved-dir"
+
+#define CASE_NOTE_SRC_PATH		"mod_case.resolved-src-path"
+#define CASE_NOTE_SRC_STAT		"mod_case.resolved-src-stat"
+#define CASE_NOTE_SRC_DIR		"mod_case.resolved-src-dir"
+
+#define CASE_NOTE_DST_PATH		"mod_case.resolved-dst-path"
+#define CASE_NOTE_DST_STAT		"mod_case.resolved-dst-stat"
+#define CASE_NOTE_DST_DIR		"mod_case.resolved-dst-dir"
+
+#endif /* MOD_CASE_H */
@@ -176,6 +176,101 @@ my $TESTS = {
     test_class => [qw(forking bug)],
   },
 
+  caseignore_cache_retr => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_shared_cache_retr => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_retr_existing_prefix => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_index_retr => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_cache_stor => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_cache_watch_retr => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_negative_cache_size => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_log_buffer => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_ctrls_stats => {
+    order => ++$order,
+    test_class => [qw(forking mod_ctrls rootprivs)],
+  },
+
+  caseignore_timing_size => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_fsio_counts => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_upload_policy_lower => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_probe => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_casefold_dir => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_fsio_mfmt => {
+    order => ++$order,
+    test_class => [qw(forking mod_facts)],
+  },
+
+  caseignore_cache_rename => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_index_dir_retr => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_log_buffer_full => {
+    order => ++$order,
+    test_class => [qw(forking)],
+  },
+
+  caseignore_fsio_directory_limit => {
+    order => ++$order,
+    test_class => [qw(forking mod_facts)],
+  },
+
 };
 
 sub new {
@@ -183,7 +278,21 @@ sub new {
 }
 
 sub list_tests {
-  return testsuite_get_runnable_tests($TESTS);
+  my @tests = testsuite_get_runnable_tests($TESTS);
+
+  # Casefolding needs filesystem support (e.g. ext4 created with "-O
+  # casefold"), and can only be set on an empty directory.
+  my $tmpdir = testsuite_get_tmp_dir();
+  my $casefold_dir = "$tmpdir/casefold.d";
+  mkpath($casefold_dir);
+
+  if (system("chattr +F $casefold_dir > /dev/null 2>&1") != 0) {
+    print STDERR "\n WARNING: Casefolded directories not supported, skipping caseignore_casefold_dir\n";
+    @tests = grep { $_ ne 'caseignore_casefold_dir' } @tests;
+  }
+
+  rmdir($casefold_dir);
+  return @tests;
 }
 
 # Support functions
@@ -3629,4 +3738,2534 @@ sub caseignore_multi_cwds_to_dst {
   test_cleanup($setup->{log_file}, $ex);
 }
 
+sub caseignore_cache_retr {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  # Use a subdirectory, since the server writes its own files into the
+  # home directory.
+  my $test_dir = File::Spec->rel2abs("$setup->{home_dir}/sub.d");
+  mkpath($test_dir);
+
+  my $test_file = File::Spec->rel2abs("$test_dir/test.txt");
+  create_test_file($setup, $test_file);
+
+  # Make sure the directory's mtime is not in the current second, so that
+  # the cached index of the directory can be trusted.
+  my $mtime = time() - 10;
+  unless (utime($mtime, $mtime, $test_dir)) {
+    die("Can't set mtime of $test_dir: $!");
+  }
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseCache => 'on',
+        CaseLog => $setup->{log_file},
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      foreach my $path (qw(sub.d/TeSt.TxT sub.d/TEST.TXT)) {
+        my $conn = $client->retr_raw($path);
+        unless ($conn) {
+          die("RETR $path failed: " . $client->response_code() . " " .
+            $client->response_msg());
+        }
+
+        my $buf;
+        while ($conn->read($buf, 25) > 0) {
+        }
+        eval { $conn->close(5) };
+
+        my $resp_code = $client->response_code();
+        my $resp_msg = $client->response_msg();
+        $self->assert_transfer_ok($resp_code, $resp_msg);
+      }
+
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $setup->{log_file}")) {
+      my $ok = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /found cached case-insensitive match 'test\.txt' for 'TEST\.TXT'/) {
+          $ok = 1;
+          last;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($ok, test_msg("Did not see expected cached match"));
+
+    } else {
+      die("Can't read $setup->{log_file}: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_shared_cache_retr {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  # Use a subdirectory, since the server writes its own files into the
+  # home directory.
+  my $test_dir = File::Spec->rel2abs("$setup->{home_dir}/sub.d");
+  mkpath($test_dir);
+
+  my $test_file = File::Spec->rel2abs("$test_dir/test.txt");
+  create_test_file($setup, $test_file);
+
+  # Make sure the directory's mtime is not in the current second, so that
+  # the shared cache entry can be trusted.
+  my $mtime = time() - 10;
+  unless (utime($mtime, $mtime, $test_dir)) {
+    die("Can't set mtime of $test_dir: $!");
+  }
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $setup->{log_file},
+        CaseSharedCache => 32,
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      # Each session resolves the same path; the second session should find
+      # the first session's match in the shared cache.
+      for (my $i = 0; $i < 2; $i++) {
+        my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+        $client->login($setup->{user}, $setup->{passwd});
+
+        my $conn = $client->retr_raw('sub.d/TeSt.TxT');
+        unless ($conn) {
+          die("RETR sub.d/TeSt.TxT failed: " . $client->response_code() . " " .
+            $client->response_msg());
+        }
+
+        my $buf;
+        while ($conn->read($buf, 25) > 0) {
+        }
+        eval { $conn->close(5) };
+
+        my $resp_code = $client->response_code();
+        my $resp_msg = $client->response_msg();
+        $self->assert_transfer_ok($resp_code, $resp_msg);
+
+        $client->quit();
+      }
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $setup->{log_file}")) {
+      my $ok = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /found shared cache entry 'sub\.d\/test\.txt' for 'sub\.d\/TeSt\.TxT'/) {
+          $ok = 1;
+          last;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($ok, test_msg("Did not see expected shared cache entry"));
+
+    } else {
+      die("Can't read $setup->{log_file}: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_retr_existing_prefix {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  my $sub_dir = File::Spec->rel2abs("$tmpdir/a/b/c/d");
+  create_test_dir($setup, $sub_dir);
+
+  my $test_file = File::Spec->rel2abs("$sub_dir/test.txt");
+  create_test_file($setup, $test_file);
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $setup->{log_file},
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      foreach my $path (qw(a/b/c/d/TeSt.TxT a/B/c/D/TEST.TXT)) {
+        my $conn = $client->retr_raw($path);
+        unless ($conn) {
+          die("RETR $path failed: " . $client->response_code() . " " .
+            $client->response_msg());
+        }
+
+        my $buf;
+        while ($conn->read($buf, 25) > 0) {
+        }
+        eval { $conn->close(5) };
+
+        my $resp_code = $client->response_code();
+        my $resp_msg = $client->response_msg();
+        $self->assert_transfer_ok($resp_code, $resp_msg);
+      }
+
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $setup->{log_file}")) {
+      my $ok = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /scanning from existing prefix '\.\/a\/b\/c\/d' \(4 of 5 components\)/) {
+          $ok = 1;
+          last;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($ok, test_msg("Did not see expected existing prefix"));
+
+    } else {
+      die("Can't read $setup->{log_file}: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_index_retr {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  # Use a subdirectory, since the server writes its own files into the
+  # home directory.  Create the index directory up front, as creating it
+  # changes the indexed directory.
+  my $test_dir = File::Spec->rel2abs("$setup->{home_dir}/sub.d");
+  mkpath("$test_dir/.ftpcase");
+
+  # Indexes are only trusted if written by the directory's owner.
+  if ($< == 0) {
+    unless (chown($setup->{uid}, $setup->{gid}, $test_dir,
+        "$test_dir/.ftpcase")) {
+      die("Can't set owner of $test_dir to $setup->{uid}/$setup->{gid}: $!");
+    }
+  }
+
+  my $test_file = File::Spec->rel2abs("$test_dir/test.txt");
+  create_test_file($setup, $test_file);
+
+  # Make sure the directory's mtime is not in the current second, so that
+  # the index of the directory can be trusted.
+  my $mtime = time() - 10;
+  unless (utime($mtime, $mtime, $test_dir)) {
+    die("Can't set mtime of $test_dir: $!");
+  }
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseIndex => 'on 1 sidecar',
+        CaseLog => $setup->{log_file},
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      foreach my $path (qw(sub.d/TeSt.TxT sub.d/TEST.TXT)) {
+        my $conn = $client->retr_raw($path);
+        unless ($conn) {
+          die("RETR $path failed: " . $client->response_code() . " " .
+            $client->response_msg());
+        }
+
+        my $buf;
+        while ($conn->read($buf, 25) > 0) {
+        }
+        eval { $conn->close(5) };
+
+        my $resp_code = $client->response_code();
+        my $resp_msg = $client->response_msg();
+        $self->assert_transfer_ok($resp_code, $resp_msg);
+      }
+
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $setup->{log_file}")) {
+      my $ok = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /found indexed case-insensitive match 'test\.txt' for 'TEST\.TXT'/) {
+          $ok = 1;
+          last;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($ok, test_msg("Did not see expected indexed match"));
+
+      $self->assert(-f "$test_dir/.ftpcase/index",
+        test_msg("Expected index file $test_dir/.ftpcase/index"));
+
+    } else {
+      die("Can't read $setup->{log_file}: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_cache_stor {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  # Use a subdirectory, since the server writes its own files into the
+  # home directory.
+  my $test_dir = File::Spec->rel2abs("$setup->{home_dir}/sub.d");
+  mkpath($test_dir);
+
+  my $test_file = File::Spec->rel2abs("$test_dir/test.txt");
+  create_test_file($setup, $test_file);
+
+  # Make sure the directory's mtime is not in the current second, so that
+  # the cached index of the directory can be trusted.
+  my $mtime = time() - 10;
+  unless (utime($mtime, $mtime, $test_dir)) {
+    die("Can't set mtime of $test_dir: $!");
+  }
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseCache => 'on',
+        CaseLog => $setup->{log_file},
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      my $conn = $client->retr_raw('sub.d/TeSt.TxT');
+      unless ($conn) {
+        die("RETR sub.d/TeSt.TxT failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      while ($conn->read($buf, 25) > 0) {
+      }
+      eval { $conn->close(5) };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      # The upload changes the directory; its cached index should be updated
+      # with the new name, rather than discarded.
+      $conn = $client->stor_raw('sub.d/New.txt');
+      unless ($conn) {
+        die("STOR sub.d/New.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $buf = "Hello, World!\n";
+      $conn->write($buf, length($buf), 5);
+      eval { $conn->close(5) };
+
+      $resp_code = $client->response_code();
+      $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      $conn = $client->retr_raw('sub.d/NEW.TXT');
+      unless ($conn) {
+        die("RETR sub.d/NEW.TXT failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      while ($conn->read($buf, 25) > 0) {
+      }
+      eval { $conn->close(5) };
+
+      $resp_code = $client->response_code();
+      $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $setup->{log_file}")) {
+      my $ok = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /found cached case-insensitive match 'New\.txt' for 'NEW\.TXT'/) {
+          $ok = 1;
+          last;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($ok, test_msg("Did not see expected cached match"));
+
+    } else {
+      die("Can't read $setup->{log_file}: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_cache_watch_retr {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  # Use a subdirectory, since the server writes its own files into the
+  # home directory.
+  my $test_dir = File::Spec->rel2abs("$setup->{home_dir}/sub.d");
+  mkpath($test_dir);
+
+  my $test_file = File::Spec->rel2abs("$test_dir/test.txt");
+  create_test_file($setup, $test_file);
+
+  # Make sure the directory's mtime is not in the current second, so that
+  # the cached index of the directory can be trusted.
+  my $mtime = time() - 10;
+  unless (utime($mtime, $mtime, $test_dir)) {
+    die("Can't set mtime of $test_dir: $!");
+  }
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseCache => 'on',
+        CaseCacheWatch => 'on',
+        CaseLog => $setup->{log_file},
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      foreach my $path (qw(sub.d/TeSt.TxT sub.d/TEST.TXT sub.d/tEsT.tXt)) {
+        my $conn = $client->retr_raw($path);
+        unless ($conn) {
+          die("RETR $path failed: " . $client->response_code() . " " .
+            $client->response_msg());
+        }
+
+        my $buf;
+        while ($conn->read($buf, 25) > 0) {
+        }
+        eval { $conn->close(5) };
+
+        my $resp_code = $client->response_code();
+        my $resp_msg = $client->response_msg();
+        $self->assert_transfer_ok($resp_code, $resp_msg);
+      }
+
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $setup->{log_file}")) {
+      my $ok = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /using watched cached index for directory '.*\/sub\.d'/) {
+          $ok = 1;
+          last;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($ok, test_msg("Did not see expected watched index"));
+
+    } else {
+      die("Can't read $setup->{log_file}: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_negative_cache_size {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  # Use a subdirectory, since the server writes its own files into the
+  # home directory.
+  my $test_dir = File::Spec->rel2abs("$setup->{home_dir}/sub.d");
+  mkpath($test_dir);
+
+  my $test_file = File::Spec->rel2abs("$test_dir/test.txt");
+  create_test_file($setup, $test_file);
+
+  # Make sure the directory's mtime is not in the current second, so that
+  # the cached lookup in the directory can be trusted.
+  my $mtime = time() - 10;
+  unless (utime($mtime, $mtime, $test_dir)) {
+    die("Can't set mtime of $test_dir: $!");
+  }
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseNegativeCache => 'on',
+        CaseLog => $setup->{log_file},
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      foreach my $path (qw(sub.d/NoSuch.TxT sub.d/NOSUCH.TXT)) {
+        eval { $client->size($path) };
+        unless ($@) {
+          die("SIZE $path succeeded unexpectedly");
+        }
+
+        my $resp_code = $client->response_code();
+        my $resp_msg = $client->response_msg();
+
+        my $expected = 550;
+        $self->assert($expected == $resp_code,
+          test_msg("Expected response code $expected, got $resp_code"));
+      }
+
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $setup->{log_file}")) {
+      my $ok = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /found negative cache entry for file 'NOSUCH\.TXT'/) {
+          $ok = 1;
+          last;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($ok, test_msg("Did not see expected negative cache entry"));
+
+    } else {
+      die("Can't read $setup->{log_file}: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_log_buffer {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  my $case_log = File::Spec->rel2abs("$tmpdir/case.log");
+
+  my $test_file = File::Spec->rel2abs("$setup->{home_dir}/test.txt");
+  create_test_file($setup, $test_file);
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $case_log,
+        CaseLogBuffer => 'on 4096 60',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      $client->size("TeSt.TxT");
+
+      # The message is only buffered, until the session ends.
+      $self->assert(-z $case_log,
+        test_msg("Expected empty $case_log before session exit"));
+
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $case_log")) {
+      my $ok = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /found case-insensitive match 'test\.txt' for 'TeSt\.TxT'/) {
+          $ok = 1;
+          last;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($ok, test_msg("Did not see expected buffered log message"));
+
+    } else {
+      die("Can't read $case_log: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub ftpdctl {
+  my $sock_file = shift;
+  my $ctrl_cmd = shift;
+
+  my $ftpdctl_bin;
+  if ($ENV{PROFTPD_TEST_PATH}) {
+    $ftpdctl_bin = "$ENV{PROFTPD_TEST_PATH}/ftpdctl";
+
+  } else {
+    $ftpdctl_bin = '../ftpdctl';
+  }
+
+  my $cmd = "$ftpdctl_bin -s $sock_file $ctrl_cmd";
+
+  if ($ENV{TEST_VERBOSE}) {
+    print STDERR "Executing ftpdctl: $cmd\n";
+  }
+
+  my @lines = `$cmd`;
+  return \@lines;
+}
+
+sub caseignore_ctrls_stats {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  my $ctrls_sock = File::Spec->rel2abs("$tmpdir/ctrls.sock");
+
+  my $test_file = File::Spec->rel2abs("$setup->{home_dir}/test.txt");
+  create_test_file($setup, $test_file);
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $setup->{log_file},
+        CaseControlsACLs => 'all allow user root',
+      },
+
+      'mod_ctrls.c' => {
+        ControlsEngine => 'on',
+        ControlsLog => $setup->{log_file},
+        ControlsSocket => $ctrls_sock,
+        ControlsACLs => 'all allow user root',
+        ControlsSocketACL => 'allow user root',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+      $client->size("TeSt.TxT");
+      $client->quit();
+
+      my $lines = ftpdctl($ctrls_sock, 'case stats');
+      my $stats = join('', @$lines);
+
+      $self->assert($stats =~ /lookups: 1\b/,
+        test_msg("Expected 1 lookup, got '$stats'"));
+      $self->assert($stats =~ /scan matches: 1, misses: 0/,
+        test_msg("Expected 1 scan match, got '$stats'"));
+
+      ftpdctl($ctrls_sock, 'case reset');
+      $lines = ftpdctl($ctrls_sock, 'case stats');
+      $stats = join('', @$lines);
+
+      $self->assert($stats =~ /lookups: 0\b/,
+        test_msg("Expected 0 lookups after reset, got '$stats'"));
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_timing_size {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  my $case_log = File::Spec->rel2abs("$tmpdir/case.log");
+
+  my $test_file = File::Spec->rel2abs("$setup->{home_dir}/test.txt");
+  create_test_file($setup, $test_file);
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $case_log,
+        CaseTiming => 'on',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      $client->size("TeSt.TxT");
+      $client->size("test.txt");
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $case_log")) {
+      my $ok = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /timing: SIZE: 2 calls, p50 <= \d+ usecs, p99 <= \d+ usecs, max \d+ usecs/) {
+          $ok = 1;
+          last;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($ok, test_msg("Did not see expected SIZE timing summary"));
+
+    } else {
+      die("Can't read $case_log: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_fsio_counts {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  my $case_log = File::Spec->rel2abs("$tmpdir/case.log");
+
+  # Keep the looked-up directories small, and apart from the files of the
+  # test setup, so that the budgets below do not depend on those.
+  my $test_dir = File::Spec->rel2abs("$tmpdir/case.d");
+  create_test_dir($setup, $test_dir);
+
+  my $sub_dir = File::Spec->rel2abs("$test_dir/SubDir");
+  create_test_dir($setup, $sub_dir);
+
+  my $test_file = File::Spec->rel2abs("$sub_dir/Test.txt");
+  create_test_file($setup, $test_file);
+
+  # The most filesystem calls, of each kind, allowed per command; the
+  # opendir/readdir budgets allow for one scan of each mismatched directory,
+  # and no more.
+  my $budgets = {
+    'LIST' => { opendir => 2, readdir => 16, open => 8, stat => 48 },
+    'CWD' => { opendir => 1, readdir => 8, open => 8, stat => 32 },
+    'RETR' => { opendir => 1, readdir => 8, open => 8, stat => 32 },
+    'SITE CHMOD' => { opendir => 1, readdir => 8, open => 8, stat => 32 },
+  };
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $case_log,
+        CaseFSIOCounts => 'on',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+      $client->cwd($test_dir);
+
+      my $conn = $client->list_raw('-a -l sUbDiR');
+      unless ($conn) {
+        die("Failed to LIST: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      $conn->read($buf, 8192, 25);
+      eval { $conn->close() };
+
+      $client->cwd('subdir');
+
+      $conn = $client->retr_raw('TEST.TXT');
+      unless ($conn) {
+        die("RETR TEST.TXT failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      while ($conn->read($buf, 25) > 0) {
+      }
+      eval { $conn->close(5) };
+
+      $client->site('CHMOD', '444', 'test.TXT');
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $case_log")) {
+      my $seen = {};
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /fsio: (.*?): opendir (\d+), readdir (\d+), open (\d+), stat (\d+)$/) {
+          my ($cmd, $counts) = ($1, {
+            opendir => $2,
+            readdir => $3,
+            open => $4,
+            stat => $5,
+          });
+
+          next unless defined($budgets->{$cmd});
+
+          # The first CWD is to the test directory, as given.
+          if ($cmd eq 'CWD' &&
+              !defined($seen->{'LIST'})) {
+            next;
+          }
+
+          $seen->{$cmd} = 1;
+
+          foreach my $call (sort(keys(%$counts))) {
+            my $budget = $budgets->{$cmd}->{$call};
+            $self->assert($counts->{$call} <= $budget,
+              test_msg("$cmd made $counts->{$call} $call calls, expected at most $budget"));
+          }
+        }
+      }
+
+      close($fh);
+
+      foreach my $cmd (sort(keys(%$budgets))) {
+        $self->assert($seen->{$cmd},
+          test_msg("Did not see expected $cmd FSIO counts"));
+      }
+
+    } else {
+      die("Can't read $case_log: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_upload_policy_lower {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  my $new_file = File::Spec->rel2abs("$setup->{home_dir}/newfile.txt");
+  my $sent_file = File::Spec->rel2abs("$setup->{home_dir}/NewFile.TXT");
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $setup->{log_file},
+        CaseUploadPolicy => 'lower',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      my $conn = $client->stor_raw("NewFile.TXT");
+      unless ($conn) {
+        die("STOR NewFile.TXT failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf = "Hello, World!\n";
+      $conn->write($buf, length($buf), 25);
+      eval { $conn->close() };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      # The file can be read back using any case.
+      $conn = $client->retr_raw("NEWFILE.txt");
+      unless ($conn) {
+        die("RETR NEWFILE.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      $buf = '';
+      $conn->read($buf, 8192, 25);
+      eval { $conn->close() };
+
+      $resp_code = $client->response_code();
+      $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+      $client->quit();
+
+      # Make sure that the file was created using the lowercased name...
+      $self->assert(-f $new_file,
+        test_msg("File '$new_file' does not exist as expected"));
+
+      # ...and not using the name as sent.  Unfortunately, we cannot do this
+      # check on MacOSX; its default filesystem is case-insensitive but
+      # case-preserving.  Yuck.
+      if ($^O ne 'darwin') {
+        $self->assert(!-f $sent_file,
+          test_msg("File '$sent_file' exists unexpectedly"));
+      }
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_probe {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  my $case_log = File::Spec->rel2abs("$tmpdir/case.log");
+
+  my $test_dir = File::Spec->rel2abs("$tmpdir/case.d");
+  create_test_dir($setup, $test_dir);
+
+  my $test_file = File::Spec->rel2abs("$test_dir/test.txt");
+  create_test_file($setup, $test_file);
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $case_log,
+        CaseFSIOCounts => 'on',
+        CaseProbe => 'on',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+      $client->cwd($test_dir);
+
+      my $conn = $client->retr_raw('TEST.TXT');
+      unless ($conn) {
+        die("RETR TEST.TXT failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      while ($conn->read($buf, 25) > 0) {
+      }
+      eval { $conn->close(5) };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $case_log")) {
+      my $seen = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        # The lowercase variant is found by probing, without reading the
+        # directory.
+        if ($line =~ /fsio: RETR: opendir (\d+), readdir (\d+),/) {
+          my ($nopendir, $nreaddir) = ($1, $2);
+          $seen = 1;
+
+          $self->assert($nopendir == 0 && $nreaddir == 0,
+            test_msg("RETR made $nopendir opendir, $nreaddir readdir calls, expected none"));
+        }
+      }
+
+      close($fh);
+
+      $self->assert($seen, test_msg("Did not see expected RETR FSIO counts"));
+
+    } else {
+      die("Can't read $case_log: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_casefold_dir {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  my $case_log = File::Spec->rel2abs("$tmpdir/case.log");
+
+  my $test_dir = File::Spec->rel2abs("$tmpdir/case.d");
+  create_test_dir($setup, $test_dir);
+
+  # Casefolding can only be set on an empty directory; list_tests() skips
+  # this test where it is not supported.
+  unless (system("chattr +F $test_dir > /dev/null 2>&1") == 0) {
+    die("Can't set casefold flag on $test_dir");
+  }
+
+  my $test_file = File::Spec->rel2abs("$test_dir/Test.txt");
+  create_test_file($setup, $test_file);
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $case_log,
+        CaseFSIOCounts => 'on',
+        CaseCasefold => 'on',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+      $client->cwd($test_dir);
+
+      my $conn = $client->stor_raw('NewFile.txt');
+      unless ($conn) {
+        die("STOR NewFile.txt failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf = "Hello, World!\n";
+      $conn->write($buf, length($buf), 25);
+      eval { $conn->close() };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $case_log")) {
+      my $seen = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        # The new name is not looked for in any other case, as the kernel
+        # already would have found it.
+        if ($line =~ /fsio: STOR: opendir (\d+), readdir (\d+),/) {
+          my ($nopendir, $nreaddir) = ($1, $2);
+          $seen = 1;
+
+          $self->assert($nopendir == 0 && $nreaddir == 0,
+            test_msg("STOR made $nopendir opendir, $nreaddir readdir calls, expected none"));
+        }
+      }
+
+      close($fh);
+
+      $self->assert($seen, test_msg("Did not see expected STOR FSIO counts"));
+
+    } else {
+      die("Can't read $case_log: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_fsio_mfmt {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  my $test_file = File::Spec->rel2abs("$setup->{home_dir}/test.txt");
+  create_test_file($setup, $test_file);
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $setup->{log_file},
+        CaseFSIO => 'on',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      # MFMT is not one of the commands whose paths are rewritten; the path
+      # is found by the FS.
+      my ($resp_code, $resp_msg) = $client->mfmt('20020717210715',
+        'TeSt.TxT');
+
+      my $expected = 213;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      # RETR's path is rewritten, as without CaseFSIO.
+      my $conn = $client->retr_raw('TEST.TXT');
+      unless ($conn) {
+        die("RETR TEST.TXT failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      $conn->read($buf, 8192, 25);
+      eval { $conn->close() };
+
+      $resp_code = $client->response_code();
+      $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+      $client->quit();
+
+      my $mtime = (stat($test_file))[9];
+      $expected = 1026940035;
+      $self->assert($expected == $mtime,
+        test_msg("Expected mtime $expected, got $mtime"));
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_cache_rename {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  # Use a subdirectory, since the server writes its own files into the
+  # home directory.
+  my $test_dir = File::Spec->rel2abs("$setup->{home_dir}/sub.d");
+  mkpath($test_dir);
+
+  my $test_file = File::Spec->rel2abs("$test_dir/test.txt");
+  create_test_file($setup, $test_file);
+
+  # Make sure the directory's mtime is not in the current second, so that
+  # the cached index of the directory can be trusted.
+  my $mtime = time() - 10;
+  unless (utime($mtime, $mtime, $test_dir)) {
+    die("Can't set mtime of $test_dir: $!");
+  }
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseCache => 'on',
+        CaseLog => $setup->{log_file},
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      my $conn = $client->retr_raw('sub.d/TeSt.TxT');
+      unless ($conn) {
+        die("RETR sub.d/TeSt.TxT failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      my $buf;
+      while ($conn->read($buf, 25) > 0) {
+      }
+      eval { $conn->close(5) };
+
+      my $resp_code = $client->response_code();
+      my $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      # The rename changes the directory; its cached index should be updated
+      # for both the resolved old name, and the new name.
+      $client->rnfr('sub.d/TEST.TXT');
+      $client->rnto('sub.d/Renamed.txt');
+
+      $conn = $client->retr_raw('sub.d/RENAMED.TXT');
+      unless ($conn) {
+        die("RETR sub.d/RENAMED.TXT failed: " . $client->response_code() . " " .
+          $client->response_msg());
+      }
+
+      while ($conn->read($buf, 25) > 0) {
+      }
+      eval { $conn->close(5) };
+
+      $resp_code = $client->response_code();
+      $resp_msg = $client->response_msg();
+      $self->assert_transfer_ok($resp_code, $resp_msg);
+
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $setup->{log_file}")) {
+      my $ok = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /found cached case-insensitive match 'Renamed\.txt' for 'RENAMED\.TXT'/) {
+          $ok = 1;
+          last;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($ok, test_msg("Did not see expected cached match"));
+
+    } else {
+      die("Can't read $setup->{log_file}: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_index_dir_retr {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  # Use a subdirectory, since the server writes its own files into the
+  # home directory.
+  my $test_dir = File::Spec->rel2abs("$setup->{home_dir}/sub.d");
+  mkpath($test_dir);
+
+  my $index_dir = File::Spec->rel2abs("$tmpdir/index.d");
+  mkpath($index_dir);
+
+  # Indexes are only trusted if written by the directory's owner.
+  if ($< == 0) {
+    unless (chown($setup->{uid}, $setup->{gid}, $test_dir, $index_dir)) {
+      die("Can't set owner of $test_dir to $setup->{uid}/$setup->{gid}: $!");
+    }
+  }
+
+  my $test_file = File::Spec->rel2abs("$test_dir/test.txt");
+  create_test_file($setup, $test_file);
+
+  # Make sure the directory's mtime is not in the current second, so that
+  # the index of the directory can be trusted.
+  my $mtime = time() - 10;
+  unless (utime($mtime, $mtime, $test_dir)) {
+    die("Can't set mtime of $test_dir: $!");
+  }
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseIndex => "on 1 $index_dir",
+        CaseLog => $setup->{log_file},
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      foreach my $path (qw(sub.d/TeSt.TxT sub.d/TEST.TXT)) {
+        my $conn = $client->retr_raw($path);
+        unless ($conn) {
+          die("RETR $path failed: " . $client->response_code() . " " .
+            $client->response_msg());
+        }
+
+        my $buf;
+        while ($conn->read($buf, 25) > 0) {
+        }
+        eval { $conn->close(5) };
+
+        my $resp_code = $client->response_code();
+        my $resp_msg = $client->response_msg();
+        $self->assert_transfer_ok($resp_code, $resp_msg);
+      }
+
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $setup->{log_file}")) {
+      my $ok = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /found indexed case-insensitive match 'test\.txt' for 'TEST\.TXT'/) {
+          $ok = 1;
+          last;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($ok, test_msg("Did not see expected indexed match"));
+
+      my $dev_ino = sprintf("%x-%x", (stat($test_dir))[0, 1]);
+      $self->assert(-f "$index_dir/$dev_ino.idx",
+        test_msg("Expected index file $index_dir/$dev_ino.idx"));
+
+      # Nothing is written into the indexed directory itself.
+      $self->assert(!-e "$test_dir/.ftpcase",
+        test_msg("Unexpected index directory $test_dir/.ftpcase"));
+
+    } else {
+      die("Can't read $setup->{log_file}: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_log_buffer_full {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  my $case_log = File::Spec->rel2abs("$tmpdir/case.log");
+
+  my $test_file = File::Spec->rel2abs("$setup->{home_dir}/test.txt");
+  create_test_file($setup, $test_file);
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $case_log,
+        CaseLogBuffer => 'on 1024 60',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      # Log more messages than fit in the buffer.
+      for (my $i = 0; $i < 20; $i++) {
+        $client->size("TeSt.TxT");
+      }
+
+      # A full buffer is not written while commands are handled; the
+      # messages which do not fit are dropped instead.
+      $self->assert(-z $case_log,
+        test_msg("Expected empty $case_log before session exit"));
+
+      $client->quit();
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  eval {
+    if (open(my $fh, "< $case_log")) {
+      my $nmatches = 0;
+      my $ndropped = 0;
+
+      while (my $line = <$fh>) {
+        chomp($line);
+
+        if ($line =~ /found case-insensitive match 'test\.txt' for 'TeSt\.TxT'/) {
+          $nmatches++;
+        }
+
+        if ($line =~ /dropped (\d+) buffered log messages/) {
+          $ndropped = $1;
+        }
+      }
+
+      close($fh);
+
+      $self->assert($nmatches > 0 && $nmatches < 20,
+        test_msg("Expected some, but not all, messages; saw $nmatches"));
+      $self->assert($ndropped > 0 && $nmatches + $ndropped >= 20,
+        test_msg("Expected dropped messages to be counted; saw $ndropped"));
+
+    } else {
+      die("Can't read $case_log: $!");
+    }
+  };
+  if ($@) {
+    $ex = $@;
+  }
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
+sub caseignore_fsio_directory_limit {
+  my $self = shift;
+  my $tmpdir = $self->{tmpdir};
+  my $setup = test_setup($tmpdir, 'case');
+
+  my $test_dir = File::Spec->rel2abs("$setup->{home_dir}/sub.d");
+  mkpath($test_dir);
+
+  my $test_file = File::Spec->rel2abs("$test_dir/test.txt");
+  create_test_file($setup, $test_file);
+
+  my $config = {
+    PidFile => $setup->{pid_file},
+    ScoreboardFile => $setup->{scoreboard_file},
+    SystemLog => $setup->{log_file},
+    TraceLog => $setup->{log_file},
+    Trace => 'case:20',
+
+    AuthUserFile => $setup->{auth_user_file},
+    AuthGroupFile => $setup->{auth_group_file},
+    AuthOrder => 'mod_auth_file.c',
+
+    Directory => {
+      $test_dir => {
+        Limit => {
+          'READ WRITE' => {
+            DenyAll => '',
+          },
+        },
+      },
+    },
+
+    IfModules => {
+      'mod_case.c' => {
+        CaseEngine => 'on',
+        CaseIgnore => 'on',
+        CaseLog => $setup->{log_file},
+        CaseFSIO => 'on',
+      },
+
+      'mod_delay.c' => {
+        DelayEngine => 'off',
+      },
+    },
+  };
+
+  my ($port, $config_user, $config_group) = config_write($setup->{config_file},
+    $config);
+
+  # Open pipes, for use between the parent and child processes.  Specifically,
+  # the child will indicate when it's done with its test by writing a message
+  # to the parent.
+  my ($rfh, $wfh);
+  unless (pipe($rfh, $wfh)) {
+    die("Can't open pipe: $!");
+  }
+
+  my $ex;
+
+  # Fork child
+  $self->handle_sigchld();
+  defined(my $pid = fork()) or die("Can't fork: $!");
+  if ($pid) {
+    eval {
+      my $client = ProFTPD::TestSuite::FTP->new('127.0.0.1', $port);
+      $client->login($setup->{user}, $setup->{passwd});
+
+      # The <Directory> section does not match the path as given, but does
+      # match the path which the FS finds for it.
+      eval { $client->mfmt('20020717210715', 'SUB.D/TeSt.TxT') };
+      unless ($@) {
+        die("MFMT SUB.D/TeSt.TxT succeeded unexpectedly");
+      }
+
+      my $resp_code = $client->response_code();
+      my $expected = 550;
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      # RETR's path is rewritten, and so checked by the core as usual.
+      my $conn = $client->retr_raw('SUB.D/TEST.TXT');
+      if ($conn) {
+        die("RETR SUB.D/TEST.TXT succeeded unexpectedly");
+      }
+
+      $resp_code = $client->response_code();
+      $self->assert($expected == $resp_code,
+        test_msg("Expected response code $expected, got $resp_code"));
+
+      $client->quit();
+
+      my $mtime = (stat($test_file))[9];
+      $self->assert($mtime != 1026940035,
+        test_msg("MFMT changed mtime of $test_file"));
+    };
+    if ($@) {
+      $ex = $@;
+    }
+
+    $wfh->print("done\n");
+    $wfh->flush();
+
+  } else {
+    eval { server_wait($setup->{config_file}, $rfh) };
+    if ($@) {
+      warn($@);
+      exit 1;
+    }
+
+    exit 0;
+  }
+
+  # Stop server
+  server_stop($setup->{pid_file});
+  $self->assert_child_ok($pid);
+
+  test_cleanup($setup->{log_file}, $ex);
+}
+
 1;